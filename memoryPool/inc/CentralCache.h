@@ -3,271 +3,699 @@
 #ifndef CENTRAL_CACHE_H
 #define CENTRAL_CACHE_H
 #include "Conmmon.h"
+#include "Hardening.h"
+#include "LatencyHistogram.h"
+#include "Numa.h"
+#include "ObjectPool.h"
 #include "PageCache.h"
+#include "SpinLock.h"
+#include "Stats.h"
+#include "TransferCache.h"
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <csignal>
+#include <cstdlib>
+#include <mutex>
 #include <thread>
 
+/**
+ * @class CentralCache
+ * @brief 中心缓存，每个 NUMA 节点一个实例
+ *
+ * 向同一节点的页缓存申请Span，内存块归还时回到所属Span的节点的中心缓存。
+ * 新的Span不在申请时整个切分成链表，而是用 bumpNext 按地址顺序从未切分的区域中切出内存块，
+ * 每次只写入这次取走的内存块；快速消耗Span的大小类可以由后台线程（startRefiller）预先补充Span
+ */
 class CentralCache
 {
 public:
     /**
-     * @brief 获取 CentralCache 的单例实例
-     * @return CentralCache& 返回中心缓存的单例引用
+     * @brief 获取当前线程所在节点的 CentralCache 实例
+     * @return CentralCache& 返回中心缓存的引用
      *
-     * 使用单例模式确保整个系统只有一个中心缓存实例
+     * 只有一个节点时整个系统只有一个中心缓存实例
      */
-    static CentralCache &getInstance()
+    static CentralCache &getInstance() { return forNode(Numa::currentNode()); }
+
+    /**
+     * @brief 获取指定节点的 CentralCache 实例，第一次使用时创建
+     */
+    static CentralCache &forNode(size_t node)
+    {
+        std::atomic<CentralCache *> *instances = nodeInstances();
+        CentralCache *cache = instances[node].load(std::memory_order_acquire);
+        if (cache)
+            return *cache;
+
+        static ObjectPool<CentralCache> pool;
+        std::lock_guard<std::mutex> lock(createMutex());
+        cache = instances[node].load(std::memory_order_relaxed);
+        if (!cache)
+        {
+            cache = pool.allocate();
+            if (!cache)
+                abort();
+            cache->node_ = node;
+            instances[node].store(cache, std::memory_order_release);
+            instanceCount_.fetch_add(1, std::memory_order_release);
+        }
+        return *cache;
+    }
+
+    /**
+     * @brief 已经创建的节点中心缓存，未创建时返回nullptr
+     */
+    static CentralCache *existingNode(size_t node)
     {
-        static CentralCache instance;
-        return instance;
+        return node < MAX_NUMA_NODES ? nodeInstances()[node].load(std::memory_order_acquire) : nullptr;
     }
 
     /**
      * @brief 从中心缓存获取指定索引的内存范围
      * @param index 内存块大小的索引
-     * @param batchNum 批量获取的内存块数量
-     * @return T* 获取到的内存指针
+     * @param batchNum 期望批量获取的内存块数量
+     * @param actualNum 实际获取到的内存块数量（可能小于batchNum）
+     * @param owner 申请内存块的线程缓存，见 claimSpan()
+     * @return T* 获取到的内存链表头指针，链表以nullptr结尾
+     *
+     * 请求一个完整批次时先从传输缓存整批取走，取不到时
+     * 依次从该大小类还有空闲内存块的Span上取内存块，
+     * 一个空闲内存块都没有时才向页缓存申请新的Span，申请期间不持有大小类的锁
      */
     template <typename T, typename N>
-    T *fetchRange(N index, N batchNum)
+    T *fetchRange(N index, N batchNum, N &actualNum, void *owner = nullptr)
     {
+        actualNum = 0;
         // 检查索引是否在有效范围内，以及批量获取数量是否为正
         if (index >= FREE_LIST_SIZE || batchNum == 0)
             return nullptr;
 
+        if (batchNum == SizeClass::getBatchNum(index))
+        {
+            void *tail = nullptr;
+            if (void *head = transferCache_.remove(index, tail))
+            {
+                actualNum = batchNum;
+                claimBatch(head, owner);
+                return static_cast<T *>(head);
+            }
+        }
+
         /**
-         * @brief 尝试获取锁
-         *  使用的是 memory_order_acquire    获取顺序
-         *  所有后续的内存读写操作不会被重排到该  内存序操作之前
+         * @brief 获取该大小类的锁
          *
-         * 使用std::atomic_flag::test_and_set()方法尝试获取锁。
-         * 如果锁已经被其他线程持有，则返回false，表示获取失败。
-         * 如果锁未被持有，则将锁设置为锁定状态，并返回true，表示获取成功。
-         * 使用自旋锁，避免线程上下文切换，提高并发性能。
+         * 锁被占用时先短暂自旋，持锁线程迟迟不释放（例如被抢占）时在 futex 上休眠，
+         * 不会反复调用 sched_yield 耗尽等待线程的时间片
          * ! 获取锁成功后继续执行
          */
-        while (locks_[index].test_and_set(std::memory_order_acquire))
-        {
-            // 让出当前线程的执行时间片，避免在锁竞争中无谓地消耗CPU资源
-            std::this_thread::yield();
-        }
+        locks_[index].lock();
+        ClassCounters &counters = counters_[index];
+        counterAdd<uint64_t>(counters.transferMisses, 1);
 
-        T *result = nullptr;
+        void *head = nullptr;
+        void *tail = nullptr;
         try
         {
-            /**
-             * @brief 获取锁成功后，从中央缓存中获取内存块
-             *  使用的是 memory_order_relaxed 宽松顺序
-             *  不保证内存操作的顺序，只保证操作的原子性
-             */
-            result = centralFreeList_[index].load(std::memory_order_relaxed);
-            if (!result)
+            SpanList &list = spanLists_[index];
+            while (actualNum < batchNum)
             {
-                // 找到具体的内存块 （下标+1）*8
-                N size = (index + 1) * ALIGNMENT;
-                // 如果中央缓存中没有内存块，则从页缓存获取内存块
-                result = fetchFromPageCache<T, N>(size);
-                if (!result)
-                {
-                    locks_[index].clear(std::memory_order_release);
-                    return nullptr;
-                }
-                char *start = static_cast<char *>(result);
-                // 计算可以分配的内存块数量
-                N totalBlocks = (SPAN_PAGES * PAGE_SIZE) / size;
-                // 计算实际可以分配的内存块数量
-                N allocBlocks = std::min(batchNum, totalBlocks);
-                if (allocBlocks > 1)
+                if (list.empty())
                 {
-                    // 如果可以分配的内存块数量大于1，则将内存块连接成链表
-                    for (N i = 1; i < allocBlocks; ++i)
-                    {
-                        void *current = start + (i - 1) * size;
-                        void *next = start + i * size;
-                        *reinterpret_cast<void **>(current) = next;
-                    }
-                    *reinterpret_cast<void **>(start + (allocBlocks - 1) * size) = nullptr;
+                    // 已经拿到一部分时不再申请新的Span，避免为了凑满一个批次多占一个Span
+                    if (actualNum > 0)
+                        break;
+                    // 页缓存的分配（可能包括 mmap）不占用这个大小类的锁，其他线程可以继续归还内存块
+                    locks_[index].unlock();
+                    Span *span = fetchFromPageCache(index);
+                    locks_[index].lock();
+                    if (!span)
+                        break;
+                    list.pushFront(span);
+                    counterAdd<uint64_t>(counters.spanFetches, 1);
+                    counterAdd<size_t>(counters.spans, 1);
                 }
-                // 构建保留在CentralCache的链表
-                if (totalBlocks > allocBlocks)
-                {
-                    void *remainStart = start + allocBlocks * size;
-                    for (size_t i = allocBlocks + 1; i < totalBlocks; ++i)
-                    {
-                        void *current = start + (i - 1) * size;
-                        void *next = start + i * size;
-                        *reinterpret_cast<void **>(current) = next;
-                    }
-                    *reinterpret_cast<void **>(start + (totalBlocks - 1) * size) = nullptr;
-
-                    centralFreeList_[index].store(remainStart, std::memory_order_release);
-                }
-            }
-            else  // 如果中心缓存有index对应大小的内存块
-            {
-                // 从现有链表中获取指定数量的块
-                void *current = result;
-                void *prev = nullptr;
-                size_t count = 0;
 
-                while (current && count < batchNum)
+                // 从Span上取一段内存块
+                Span *span = list.begin();
+                void *start = nullptr;
+                void *end = nullptr;
+                size_t count = takeBlocks(span, batchNum - actualNum, start, end);
+                span->useCount += count;
+                claimSpan(span, owner);
+                // Span上的内存块全部分配出去后从链表摘除，归还内存块时再挂回来
+                if (!hasFreeBlocks(span))
                 {
-                    prev = current;
-                    current = *reinterpret_cast<void **>(current);
-                    count++;
+                    SpanList::erase(span);
+                    noteDepleted(counters);
                 }
 
-                if (prev)  // 当前centralFreeList_[index]链表上的内存块大于batchNum时需要用到
-                {
-                    *reinterpret_cast<void **>(prev) = nullptr;
-                }
-
-                centralFreeList_[index].store(current, std::memory_order_release);
+                // 把这一段接到结果链表的尾部
+                FreeList::setNext(end, nullptr);
+                if (tail)
+                    FreeList::setNext(tail, start);
+                else
+                    head = start;
+                tail = end;
+                actualNum += count;
             }
         }
         catch (...)
         {
-            locks_[index].clear(std::memory_order_release);
+            locks_[index].unlock();
             throw;
         }
+        counterAdd<size_t>(counters.outstanding, actualNum);
 
         // 释放锁
-        locks_[index].clear(std::memory_order_release);
-        return result;
+        locks_[index].unlock();
+        return static_cast<T *>(head);
     }
 
 
     /**
      * @brief 将内存范围返回给中心缓存
-     * @param ptr 要返回的内存指针
-     * @param size 内存块大小
-     * @param bytes 实际使用的字节数
+     * @param ptr 要返回的内存链表头指针
+     * @param size 链表中内存块的数量
+     * @param index 大小类的索引
+     * @param tail 链表的尾节点，调用方已知时传入，省去一次遍历
+     *
+     * 正好一个完整批次时先尝试整批放入传输缓存：存在多个节点的实例时先检查批次中的内存块
+     * 都属于这个节点，全部属于另一个节点时整批转交给那个节点，混合的批次按下面的慢路径逐个处理；
+     * 否则每个内存块通过页表找到所属的Span，放回Span的空闲链表并减少 useCount，
+     * 一个Span上的内存块全部归还后，整个Span还给页缓存，可以被合并后用于其他大小类。
+     * 属于其他节点的内存块先按节点串起来，释放锁之后转交给对应节点的中心缓存
      */
     template <typename T, typename N>
-    void returnRange(T *ptr, N size, N index)
+    void returnRange(T *ptr, N size, N index, void *tail = nullptr)
     {
 
         // 当索引大于等于FREE_LIST_SIZE时，说明内存过大应直接向系统归还
         if (!ptr || index >= FREE_LIST_SIZE)
             return;
 
-        while (locks_[index].test_and_set(std::memory_order_acquire))
+        if (size == SizeClass::getBatchNum(index))
         {
-            std::this_thread::yield();
+            size_t batchNode = node_;
+            if (instanceCount_.load(std::memory_order_acquire) > 1)
+                batchNode = nodeOfBatch(ptr, size, tail);
+            else if (!tail)
+            {
+                tail = ptr;
+                for (N i = 1; i < size; i++)
+                    tail = FreeList::next(tail);
+            }
+            if (batchNode == node_)
+            {
+                if (transferCache_.insert(index, ptr, tail))
+                    return;
+            }
+            else if (batchNode < MAX_NUMA_NODES)
+            {
+                forNode(batchNode).returnRange(ptr, size, index, tail);
+                return;
+            }
         }
 
+        PageCache &pageCache = PageCache::forNode(node_);
+        // 完全空闲的Span先串成链表，释放锁之后再还给页缓存，缩短持锁时间
+        Span *freeSpans = nullptr;
+        // 其他节点的内存块
+        void *remote[MAX_NUMA_NODES] = {};
+        N remoteCount[MAX_NUMA_NODES] = {};
+
+        locks_[index].lock();
+        ClassCounters &counters = counters_[index];
+
         try
         {
-            // 找到要归还的链表的最后一个节点
-            T *end = ptr;
-            N count = 1;
-            while (*reinterpret_cast<T **>(end) != nullptr && count < size)
+            void *current = ptr;
+            N count = 0;
+            while (current && count < size)
             {
-                end = *reinterpret_cast<T **>(end);
+                void *next = FreeList::next(current);
+                Span *span = PageCache::mapObjectToSpan(current);
                 count++;
-            }
+                if (span->node != node_)
+                {
+                    FreeList::setNext(current, remote[span->node]);
+                    remote[span->node] = current;
+                    remoteCount[span->node]++;
+                    current = next;
+                    continue;
+                }
 
-            // 将归还的链表连接到中心缓存的链表头部
-            T *current = centralFreeList_[index].load(std::memory_order_relaxed);
-            *reinterpret_cast<T **>(end) = current;  // 将原链表头接到归还链表的尾部
-            centralFreeList_[index].store(
-                ptr,
-                std::memory_order_release);  // 将归还的链表头设为新的链表头
+                // 之前Span上的内存块全部分配出去了，重新挂回该大小类的链表
+                if (!hasFreeBlocks(span))
+                {
+                    spanLists_[index].pushFront(span);
+                }
+                FreeList::setNext(current, span->freeList);
+                span->freeList = current;
+                counterSub<size_t>(counters.outstanding, 1);
+
+                if (--span->useCount == 0)
+                {
+                    SpanList::erase(span);
+                    span->next = freeSpans;
+                    freeSpans = span;
+                    counterSub<size_t>(counters.spans, 1);
+                }
+                current = next;
+            }
         }
         catch (...)
         {
-            locks_[index].clear(std::memory_order_release);
+            locks_[index].unlock();
             throw;
         }
 
-        locks_[index].clear(std::memory_order_release);
+        locks_[index].unlock();
+
+        while (freeSpans)
+        {
+            Span *next = freeSpans->next;
+            pageCache.deallocateSpan(freeSpans->PageAddr, freeSpans->sizePages);
+            freeSpans = next;
+        }
+
+        for (size_t node = 0; node < MAX_NUMA_NODES; node++)
+        {
+            if (remote[node])
+                forNode(node).returnRange(remote[node], remoteCount[node], index);
+        }
     }
 
-private:
     /**
-     * @brief 私有构造函数，初始化中心缓存
+     * @brief 把各个大小类的Span数量、空闲内存块数和命中次数累加到统计中
      *
-     * 初始化自由链表和自旋锁数组
+     * 这里的空闲内存块数是Span上的空闲块，传输缓存里的块由 TransferCache::collectStats 统计
      */
-    CentralCache()
+    void collectStats(MemoryPoolStats &stats) const
     {
-        for (auto &ptr : centralFreeList_)
+        for (size_t index = 0; index < FREE_LIST_SIZE; index++)
         {
-            /**
-             * @brief 存储一个空指针到自由链表中
-             * @param ptr 要存储的指针
-             * @param order 宽松顺序
-             */
-            ptr.store(nullptr, std::memory_order_relaxed);
+            const ClassCounters &counters = counters_[index];
+            ClassStats &c = stats.classes[index];
+            size_t spans = counters.spans.load(std::memory_order_relaxed);
+            size_t spanBytes = spans * SizeClass::getSpanPages(index) * PAGE_SIZE;
+            size_t outstanding = counters.outstanding.load(std::memory_order_relaxed);
+            size_t blocks = spans * (SizeClass::getSpanPages(index) * PAGE_SIZE / SizeClass::getSize(index));
+            c.spans += spans;
+            c.spanBytes += spanBytes;
+            c.centralObjects += blocks > outstanding ? blocks - outstanding : 0;
+            // 先记下从Span取走的数量，汇总时减去传输缓存和用户持有的数量得到线程缓存中的数量
+            c.frontObjects += outstanding;
+            c.transferMisses += counters.transferMisses.load(std::memory_order_relaxed);
+            c.spanFetches += counters.spanFetches.load(std::memory_order_relaxed);
+            c.lockContentions += locks_[index].contentions();
+            transferCache_.collectStats(index, c);
         }
-        for (auto &lock : locks_)
+    }
+
+    /**
+     * @brief 为正在快速消耗Span的大小类预先准备一个Span
+     * @return size_t 补充的Span数
+     *
+     * 只处理Span链表已经取空的大小类，下一次未命中时不需要再等页缓存；
+     * 申请Span时不持有大小类的锁，放入时链表已经不为空（其他线程刚申请过）就把Span还给页缓存
+     */
+    size_t refillHotClasses()
+    {
+        size_t refilled = 0;
+        for (size_t index = 0; index < FREE_LIST_SIZE; index++)
         {
-            /**
-             * @brief 清除自旋锁
+            ClassCounters &counters = counters_[index];
+            if (!counters.hot.load(std::memory_order_relaxed) || !counters.hot.exchange(false, std::memory_order_relaxed))
+                continue;
+            locks_[index].lock();
+            bool empty = spanLists_[index].empty();
+            locks_[index].unlock();
+            if (!empty)
+                continue;
 
-             */
-            lock.clear();
+            Span *span = fetchFromPageCache(index);
+            if (!span)
+                continue;
+            locks_[index].lock();
+            empty = spanLists_[index].empty();
+            if (empty)
+            {
+                spanLists_[index].pushFront(span);
+                counterAdd<uint64_t>(counters.spanFetches, 1);
+                counterAdd<size_t>(counters.spans, 1);
+            }
+            locks_[index].unlock();
+            if (empty)
+                refilled++;
+            else
+                PageCache::forNode(node_).deallocateSpan(span->PageAddr, span->sizePages);
         }
+        return refilled;
     }
 
     /**
-     * @brief 从中心缓存获取指定大小的内存
-     * @param size 请求的内存大小
-     * @return void* 获取到的内存指针
+     * @brief 启动后台补充线程
+     * @param intervalMs 两次检查之间的间隔（毫秒）
+     * @return bool 启动成功返回true，已经在运行或创建线程失败返回false
+     *
+     * 一个线程依次处理所有已创建节点的中心缓存
      */
-    template <typename T, typename N>
-    T *fetchFromPageCache(N size)
+    static bool startRefiller(size_t intervalMs = REFILL_INTERVAL_MS)
     {
-        N Size_Index = (size + PAGE_SIZE - 1) / PAGE_SIZE;
-        if (Size_Index <= SPAN_PAGES * PAGE_SIZE)
-        {  // 小于等于32KB的请求，使用固定8页
-            return PageCache::GetInstance().allocateSpan<T, N>(SPAN_PAGES);
+        int expected = REFILLER_STOPPED;
+        if (!refillerState_.compare_exchange_strong(expected, REFILLER_RUNNING))
+            return false;
+        try
+        {
+            std::thread([intervalMs]() {
+                while (refillerState_.load(std::memory_order_acquire) == REFILLER_RUNNING)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+                    for (size_t node = 0; node < MAX_NUMA_NODES; node++)
+                    {
+                        if (CentralCache *cache = existingNode(node))
+                            cache->refillHotClasses();
+                    }
+                }
+                refillerState_.store(REFILLER_STOPPED, std::memory_order_release);
+            }).detach();
         }
-        else
+        catch (...)
         {
-            // 大于32KB的请求，按实际需求分配
-            return PageCache::GetInstance().allocateSpan<T, N>(Size_Index);
+            refillerState_.store(REFILLER_STOPPED, std::memory_order_release);
+            return false;
         }
+        return true;
     }
 
+    /**
+     * @brief 停止后台补充线程，等待线程退出后返回
+     */
+    static void stopRefiller()
+    {
+        int expected = REFILLER_RUNNING;
+        if (!refillerState_.compare_exchange_strong(expected, REFILLER_STOPPING))
+            return;
+        while (refillerState_.load(std::memory_order_acquire) != REFILLER_STOPPED)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    /**
+     * @brief fork 之前获取创建实例的锁和所有节点的大小类锁、传输缓存锁
+     *
+     * 由 ThreadCache 注册的 pthread_atfork 处理函数调用。其他线程持有锁时 fork，
+     * 子进程中的锁永远不会被释放；先拿到所有锁，fork 之后父子进程各自释放。
+     * 正常路径上大小类的锁可能在持有时获取传输缓存的锁，反过来不会，所以先拿大小类的锁
+     */
+    static void prepareFork()
+    {
+        createMutex().lock();
+        for (size_t node = 0; node < MAX_NUMA_NODES; node++)
+        {
+            if (CentralCache *cache = existingNode(node))
+            {
+                for (SpinLock &lock : cache->locks_)
+                {
+                    lock.lock();
+                }
+                cache->transferCache_.prepareFork();
+            }
+        }
+    }
+
+    /**
+     * @brief fork 之后释放 prepareFork() 获取的锁
+     * @param child 是否在子进程中：子进程里补充线程不存在了，状态改为已停止，可以重新启动
+     */
+    static void afterFork(bool child)
+    {
+        for (size_t node = 0; node < MAX_NUMA_NODES; node++)
+        {
+            if (CentralCache *cache = existingNode(node))
+            {
+                cache->transferCache_.afterFork(child);
+                for (SpinLock &lock : cache->locks_)
+                {
+                    if (child)
+                        lock.unlockInChild();
+                    else
+                        lock.unlock();
+                }
+            }
+        }
+        createMutex().unlock();
+        if (child)
+            refillerState_.store(REFILLER_STOPPED, std::memory_order_release);
+    }
 
 private:
+    friend class ObjectPool<CentralCache>;
+
+    static std::atomic<CentralCache *> *nodeInstances()
+    {
+        static std::atomic<CentralCache *> instances[MAX_NUMA_NODES] = {};
+        return instances;
+    }
+
+    static std::mutex &createMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    /**
+     * @brief 私有构造函数，防止外部创建实例
+     *
+     * 锁和Span链表由各自的构造函数初始化
+     */
+    CentralCache() = default;
+
     /**
-     * @brief 中心缓存自由链表数组
+     * @brief 从页缓存获取一个新的Span，并切分成该大小类的内存块
+     * @param index 大小类的索引
+     * @return Span* 切分好的Span，失败返回nullptr
      *
-     * 这个数组存储了各种不同大小内存块的空闲链表头指针，数组大小由FREE_LIST_SIZE常量决定，
-     * 每个索引位置对应一种特定大小的内存块。
+     * 在Span上记录大小类，释放时可以只凭指针找到大小类。
+     * 新的Span还不属于任何线程缓存，第一次取走内存块时由 claimSpan() 记录所有者。
+     * 调用时不持有大小类的锁：fetchRange 在 try 块中先释放锁再调用它，所以不能抛出异常
+     */
+    Span *fetchFromPageCache(size_t index) noexcept
+    {
+        MEMPOOL_LATENCY_SCOPE(LATENCY_SPAN_FETCH);
+        size_t size = SizeClass::getSize(index);
+        size_t numPages = SizeClass::getSpanPages(index);
+        PageCache &pageCache = PageCache::forNode(node_);
+        char *start = pageCache.allocateSpan<char>(numPages);
+        if (!start)
+            return nullptr;
+
+        Span *span = pageCache.mapObjectToSpan(start);
+        span->sizeClass = index;
+        span->objSize = size;
+        span->useCount = 0;
+        span->owner.store(nullptr, std::memory_order_relaxed);
+
+        // 不切分，取内存块时再从 bumpNext 开始按地址顺序切出，不访问还没有用到的页
+        size_t totalBlocks = (numPages * PAGE_SIZE) / size;
+        span->freeList = nullptr;
+        span->bumpNext = start;
+        span->bumpEnd = start + totalBlocks * size;
+        return span;
+    }
+
+    /**
+     * @brief 记录线程缓存从Span上取走了内存块
+     *
+     * 第一个取内存块的线程缓存成为Span的所有者；之后有其他线程缓存（或不属于线程缓存的调用方）
+     * 也取走内存块时，Span标记为共用，释放时不再交还给任何一个线程缓存。
+     * 传输缓存的批次不持有大小类的锁，所以用 CAS 修改
+     */
+    static void claimSpan(Span *span, void *owner)
+    {
+        void *current = span->owner.load(std::memory_order_relaxed);
+        while (current != owner && current != Span::sharedOwner())
+        {
+            void *desired = current ? Span::sharedOwner() : owner;
+            if (span->owner.compare_exchange_weak(current, desired, std::memory_order_relaxed))
+                break;
+        }
+    }
+
+    /**
+     * @brief 从传输缓存整批取走时，对批次中的每个Span调用 claimSpan
+     *
+     * 批次中相邻的内存块通常在同一个Span上，只在离开上一个Span的范围时查页表
+     */
+    static void claimBatch(void *head, void *owner)
+    {
+        Span *span = nullptr;
+        char *begin = nullptr;
+        char *end = nullptr;
+        for (void *block = head; block; block = FreeList::next(block))
+        {
+            char *address = static_cast<char *>(block);
+            if (address >= begin && address < end)
+                continue;
+            span = PageCache::mapObjectToSpan(block);
+            begin = static_cast<char *>(span->PageAddr);
+            end = begin + span->sizePages * PAGE_SIZE;
+            claimSpan(span, owner);
+        }
+    }
+
+    /**
+     * @brief 批次中的内存块所属的节点，同时找到尾节点
+     * @return size_t 全部属于同一个节点时返回节点编号，属于多个节点时返回 MAX_NUMA_NODES
+     */
+    template <typename N>
+    static size_t nodeOfBatch(void *head, N size, void *&tail)
+    {
+        size_t node = PageCache::mapObjectToSpan(head)->node;
+        void *current = head;
+        for (N i = 1; i < size; i++)
+        {
+            current = FreeList::next(current);
+            if (PageCache::mapObjectToSpan(current)->node != node)
+                node = MAX_NUMA_NODES;
+        }
+        tail = current;
+        return node;
+    }
+
+    /**
+     * @brief Span上是否还有可以分配的内存块（归还过的，或者还没有切分过的）
+     */
+    static bool hasFreeBlocks(const Span *span) { return span->freeList || span->bumpNext < span->bumpEnd; }
+
+    /**
+     * @brief 从Span上取最多 want 个内存块，调用方持有大小类的锁
+     * @param start 取到的第一个内存块
+     * @param end 取到的最后一个内存块，它的 next 由调用方设置
+     * @return size_t 取到的数量，Span上有空闲内存块时至少为1
      *
-     * 数组中每个元素是std::atomic<void*>类型，使用原子操作确保在多线程环境下安全访问和修改，
-     * 避免了数据竞争，提高了并发性能。
+     * 先取归还过的空闲链表（已经连好，只需要找到截断的位置），
+     * 不够时再从未切分的区域切出，只写入这次取走的内存块的 next
+     */
+    static size_t takeBlocks(Span *span, size_t want, void *&start, void *&end)
+    {
+        size_t count = 0;
+        if (span->freeList)
+        {
+            start = end = span->freeList;
+            count = 1;
+            while (count < want && FreeList::next(end))
+            {
+                end = FreeList::next(end);
+                count++;
+            }
+            span->freeList = FreeList::next(end);
+        }
+
+        char *bump = static_cast<char *>(span->bumpNext);
+        char *limit = static_cast<char *>(span->bumpEnd);
+        if (count < want && bump < limit)
+        {
+            size_t size = span->objSize;
+            size_t n = std::min(want - count, static_cast<size_t>(limit - bump) / size);
+            if (end)
+                FreeList::setNext(end, bump);
+            else
+                start = bump;
+            for (size_t i = 1; i < n; i++)
+            {
+                FreeList::setNext(bump + (i - 1) * size, bump + i * size);
+            }
+            end = bump + (n - 1) * size;
+            span->bumpNext = bump + n * size;
+            count += n;
+        }
+        return count;
+    }
+
+
+
+private:
+    /**
+     * @brief 中心缓存的Span链表数组
      *
-     * 在内存布局上，这是一个连续的数组，每个元素占用一个指针大小（通常是4字节或8字节，取决于系统位数）。
-     * 数组的每个元素初始化为nullptr，表示该大小类别的空闲链表最初为空。
+     * 每个大小类一个链表，挂着这个大小类中还有空闲内存块的Span，
+     * 每个Span维护自己的空闲内存块链表和已分配数量 useCount。
      *
-     * 在实际工作中，当线程请求或释放内存时，会按照内存大小找到对应的索引位置，然后
-     * 操作该位置的链表头指针，实现内存的分配和回收。
+     * 1. 分配时从链表头部的Span上取内存块，Span取空后从链表摘除
+     * 2. 归还时内存块回到各自所属的Span上，全部归还后Span还给页缓存
+     * 3. 这样某个大小类的突发分配结束后，内存可以重新用于其他大小类
      */
-    std::array<std::atomic<void *>, FREE_LIST_SIZE> centralFreeList_;
+    std::array<SpanList, FREE_LIST_SIZE> spanLists_;
 
     /**
-     * @brief 自旋锁数组
+     * @brief 锁数组
      *
-     * 这个数组与centralFreeList_一一对应，为每个自由链表提供独立的锁保护机制，
+     * 这个数组与spanLists_一一对应，为每个大小类提供独立的锁保护机制，
      * 实现了细粒度的锁控制，提高了并发访问效率。
      *
-     * 使用std::atomic_flag实现自旋锁而非互斥锁，自旋锁在竞争不激烈的情况下可以减少
-     * 线程上下文切换的开销，特别适合短时间持有的锁场景。
+     * 使用 SpinLock 而非互斥锁：临界区很短，竞争不激烈时自旋就能拿到锁，
+     * 持锁线程被抢占时等待线程在 futex 上休眠。
      *
-     * 在内存布局上，每个atomic_flag通常占用1个字节，整个数组是连续分配的内存区域。
-     * 每个锁初始化为未锁定状态（通过clear()方法）。
+     * 每个锁独占一个缓存行，不同大小类的锁之间不会伪共享。
      *
      * 在多线程访问时，当一个线程需要修改特定大小类别的链表时，会先尝试获取对应的锁，
      * 确保同一时刻只有一个线程能修改该链表，避免数据不一致问题。
      * 不同大小类别的内存操作可以并行进行，提高了系统吞吐量。
      */
-    std::array<std::atomic_flag, FREE_LIST_SIZE> locks_;
+    std::array<SpinLock, FREE_LIST_SIZE> locks_;
+
+    /**
+     * @brief 传输缓存
+     *
+     * 位于Span链表之前，线程缓存之间整批交换内存块，大多数请求不需要获取上面的自旋锁
+     */
+    TransferCache transferCache_;
+
+    /**
+     * @brief 每个大小类的统计计数器，只在持有 locks_[index] 时修改
+     *
+     * outstanding 是从Span上取走、还没有还回Span的内存块数（包括传输缓存中的）；
+     * lastDepletedMs 是上一个Span被取空的时间，hot 表示需要预先补充Span，由补充线程清除
+     */
+    struct ClassCounters
+    {
+        std::atomic<size_t> spans{0};
+        std::atomic<size_t> outstanding{0};
+        std::atomic<uint64_t> transferMisses{0};
+        std::atomic<uint64_t> spanFetches{0};
+        std::atomic<uint64_t> lastDepletedMs{0};
+        std::atomic<bool> hot{false};
+    };
+    std::array<ClassCounters, FREE_LIST_SIZE> counters_;
+
+    /**
+     * @brief 一个Span被取空：与上一个Span取空的间隔足够短时，把大小类标记为需要预先补充
+     */
+    static void noteDepleted(ClassCounters &counters)
+    {
+        uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                 std::chrono::steady_clock::now().time_since_epoch())
+                                                 .count());
+        uint64_t last = counters.lastDepletedMs.load(std::memory_order_relaxed);
+        if (last && now - last <= REFILL_HOT_MS && !counters.hot.load(std::memory_order_relaxed))
+            counters.hot.store(true, std::memory_order_relaxed);
+        counters.lastDepletedMs.store(now, std::memory_order_relaxed);
+    }
+
+    // 所属的NUMA节点
+    size_t node_ = 0;
+
+    // 已经创建的实例数，只有一个时所有内存块都属于它，整批归还时不需要检查节点
+    static inline std::atomic<size_t> instanceCount_{0};
+
+    // 后台补充线程的状态
+    static constexpr int REFILLER_STOPPED = 0;
+    static constexpr int REFILLER_RUNNING = 1;
+    static constexpr int REFILLER_STOPPING = 2;
+    static inline std::atomic<int> refillerState_{REFILLER_STOPPED};
 };
 
-#endif
\ No newline at end of file
+#endif
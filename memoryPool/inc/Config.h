@@ -0,0 +1,220 @@
+// 运行时配置
+
+#ifndef CONFIG_H
+#define CONFIG_H
+#include "Conmmon.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sched.h>
+
+/**
+ * @struct MemoryPoolConfig
+ * @brief 启动时读取一次的调优参数
+ *
+ * 第一次使用内存池时从环境变量 MEMPOOL_CONF 读取，格式为逗号分隔的 key=value，例如
+ *     MEMPOOL_CONF=thread_cache_max=2MB,max_list_length=1024,release_rate=0
+ * 数值可以带 K、M、G（以及 KB、MB、GB）后缀，不区分大小写；有任何一项无法解析时整个字符串被忽略。
+ * 程序也可以在第一次分配之前调用 configure() 代替环境变量，之后配置不再改变。
+ *
+ * 大小类、页大小、Span页数等决定数组大小和编译期查找表的参数不能在运行时修改，仍然在 Conmmon.h 中
+ */
+struct MemoryPoolConfig
+{
+    size_t threadCacheBytes = THREAD_CACHE_BYTES;    ///< thread_cache_max：所有线程缓存的字节数预算
+    size_t maxListLength = MAX_FREE_LIST_LENGTH;     ///< max_list_length：每个自由链表的长度上限
+    size_t releaseRate = RELEASE_RATE;               ///< release_rate：空闲内存归还操作系统的速率（字节/秒）
+    size_t retainBytes = RETAIN_BYTES;               ///< retain_bytes：每个节点保留不归还的空闲内存
+    size_t directMmapBytes = DIRECT_MMAP_BYTES;      ///< direct_mmap：单独mmap的阈值
+    size_t madvFree = 0;                             ///< madv_free：非0时用 MADV_FREE 归还
+    size_t sampleRate = 0;                           ///< sample_rate：堆分析的平均采样间隔，0表示关闭
+    size_t guardPages = 0;                           ///< guard_pages：非0时加固模式下大对象末尾加一个保护页
+
+    /**
+     * @brief 解析 key=value 形式的配置字符串
+     * @param spec 配置字符串，nullptr 或空字符串表示全部使用默认值
+     * @param config 解析结果，从 config 原有的值开始修改；失败时保持不变
+     * @return bool 有未知的 key 或无法解析的数值时返回false
+     *
+     * 不分配内存，可以在内存池初始化的过程中调用
+     */
+    static bool parse(const char *spec, MemoryPoolConfig &config)
+    {
+        MemoryPoolConfig result = config;
+        const char *p = spec ? spec : "";
+        while (*p)
+        {
+            const char *key = p;
+            while (*p && *p != '=' && *p != ',')
+                p++;
+            size_t keyLength = static_cast<size_t>(p - key);
+            if (*p != '=')
+                return false;
+            p++;
+            size_t *field = result.fieldOf(key, keyLength);
+            if (!field || !parseValue(p, *field))
+                return false;
+            if (*p == ',')
+                p++;
+        }
+        if (result.maxListLength == 0)
+            return false;
+        config = result;
+        return true;
+    }
+
+    /**
+     * @brief 当前的配置，第一次调用时从 MEMPOOL_CONF 读取
+     */
+    static const MemoryPoolConfig &get()
+    {
+        if (__builtin_expect(state_.load(std::memory_order_acquire) != LOADED, 0))
+            load(nullptr);
+        return storage();
+    }
+
+    /**
+     * @brief 在第一次使用内存池之前设置配置，代替 MEMPOOL_CONF
+     * @return bool 配置已经被读取（内存池已经开始使用）时返回false，配置不变
+     */
+    static bool configure(const MemoryPoolConfig &config) { return load(&config); }
+
+    /**
+     * @brief 解析预热的配置，格式为逗号分隔的 大小=数量，例如 "64=1000,256=200,64K=16"
+     * @param visit 对每一项调用 visit(size, count)
+     * @return bool 格式错误时返回false，这时不调用 visit
+     */
+    template <typename F>
+    static bool parseWarmup(const char *spec, F &&visit)
+    {
+        // 第一遍只检查格式，第二遍才调用 visit
+        for (int pass = 0; pass < 2; pass++)
+        {
+            const char *p = spec ? spec : "";
+            while (*p)
+            {
+                size_t size = 0;
+                size_t count = 0;
+                if (!parseValue(p, size, '=') || *p != '=' || !parseValue(++p, count, ','))
+                    return false;
+                if (pass)
+                    visit(size, count);
+                if (*p == ',')
+                    p++;
+            }
+        }
+        return true;
+    }
+
+private:
+    static constexpr int UNLOADED = 0;
+    static constexpr int LOADING = 1;
+    static constexpr int LOADED = 2;
+
+    static MemoryPoolConfig &storage()
+    {
+        static MemoryPoolConfig config;
+        return config;
+    }
+
+    /**
+     * @brief 只有第一个调用的线程写入配置，同时调用的其他线程等待它完成
+     * @param config 程序指定的配置，nullptr 表示读取环境变量
+     */
+    static bool load(const MemoryPoolConfig *config)
+    {
+        int expected = UNLOADED;
+        if (!state_.compare_exchange_strong(expected, LOADING, std::memory_order_acquire))
+        {
+            while (state_.load(std::memory_order_acquire) != LOADED)
+            {
+                sched_yield();
+            }
+            return false;
+        }
+        if (config)
+            storage() = *config;
+        else
+            parse(getenv("MEMPOOL_CONF"), storage());
+        state_.store(LOADED, std::memory_order_release);
+        return true;
+    }
+
+    size_t *fieldOf(const char *key, size_t length)
+    {
+        struct Field
+        {
+            const char *name;
+            size_t MemoryPoolConfig::*member;
+        };
+        static const Field fields[] = {
+            {"thread_cache_max", &MemoryPoolConfig::threadCacheBytes},
+            {"max_list_length", &MemoryPoolConfig::maxListLength},
+            {"release_rate", &MemoryPoolConfig::releaseRate},
+            {"retain_bytes", &MemoryPoolConfig::retainBytes},
+            {"direct_mmap", &MemoryPoolConfig::directMmapBytes},
+            {"madv_free", &MemoryPoolConfig::madvFree},
+            {"sample_rate", &MemoryPoolConfig::sampleRate},
+            {"guard_pages", &MemoryPoolConfig::guardPages},
+        };
+        for (const Field &field : fields)
+        {
+            if (strlen(field.name) == length && strncmp(field.name, key, length) == 0)
+                return &(this->*field.member);
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 解析一个数值和可选的单位后缀，p 移动到数值之后的 end 或字符串末尾
+     */
+    static bool parseValue(const char *&p, size_t &value, char end = ',')
+    {
+        if (*p < '0' || *p > '9')
+            return false;
+        size_t number = 0;
+        for (; *p >= '0' && *p <= '9'; p++)
+        {
+            if (__builtin_mul_overflow(number, size_t(10), &number) ||
+                __builtin_add_overflow(number, static_cast<size_t>(*p - '0'), &number))
+                return false;
+        }
+        size_t shift = 0;
+        switch (*p)
+        {
+        case 'k':
+        case 'K':
+            shift = 10;
+            break;
+        case 'm':
+        case 'M':
+            shift = 20;
+            break;
+        case 'g':
+        case 'G':
+            shift = 30;
+            break;
+        default:
+            break;
+        }
+        if (shift)
+        {
+            p++;
+            if (*p == 'b' || *p == 'B')
+                p++;
+            if (number > (SIZE_MAX >> shift))
+                return false;
+            number <<= shift;
+        }
+        if (*p && *p != end)
+            return false;
+        value = number;
+        return true;
+    }
+
+    static inline std::atomic<int> state_{UNLOADED};
+};
+
+#endif
@@ -11,6 +11,7 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 /**
  * 内存对齐的最小值，设置为8b
  * 1. 保证所有分配的内存都是8字节对齐的
@@ -21,20 +22,23 @@ static constexpr size_t ALIGNMENT = 8;
 
 /**
  * 内存池管理的最大内存块大小：256KB
- * 1. 超过这个大小的内存请求将直接使用系统malloc
+ * 1. 超过这个大小的内存请求不再经过自由链表，直接向页缓存申请整页的Span
  * 2. 256KB是一个比较合理的阈值，能覆盖大多数小对象分配
  * 3. 避免内存池管理过大的内存块，影响性能
  */
 static constexpr size_t MAX_BYTES = 256 * 1024;
 
 /**
- * 自由链表的大小（数组大小）
- * 1. 计算方法：最大内存大小 / 对齐大小  （256KB / 8B = 32768B）
- * 2. 例如：256KB / 8B = 32768，表示有32768个不同大小的内存块类别
- * 3. 每个位置i对应的内存块大小为：(i + 1) * ALIGNMENT
- * 4. 形成内存块大小序列：8B, 16B, 24B, ..., 256KB
+ * 自由链表的大小（数组大小），即大小类的数量
+ * 1. 8B ~ 128B 按 8 字节递增，共16个大小类
+ * 2. 128B 以上每个 2 的幂区间 [2^k, 2^(k+1)] 等分成 8 份，步长为 2^(k-3)，
+ *    128B ~ 256KB 共 11 个区间、88 个大小类
+ * 3. 合计 104 个大小类，128B 以上的内部碎片不超过 1/8（12.5%）
+ * 4. 形成内存块大小序列：8B, 16B, ..., 128B, 144B, 160B, ..., 224KB, 256KB
  */
-static constexpr size_t FREE_LIST_SIZE = MAX_BYTES / ALIGNMENT;
+static constexpr size_t SMALL_CLASS_MAX = 128;
+static constexpr size_t CLASS_STEPS_PER_OCTAVE = 8;
+static constexpr size_t FREE_LIST_SIZE = SMALL_CLASS_MAX / ALIGNMENT + 11 * CLASS_STEPS_PER_OCTAVE;
 
 
 /**
@@ -55,6 +59,182 @@ static constexpr size_t SPAN_PAGES = 8;  // 一个span 包含8页
  * 在Linux系统中，标准页面大小通常为4KB
  */
 static constexpr size_t PAGE_SIZE = 4096;  // 4k 页大小
+static constexpr size_t PAGE_SHIFT = 12;   // 地址右移 PAGE_SHIFT 位得到页号
+static_assert((size_t(1) << PAGE_SHIFT) == PAGE_SIZE, "PAGE_SHIFT 必须与 PAGE_SIZE 对应");
+
+
+/**
+ * 大页模式（MEMPOOL_HUGE_PAGES）下向系统申请内存的粒度
+ * 1. 每次预留至少 ARENA_SIZE（32MB）、按 HUGE_PAGE_SIZE（2MB）对齐的区域
+ * 2. 优先使用 MAP_HUGETLB，系统没有预留大页时退回普通映射并 madvise(MADV_HUGEPAGE)
+ * 3. 整个区域作为一个空闲Span放入页缓存，之后的Span都从中切分
+ */
+static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+static constexpr size_t ARENA_SIZE = 32 * 1024 * 1024;
+
+
+/**
+ * 支持的最大 NUMA 节点数量
+ * 每个节点有自己的页缓存和中心缓存，节点编号超过该值时按取模合并
+ */
+static constexpr size_t MAX_NUMA_NODES = 8;
+
+
+/**
+ * 页缓存按页数分组管理空闲Span的最大页数
+ * 1. 不超过128页（512KB）的空闲Span按页数挂在各自的链表上，查找时 O(1) 定位
+ * 2. 超过128页的空闲Span统一挂在一个链表上，查找时选择最合适的
+ */
+static constexpr size_t MAX_FREE_PAGES = 128;
+
+
+/**
+ * 页缓存中小Span的无锁槽位
+ * 1. 不超过 READY_SPAN_MAX_PAGES 页的Span释放后先放进对应页数的槽位，同样页数的请求直接取走，不加锁
+ * 2. 每种页数最多 READY_SPAN_SLOTS 个槽位，槽位中的Span总字节数不超过 READY_SPAN_BYTES（至少一个）
+ */
+static constexpr size_t READY_SPAN_MAX_PAGES = 16;
+static constexpr size_t READY_SPAN_SLOTS = 16;
+static constexpr size_t READY_SPAN_BYTES = 256 * 1024;
+
+
+/**
+ * 超大对象直接映射的默认参数
+ * 1. 不小于 DIRECT_MMAP_BYTES（8MB）的请求单独mmap，不参与Span的分割与合并，避免把堆切碎
+ * 2. 释放后先放进缓存链表，之后大小相近的请求直接复用，不需要系统调用
+ * 3. 缓存超过 DIRECT_CACHE_BYTES 时，最早放入的映射被munmap
+ */
+static constexpr size_t DIRECT_MMAP_BYTES = 8 * 1024 * 1024;
+static constexpr size_t DIRECT_CACHE_BYTES = 64 * 1024 * 1024;
+
+
+/**
+ * 空闲内存归还操作系统（scavenger）的默认参数
+ * 1. 空闲Span至少闲置 SPAN_IDLE_MS 毫秒才会被归还，避免刚释放就被再次申请时反复缺页
+ * 2. 每隔 SCAVENGE_INTERVAL_MS 毫秒最多归还 RELEASE_RATE 字节/秒 × 间隔 的内存
+ * 3. 页缓存中未归还的空闲内存不超过 RETAIN_BYTES 时不再归还，保留一部分热内存
+ */
+static constexpr size_t SPAN_IDLE_MS = 1000;
+static constexpr size_t SCAVENGE_INTERVAL_MS = 100;
+static constexpr size_t RELEASE_RATE = 16 * 1024 * 1024;
+static constexpr size_t RETAIN_BYTES = 64 * 1024 * 1024;
+
+
+/**
+ * 线程缓存与中心缓存之间一个批次的内存块数量限制
+ * 1. 一个批次的总字节数不超过 MAX_BATCH_BYTES（64KB）
+ * 2. 小对象一个批次最多 MAX_BATCH_NUM 个，避免一次拿走过多内存
+ * 3. 大对象一个批次至少 MIN_BATCH_NUM 个，保证每次访问中心缓存都有收益
+ */
+static constexpr size_t MAX_BATCH_BYTES = 64 * 1024;
+static constexpr size_t MAX_BATCH_NUM = 128;
+static constexpr size_t MIN_BATCH_NUM = 2;
+
+
+/**
+ * 中心缓存前面的传输缓存（TransferCache）容量
+ * 1. 每个大小类最多缓存 TRANSFER_CACHE_SLOTS 个完整批次
+ * 2. 每个大小类缓存的总字节数不超过 TRANSFER_CACHE_BYTES，但至少能放下一个批次
+ */
+static constexpr size_t TRANSFER_CACHE_SLOTS = 64;
+static constexpr size_t TRANSFER_CACHE_BYTES = 512 * 1024;
+
+
+/**
+ * SpinLock 拿不到锁时自旋的上限
+ * 每轮 pause 的次数从1开始翻倍，超过 SPIN_MAX_PAUSES 后在 futex 上休眠
+ */
+static constexpr size_t SPIN_MAX_PAUSES = 256;
+
+
+/**
+ * 按CPU划分的缓存（MEMPOOL_PERCPU_CACHE）容量
+ * 1. 每个CPU的每个大小类最多缓存 PERCPU_MAX_ITEMS 个内存块
+ * 2. 每个大小类在一个CPU上缓存的总字节数不超过 PERCPU_CLASS_BYTES，但至少 MIN_BATCH_NUM 个
+ */
+static constexpr size_t PERCPU_MAX_ITEMS = 64;
+static constexpr size_t PERCPU_CLASS_BYTES = 64 * 1024;
+
+
+/**
+ * 线程缓存中单个自由链表的动态长度上限
+ * 1. 每个自由链表的长度上限从1开始慢启动，未命中时逐步增长，最大到 MAX_FREE_LIST_LENGTH
+ *    （可以通过 MEMPOOL_CONF 的 max_list_length 修改）
+ * 2. 归还时链表长度连续超过上限 MAX_LENGTH_OVERAGES 次，上限缩小一个批次
+ */
+static constexpr size_t MAX_FREE_LIST_LENGTH = 8192;
+static constexpr size_t MAX_LENGTH_OVERAGES = 3;
+
+
+/**
+ * 线程缓存的字节数预算（动态分配给各个线程，参考 tcmalloc）
+ * 1. 所有线程缓存的上限之和为 THREAD_CACHE_BYTES，可以通过 MEMPOOL_CONF 的 thread_cache_max 修改
+ * 2. 新线程的上限是 THREAD_CACHE_MIN_BYTES，缓存超过上限时先归还一半，再为自己增加 THREAD_CACHE_STEAL_BYTES：
+ *    优先从还没有分配出去的预算中取，没有时从其他线程的上限中取，一个线程最多增长到 THREAD_CACHE_MAX_BYTES
+ */
+static constexpr size_t THREAD_CACHE_BYTES = 32 * 1024 * 1024;
+static constexpr size_t THREAD_CACHE_MIN_BYTES = 512 * 1024;
+static constexpr size_t THREAD_CACHE_MAX_BYTES = 4 * 1024 * 1024;
+static constexpr size_t THREAD_CACHE_STEAL_BYTES = 64 * 1024;
+
+
+/**
+ * 跨线程释放的远程队列长度上限
+ * 内存块释放到其他线程的远程队列里，该大小类的队列超过 REMOTE_FREE_BATCHES 个批次时，
+ * 说明所属线程很久没有取用，释放的线程把整条队列还给中心缓存
+ */
+static constexpr size_t REMOTE_FREE_BATCHES = 4;
+
+
+/**
+ * 中心缓存预先补充Span
+ * 1. 一个大小类连续两个Span被取空的间隔不超过 REFILL_HOT_MS 毫秒时，认为它正在快速消耗Span
+ * 2. 后台补充线程每 REFILL_INTERVAL_MS 毫秒检查一次，为Span链表已经取空的这类大小类预先申请一个Span
+ */
+static constexpr size_t REFILL_HOT_MS = 10;
+static constexpr size_t REFILL_INTERVAL_MS = 5;
+
+
+/**
+ * 加固模式（MEMPOOL_HARDENED）下每个内存块末尾的状态标记
+ * 分配时写入“已分配”，释放时检查后改为“已释放”：标记是“已释放”说明重复释放，
+ * 两者都不是说明从前面越界写到了这里
+ */
+#if MEMPOOL_HARDENED
+static constexpr size_t HARDENED_TAG_BYTES = sizeof(uintptr_t);
+#else
+static constexpr size_t HARDENED_TAG_BYTES = 0;
+#endif
+
+
+/**
+ * 单调分配区域（MonotonicRegion）每次向页缓存申请的Span大小
+ * 1. 第一个Span为 REGION_CHUNK_PAGES 页，之后每次翻倍，最大 REGION_MAX_CHUNK_PAGES 页
+ * 2. 超过当前Span一半的请求单独申请一个Span，不浪费当前Span剩余的空间
+ */
+static constexpr size_t REGION_CHUNK_PAGES = 16;
+static constexpr size_t REGION_MAX_CHUNK_PAGES = 256;
+
+
+/**
+ * 采样堆分析（HeapProfiler）
+ * 1. 采样关闭时，线程每分配 PROFILE_RECHECK_BYTES 字节检查一次是否已经开启
+ * 2. 最多同时记录 PROFILE_MAX_SAMPLES 个存活的采样，每个采样最多 PROFILE_MAX_DEPTH 层调用栈
+ * 3. 采样表按地址开放寻址，最多探测 PROFILE_MAX_PROBES 个位置，找不到空位时丢弃这个采样
+ */
+static constexpr size_t PROFILE_RECHECK_BYTES = 1024 * 1024;
+static constexpr size_t PROFILE_MAX_SAMPLES = 8192;
+static constexpr size_t PROFILE_MAX_DEPTH = 32;
+static constexpr size_t PROFILE_MAX_PROBES = 64;
+
+
+/**
+ * 慢路径延迟直方图（MEMPOOL_LATENCY_HISTOGRAM）的分桶
+ * 1. 每个 2 的幂区间等分成 2^LATENCY_SUB_BUCKET_BITS 个桶，记录的值与桶的上界相差不超过 1/8
+ * 2. 超过 2^LATENCY_MAX_BITS 个时钟周期的记录计入最后一个桶
+ */
+static constexpr size_t LATENCY_SUB_BUCKET_BITS = 3;
+static constexpr size_t LATENCY_MAX_BITS = 40;
 
 
 // 内存块头部信息
@@ -65,61 +245,151 @@ struct BlockHeader
     BlockHeader *next;  // 指向下一个内存块
 };
 
+/**
+ * 大小类查找表的分段点以及查表位置的数量
+ * 1. 小于等于 SMALL_LOOKUP_MAX 的大小按 8 字节粒度查表
+ * 2. 更大的大小按 128 字节粒度查表
+ */
+static constexpr size_t SMALL_LOOKUP_MAX = 1024;
+static constexpr size_t LOOKUP_SLOTS = ((MAX_BYTES + 127 + (120 << 7)) >> 7) + 1;
+
+// 编译期生成的大小类查找表
+struct SizeClassTables
+{
+    size_t classSize[FREE_LIST_SIZE] = {};          // 大小类 -> 内存块大小
+    size_t classPages[FREE_LIST_SIZE] = {};         // 大小类 -> Span 页数
+    size_t classBatch[FREE_LIST_SIZE] = {};         // 大小类 -> 批次数量上限
+    unsigned char classIndex[LOOKUP_SLOTS] = {};    // 查表位置 -> 大小类
+};
+
+static constexpr SizeClassTables buildSizeClassTables()
+{
+    SizeClassTables t{};
+    size_t index = 0;
+    // 1. 8B ~ 128B 按 ALIGNMENT 递增
+    for (size_t size = ALIGNMENT; size <= SMALL_CLASS_MAX; size += ALIGNMENT)
+    {
+        t.classSize[index++] = size;
+    }
+    // 2. 每个 2 的幂区间等分成 CLASS_STEPS_PER_OCTAVE 份
+    for (size_t base = SMALL_CLASS_MAX; base < MAX_BYTES; base *= 2)
+    {
+        size_t step = base / CLASS_STEPS_PER_OCTAVE;
+        for (size_t size = base + step; size <= base * 2; size += step)
+        {
+            t.classSize[index++] = size;
+        }
+    }
+
+    for (size_t i = 0; i < FREE_LIST_SIZE; i++)
+    {
+        size_t size = t.classSize[i];
+        // Span 页数：至少 SPAN_PAGES 页且能放下一个内存块，尾部浪费超过 1/8 时继续加页
+        size_t pages = std::max(SPAN_PAGES, (size + PAGE_SIZE - 1) / PAGE_SIZE);
+        while ((pages * PAGE_SIZE) % size > (pages * PAGE_SIZE) / 8)
+        {
+            pages++;
+        }
+        t.classPages[i] = pages;
+        t.classBatch[i] = std::max(MIN_BATCH_NUM, std::min(MAX_BATCH_BYTES / size, MAX_BATCH_NUM));
+    }
+
+    // 3. 每个查表位置映射到第一个能容纳该位置最大字节数的大小类
+    size_t cls = 0;
+    for (size_t slot = 0; slot < LOOKUP_SLOTS; slot++)
+    {
+        size_t maxBytes = slot <= SMALL_LOOKUP_MAX / 8 ? slot * 8 : (slot << 7) - (120 << 7);
+        while (cls + 1 < FREE_LIST_SIZE && t.classSize[cls] < maxBytes)
+        {
+            cls++;
+        }
+        t.classIndex[slot] = static_cast<unsigned char>(cls);
+    }
+    return t;
+}
+
+static constexpr SizeClassTables SIZE_CLASS_TABLES = buildSizeClassTables();
+
 // 大小类管理
 class SizeClass
 {
 public:
     /**
-     * @brief 将内存大小向上对齐到 ALIGNMENT 的倍数
+     * @brief 将内存大小向上取整到所属大小类的内存块大小
      * @param bytes 需要对齐的内存大小
      * @return size_t 对齐后的内存大小
      *
-     * 使用位运算实现高效的对齐操作：
-     * 1. 计算方式：(bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1)
-     * 2. 例如：ALIGNMENT = 8
+     * 例如：
      *    - 输入 10 -> 输出 16
-     *    - 输入 15 -> 输出 16
-     *    - 输入 16 -> 输出 16
+     *    - 输入 130 -> 输出 144
+     *    - 输入 1100 -> 输出 1152
      */
-    static size_t roundUp(size_t bytes)
-    {
-        /*
-        *假设 bytes = 10
-         1. 10 + 7 = 17
-       二进制：0001 0001
-
-        2. 17 & ~7
-        0001 0001
-        1111 1000
-        ---------
-        0001 0000 = 16
-
-            结果：10 被向上取整到 16
-         */
-        //  这里  ~(ALIGNMENT - 1) 转换为二进制进行取反，然后进行比较
-        return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
-    }
+    static constexpr size_t roundUp(size_t bytes) { return getSize(getIndex(bytes)); }
 
     /**
      * @brief 计算内存大小对应的自由链表索引
-     * @param bytes 内存大小
+     * @param bytes 内存大小（不超过 MAX_BYTES）
      * @return size_t 自由链表数组的索引
      *
-     * 计算规则：
-     * 1. 确保输入大小至少为 ALIGNMENT
-     * 2. 将大小除以 ALIGNMENT 并减1得到索引
-     * 3. 例如：ALIGNMENT = 8
-     *    - 输入 8 -> 输出 0
-     *    - 输入 16 -> 输出 1
-     *    - 输入 24 -> 输出 2
+     * 计算规则（与 tcmalloc 的 ClassIndex 相同）：
+     * 1. 小于等于 1024B 时按 8 字节粒度查表：(bytes + 7) >> 3
+     * 2. 大于 1024B 时按 128 字节粒度查表：(bytes + 127 + (120 << 7)) >> 7
+     *    两段表拼在一起共约2KB，一次查表即可得到索引
+     */
+    static constexpr size_t getIndex(size_t bytes) { return SIZE_CLASS_TABLES.classIndex[lookupSlot(bytes)]; }
+
+    /**
+     * @brief 获取大小类对应的内存块大小
+     * @param index 自由链表的索引
+     */
+    static constexpr size_t getSize(size_t index) { return SIZE_CLASS_TABLES.classSize[index]; }
+
+    /**
+     * @brief 获取大小类一次向页缓存申请的页数
+     * @param index 自由链表的索引
+     *
+     * 至少 SPAN_PAGES 页，并保证切分后剩余的尾部碎片不超过 Span 的 1/8
+     */
+    static constexpr size_t getSpanPages(size_t index) { return SIZE_CLASS_TABLES.classPages[index]; }
+
+    /**
+     * @brief 获取大小类一个批次内存块数量的上限
+     * @param index 自由链表的索引
+     *
+     * 一个批次的总字节数不超过 MAX_BATCH_BYTES，数量限制在 [MIN_BATCH_NUM, MAX_BATCH_NUM]
+     */
+    static constexpr size_t getBatchNum(size_t index) { return SIZE_CLASS_TABLES.classBatch[index]; }
+
+    /**
+     * @brief 检查对齐分配依赖的大小类性质
+     * @return bool 对任意不超过一页的2的幂 align，align 的倍数映射到的大小类也是 align 的倍数
+     *
+     * 每个 2 的幂区间的步长是 2 的幂：align 不小于步长时 align 的倍数本身就是大小类，
+     * align 小于步长时向上取整得到的大小类是步长的倍数，也就是 align 的倍数
      */
-    static size_t getIndex(size_t bytes)
+    static constexpr bool alignedClassesOk()
     {
-        // 确保bytes至少为ALIGNMENT
-        bytes = std::max(bytes, ALIGNMENT);
-        // 向上取整后-1
-        return (bytes + ALIGNMENT - 1) / ALIGNMENT - 1;
+        for (size_t align = 2 * ALIGNMENT; align <= PAGE_SIZE; align *= 2)
+        {
+            for (size_t bytes = align; bytes <= MAX_BYTES; bytes += align)
+            {
+                if (roundUp(bytes) % align != 0)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t lookupSlot(size_t bytes)
+    {
+        return bytes <= SMALL_LOOKUP_MAX ? (bytes + 7) >> 3 : (bytes + 127 + (120 << 7)) >> 7;
     }
 };
 
+static_assert(SizeClass::getSize(FREE_LIST_SIZE - 1) == MAX_BYTES, "最后一个大小类必须是 MAX_BYTES");
+static_assert(SizeClass::getIndex(MAX_BYTES) == FREE_LIST_SIZE - 1, "MAX_BYTES 必须映射到最后一个大小类");
+static_assert(SizeClass::roundUp(ALIGNMENT) == ALIGNMENT, "最小的大小类必须是 ALIGNMENT");
+static_assert(SizeClass::alignedClassesOk(), "对齐的大小必须映射到同样对齐的大小类");
+
 #endif  // COMMON_H
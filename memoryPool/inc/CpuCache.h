@@ -0,0 +1,278 @@
+// 每个CPU一个的缓存（restartable sequences）
+
+#ifndef CPU_CACHE_H
+#define CPU_CACHE_H
+#include "CentralCache.h"
+#include "Conmmon.h"
+#include "Hardening.h"
+#include <cstddef>
+#include <cstdint>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#include <sys/rseq.h>
+#define MEMPOOL_HAS_RSEQ 1
+#else
+#define MEMPOOL_HAS_RSEQ 0
+#endif
+
+/**
+ * @class CpuCache
+ * @brief 按CPU划分的小对象缓存，可以代替按线程划分的 ThreadCache 自由链表
+ *
+ * 缓存的数量等于CPU数量而不是线程数量，大量空闲线程不会各自占着一份缓存。
+ * 每个CPU的每个大小类是一个指针栈 {count, items[]}，压栈、出栈都放在 rseq 临界区里：
+ * 1. 读当前CPU编号，算出这个CPU上该大小类的栈
+ * 2. 读写栈顶元素
+ * 3. 最后一条指令写回 count，这一次写入就是提交
+ * 线程在提交之前被抢占、迁移或收到信号时，内核把它跳转到 abort 处理重新执行，
+ * 所以快速路径不需要原子指令和锁。
+ *
+ * 依赖 glibc 2.35 以上自动注册的 rseq（x86-64），不满足条件时 enabled() 返回false，
+ * ThreadCache 继续使用线程本地的自由链表
+ */
+class CpuCache
+{
+public:
+    static CpuCache &getInstance()
+    {
+        static CpuCache instance;
+        return instance;
+    }
+
+    /**
+     * @brief 当前进程是否可以使用按CPU划分的缓存
+     */
+    static bool enabled()
+    {
+        static const bool ok = getInstance().slabs_ != nullptr;
+        return ok;
+    }
+
+    /**
+     * @brief 从当前CPU的缓存取一个内存块，为空时从中心缓存批量补充
+     * @param index 大小类的索引
+     */
+    void *allocate(size_t index)
+    {
+        void *ptr = pop(index);
+        if (ptr)
+            return ptr;
+        return refill(index);
+    }
+
+    /**
+     * @brief 把内存块放回当前CPU的缓存，满了先把一个批次还给中心缓存
+     * @param ptr 内存块指针
+     * @param index 大小类的索引
+     */
+    void deallocate(void *ptr, size_t index)
+    {
+        while (!push(ptr, index))
+        {
+            drain(index);
+        }
+    }
+
+    /**
+     * @brief 大小类在每个CPU上最多缓存的内存块数量
+     *
+     * 总字节数不超过 PERCPU_CLASS_BYTES，数量在 [MIN_BATCH_NUM, PERCPU_MAX_ITEMS] 之间
+     */
+    static constexpr size_t capacity(size_t index)
+    {
+        return std::max(MIN_BATCH_NUM, std::min(PERCPU_CLASS_BYTES / SizeClass::getSize(index), PERCPU_MAX_ITEMS));
+    }
+
+private:
+    // 每个CPU上一个大小类的栈：count 后面紧跟 items，栈顶是 items[count - 1]
+    struct ClassSlab
+    {
+        size_t count;
+        void *items[PERCPU_MAX_ITEMS];
+    };
+    static constexpr size_t CPU_STRIDE = sizeof(ClassSlab) * FREE_LIST_SIZE;
+
+    /**
+     * @brief 为所有可能的CPU预留缓存
+     *
+     * 匿名映射按需分配物理页，只有真正运行过线程的CPU才会占用内存
+     */
+    CpuCache()
+    {
+#if MEMPOOL_HAS_RSEQ
+        // glibc 没有注册 rseq（例如设置了 glibc.pthread.rseq=0）时 cpu_id 是负数
+        if (__rseq_size < 8 || static_cast<int32_t>(rseqArea()->cpu_id) < 0)
+            return;
+        long cpus = sysconf(_SC_NPROCESSORS_CONF);
+        if (cpus <= 0)
+            return;
+        numCpus_ = static_cast<size_t>(cpus);
+        void *ptr = mmap(nullptr, numCpus_ * CPU_STRIDE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr != MAP_FAILED)
+            slabs_ = static_cast<char *>(ptr);
+#endif
+    }
+
+#if MEMPOOL_HAS_RSEQ
+    static struct rseq *rseqArea()
+    {
+        char *threadPointer;
+        __asm__("movq %%fs:0, %0" : "=r"(threadPointer));
+        return reinterpret_cast<struct rseq *>(threadPointer + __rseq_offset);
+    }
+#endif
+
+    /**
+     * @brief 从当前CPU的栈中弹出一个内存块，栈为空时返回nullptr
+     */
+    void *pop(size_t index)
+    {
+#if MEMPOOL_HAS_RSEQ
+        char *base = slabs_ + index * sizeof(ClassSlab);
+        void *result;
+        __asm__ __volatile__(
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0x0, 0x0\n\t"
+            ".quad 1f, 2f - 1f, 4f\n\t"
+            ".popsection\n\t"
+            "0:\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, 8(%[rseq])\n\t"
+            "1:\n\t"
+            "xorl %%edx, %%edx\n\t"
+            "movl 4(%[rseq]), %%eax\n\t"
+            "imulq %[stride], %%rax\n\t"
+            "addq %[base], %%rax\n\t"
+            "movq (%%rax), %%rcx\n\t"
+            "testq %%rcx, %%rcx\n\t"
+            "jz 2f\n\t"
+            "movq (%%rax, %%rcx, 8), %%rdx\n\t"
+            "decq %%rcx\n\t"
+            "movq %%rcx, (%%rax)\n\t"
+            "2:\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".byte 0x0f, 0xb9, 0x3d\n\t"
+            ".long 0x53053053\n\t"
+            "4:\n\t"
+            "jmp 0b\n\t"
+            ".popsection\n\t"
+            : "=&d"(result)
+            : [rseq] "r"(rseqArea()), [stride] "r"(CPU_STRIDE), [base] "r"(base)
+            : "rax", "rcx", "memory", "cc");
+        return result;
+#else
+        (void)index;
+        return nullptr;
+#endif
+    }
+
+    /**
+     * @brief 把内存块压入当前CPU的栈，栈已满时返回false
+     */
+    bool push(void *ptr, size_t index)
+    {
+#if MEMPOOL_HAS_RSEQ
+        char *base = slabs_ + index * sizeof(ClassSlab);
+        size_t ok;
+        __asm__ __volatile__(
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0x0, 0x0\n\t"
+            ".quad 1f, 2f - 1f, 4f\n\t"
+            ".popsection\n\t"
+            "0:\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, 8(%[rseq])\n\t"
+            "1:\n\t"
+            "xorl %%edx, %%edx\n\t"
+            "movl 4(%[rseq]), %%eax\n\t"
+            "imulq %[stride], %%rax\n\t"
+            "addq %[base], %%rax\n\t"
+            "movq (%%rax), %%rcx\n\t"
+            "cmpq %[cap], %%rcx\n\t"
+            "jae 2f\n\t"
+            "movq %[ptr], 8(%%rax, %%rcx, 8)\n\t"
+            "incq %%rcx\n\t"
+            "movl $1, %%edx\n\t"
+            "movq %%rcx, (%%rax)\n\t"
+            "2:\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".byte 0x0f, 0xb9, 0x3d\n\t"
+            ".long 0x53053053\n\t"
+            "4:\n\t"
+            "jmp 0b\n\t"
+            ".popsection\n\t"
+            : "=&d"(ok)
+            : [rseq] "r"(rseqArea()), [stride] "r"(CPU_STRIDE), [base] "r"(base), [ptr] "r"(ptr),
+              [cap] "r"(capacity(index))
+            : "rax", "rcx", "memory", "cc");
+        return ok != 0;
+#else
+        (void)ptr;
+        (void)index;
+        return false;
+#endif
+    }
+
+    /**
+     * @brief 当前CPU的栈为空：从中心缓存取一个批次，返回第一个，其余压入栈中
+     *
+     * 压栈期间可能被迁移到其他CPU，放不下的部分还给中心缓存
+     */
+    void *refill(size_t index)
+    {
+        MEMPOOL_LATENCY_SCOPE(LATENCY_FRONT_MISS);
+        size_t batchNum = std::min(SizeClass::getBatchNum(index), capacity(index));
+        size_t actualNum = 0;
+        void *head = CentralCache::getInstance().fetchRange<void>(index, batchNum, actualNum);
+        if (!head)
+            return nullptr;
+        void *rest = FreeList::next(head);
+        size_t restNum = actualNum - 1;
+        while (rest)
+        {
+            void *next = FreeList::next(rest);
+            if (!push(rest, index))
+                break;
+            rest = next;
+            restNum--;
+        }
+        if (rest)
+            CentralCache::getInstance().returnRange(rest, restNum, index);
+        return head;
+    }
+
+    /**
+     * @brief 当前CPU的栈已满：弹出一个批次还给中心缓存
+     */
+    void drain(size_t index)
+    {
+        size_t batchNum = std::min(SizeClass::getBatchNum(index), capacity(index));
+        void *head = nullptr;
+        void *tail = nullptr;
+        size_t count = 0;
+        while (count < batchNum)
+        {
+            void *ptr = pop(index);
+            if (!ptr)
+                break;
+            FreeList::setNext(ptr, head);
+            head = ptr;
+            if (!tail)
+                tail = ptr;
+            count++;
+        }
+        if (head)
+            CentralCache::getInstance().returnRange(head, count, index, tail);
+    }
+
+    char *slabs_ = nullptr;  // 所有CPU的缓存，第 cpu 个CPU从 slabs_ + cpu * CPU_STRIDE 开始
+    size_t numCpus_ = 0;
+};
+
+#endif
@@ -0,0 +1,170 @@
+// 空闲链表的读写，以及加固模式（MEMPOOL_HARDENED）下的内存块检查
+
+#ifndef HARDENING_H
+#define HARDENING_H
+#include "Conmmon.h"
+#include "PageCache.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+/**
+ * @struct Hardening
+ * @brief 加固模式的检查，发现问题时输出原因并 abort
+ *
+ * 1. 空闲链表的指针与进程的随机密钥、存放位置的地址异或后再写入内存块，
+ *    释放后被写入的内存块在解码时通常得到不对齐的地址
+ * 2. 内存块末尾 HARDENED_TAG_BYTES 字节记录状态，释放时检查重复释放和越界写
+ * 3. 大对象可以在末尾加一个不可访问的保护页（MEMPOOL_CONF 的 guard_pages）
+ *
+ * 内存块会在线程缓存、其他线程的远程队列和中心缓存之间整段转交，
+ * 所以密钥是整个进程一个，而不是每个线程一个
+ */
+struct Hardening
+{
+    /**
+     * @brief 进程的随机密钥，第一次使用时通过 getrandom 生成
+     *
+     * 最低位固定为1：被改写成0的链接指针解码后不对齐，同样可以被发现
+     */
+    static uintptr_t secret()
+    {
+        static const uintptr_t value = []() {
+            uintptr_t random = 0;
+            if (getrandom(&random, sizeof(random), GRND_NONBLOCK) != static_cast<ssize_t>(sizeof(random)))
+                random = reinterpret_cast<uintptr_t>(&random) * 0x9e3779b97f4a7c15ull;
+            return random | 1;
+        }();
+        return value;
+    }
+
+    /**
+     * @brief 加上末尾的标记之后实际请求的大小
+     *
+     * size 是 2^k 的倍数时，原来保证内存块按 2^k 对齐（见 SizeClass::alignedClassesOk），
+     * 加上标记后仍然向上取整到 2^k 的倍数（最多一页），对齐保证不变
+     */
+    static constexpr size_t taggedSize(size_t size)
+    {
+#if MEMPOOL_HARDENED
+        // 接近 SIZE_MAX 的大小不能回绕成小对象，保持在 SIZE_MAX，由 allocateLarge 拒绝
+        if (size > MAX_BYTES)
+            return size > SIZE_MAX - HARDENED_TAG_BYTES ? SIZE_MAX : size + HARDENED_TAG_BYTES;
+        size_t align = std::min(std::max(size & (~size + 1), ALIGNMENT), PAGE_SIZE);
+        return (size + HARDENED_TAG_BYTES + align - 1) & ~(align - 1);
+#else
+        return size;
+#endif
+    }
+
+    /**
+     * @brief 在内存块末尾写入“已分配”
+     * @param block 内存块的起始地址
+     * @param blockSize 内存块的大小（大小类的大小，或大对象的字节数）
+     */
+    static void markAllocated(void *block, size_t blockSize) { tagOf(block, blockSize) = tagValue(block, TAG_ALLOCATED); }
+
+    /**
+     * @brief 检查要释放的内存块，然后在末尾写入“已释放”
+     * @param ptr 释放的指针
+     * @param span 指针所在的Span，不属于内存池时为nullptr
+     *
+     * 小对象必须是内存块的起始地址，大对象可以是对齐分配返回的内部指针
+     */
+    static void checkFree(void *ptr, const Span *span)
+    {
+        if (!span || span->objSize == 0)
+            report("释放的地址不属于内存池，或者所在的Span已经整体释放", ptr);
+        char *base = static_cast<char *>(span->PageAddr);
+        char *block = base;
+        if (span->objSize <= MAX_BYTES)
+        {
+            size_t offset = static_cast<size_t>(static_cast<char *>(ptr) - base);
+            block = base + offset - offset % span->objSize;
+            if (block != ptr)
+                report("释放的地址不是内存块的起始地址", ptr);
+        }
+        uintptr_t &tag = tagOf(block, span->objSize);
+        if (tag == tagValue(block, TAG_FREE))
+            report("重复释放", ptr);
+        if (tag != tagValue(block, TAG_ALLOCATED))
+            report("内存块末尾的标记被改写（越界写）", ptr);
+        tag = tagValue(block, TAG_FREE);
+    }
+
+    /**
+     * @brief 编码（解码）存放在 slot 处的链接指针
+     */
+    static uintptr_t linkKey(const void *slot) { return secret() ^ reinterpret_cast<uintptr_t>(slot); }
+
+    /**
+     * @brief 大对象末尾的保护页，mprotect 失败（例如映射数达到上限）时不保护
+     */
+    static void protectPage(void *page) { mprotect(page, PAGE_SIZE, PROT_NONE); }
+    static void unprotectPage(void *page) { mprotect(page, PAGE_SIZE, PROT_READ | PROT_WRITE); }
+
+    /**
+     * @brief 输出检测到的问题并结束进程，不分配内存
+     */
+    [[noreturn]] __attribute__((noinline, cold)) static void report(const char *what, const void *ptr)
+    {
+        char buffer[160];
+        int length = snprintf(buffer, sizeof(buffer), "内存池检测到错误: %s (%p)\n", what, ptr);
+        if (length > 0)
+        {
+            ssize_t written = write(STDERR_FILENO, buffer, std::min(static_cast<size_t>(length), sizeof(buffer) - 1));
+            (void)written;
+        }
+        abort();
+    }
+
+private:
+    static constexpr uintptr_t TAG_ALLOCATED = 0xa110ca7eda110ca7ull;
+    static constexpr uintptr_t TAG_FREE = 0xf4eeb10cf4eeb10cull;
+
+    static uintptr_t &tagOf(void *block, size_t blockSize)
+    {
+        return *reinterpret_cast<uintptr_t *>(static_cast<char *>(block) + blockSize - sizeof(uintptr_t));
+    }
+
+    static uintptr_t tagValue(const void *block, uintptr_t state)
+    {
+        return secret() ^ reinterpret_cast<uintptr_t>(block) ^ state;
+    }
+};
+
+/**
+ * @struct FreeList
+ * @brief 空闲内存块的链接指针存放在内存块的前8个字节
+ *
+ * 所有层的空闲链表都通过这里读写；加固模式下指针编码后存放，解码出不对齐的地址时报告错误
+ */
+struct FreeList
+{
+    static void *next(const void *block)
+    {
+#if MEMPOOL_HARDENED
+        uintptr_t next = *static_cast<const uintptr_t *>(block) ^ Hardening::linkKey(block);
+        if (__builtin_expect(next & (ALIGNMENT - 1), 0))
+            Hardening::report("空闲内存块的链接指针被改写（释放后写入）", block);
+        return reinterpret_cast<void *>(next);
+#else
+        return *static_cast<void *const *>(block);
+#endif
+    }
+
+    static void setNext(void *block, void *next)
+    {
+#if MEMPOOL_HARDENED
+        *static_cast<uintptr_t *>(block) = reinterpret_cast<uintptr_t>(next) ^ Hardening::linkKey(block);
+#else
+        *static_cast<void **>(block) = next;
+#endif
+    }
+};
+
+#endif
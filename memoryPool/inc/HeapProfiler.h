@@ -0,0 +1,289 @@
+// 采样堆分析
+
+#ifndef HEAP_PROFILER_H
+#define HEAP_PROFILER_H
+#include "Conmmon.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <sys/mman.h>
+#include <unwind.h>
+#include <vector>
+
+/**
+ * @class HeapProfiler
+ * @brief 按字节采样的堆分析，记录存活的采样内存块及其调用栈
+ *
+ * 1. 每个线程缓存维护一个字节倒计数，分配时减去请求的大小，减到0以下时才进入采样的慢路径，
+ *    两次采样之间的字节数服从均值为采样间隔的几何（指数）分布，与 tcmalloc、jemalloc 相同
+ * 2. 采样表是固定大小的开放寻址哈希表，按内存块地址查找，插入、删除都是一次CAS，没有锁
+ * 3. 释放时只有存在存活的采样才查表，采样关闭并且没有存活的采样时只多读一次全局计数
+ * 4. writeProfile() 按 gperftools 的 heap profile 文本格式输出，可以用 pprof 分析
+ */
+class HeapProfiler
+{
+public:
+    static HeapProfiler &getInstance()
+    {
+        static HeapProfiler instance;
+        return instance;
+    }
+
+    /**
+     * @brief 设置平均采样间隔（字节），0表示关闭采样
+     *
+     * 已经记录的采样保留到内存块释放；各线程在当前倒计数用完后使用新的间隔
+     */
+    static void setSampleRate(size_t bytes) { sampleRate_.store(bytes, std::memory_order_relaxed); }
+
+    static size_t getSampleRate() { return sampleRate_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 是否有存活的采样，释放内存块时先检查，没有时不查表
+     */
+    static bool hasSamples() { return liveSamples_.load(std::memory_order_relaxed) != 0; }
+
+    /**
+     * @brief 存活的采样数量
+     */
+    static size_t getSampleCount() { return liveSamples_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 采样表已满而丢弃的采样数量
+     */
+    size_t getDroppedCount() const { return dropped_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 下一次采样前还要分配的字节数
+     * @param rate 平均采样间隔
+     * @param seed 线程自己的随机数状态
+     */
+    static int64_t nextInterval(size_t rate, uint64_t &seed)
+    {
+        if (seed == 0)
+            seed = reinterpret_cast<uintptr_t>(&seed) | 1;
+        // xorshift64*，取高53位得到 (0, 1] 上的均匀分布
+        seed ^= seed >> 12;
+        seed ^= seed << 25;
+        seed ^= seed >> 27;
+        double u = static_cast<double>(((seed * 0x2545F4914F6CDD1DULL) >> 11) + 1) * (1.0 / 9007199254740992.0);
+        double interval = -std::log(u) * static_cast<double>(rate);
+        return static_cast<int64_t>(std::min(std::max(interval, 1.0), 1e15));
+    }
+
+    /**
+     * @brief 记录一个采样的内存块和当前调用栈
+     * @param ptr 分配给用户的地址
+     * @param size 请求的大小
+     * @return bool 采样表已满时返回false
+     */
+    __attribute__((noinline)) bool record(void *ptr, size_t size)
+    {
+        if (!samples_ || !ptr)
+            return false;
+        uintptr_t key = reinterpret_cast<uintptr_t>(ptr);
+        for (size_t i = 0; i < PROFILE_MAX_PROBES; i++)
+        {
+            Sample &sample = samples_[(hash(key) + i) % PROFILE_MAX_SAMPLES];
+            uintptr_t state = sample.key.load(std::memory_order_relaxed);
+            if ((state != EMPTY && state != DELETED) ||
+                !sample.key.compare_exchange_strong(state, WRITING, std::memory_order_acquire, std::memory_order_relaxed))
+                continue;
+
+            // 跳过 record 和线程缓存中采样的慢路径两层
+            UnwindState unwind{sample.stack, 0, 2};
+            _Unwind_Backtrace(unwindFrame, &unwind);
+            sample.size.store(size, std::memory_order_relaxed);
+            sample.depth.store(unwind.depth, std::memory_order_relaxed);
+            sample.key.store(key, std::memory_order_release);
+            liveSamples_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    /**
+     * @brief 内存块释放时删除它的采样，不是采样的内存块时什么都不做
+     */
+    void remove(const void *ptr)
+    {
+        Sample *sample = find(ptr);
+        uintptr_t key = reinterpret_cast<uintptr_t>(ptr);
+        if (sample && sample->key.compare_exchange_strong(key, DELETED, std::memory_order_relaxed))
+            liveSamples_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 内存块是否有存活的采样
+     */
+    bool isSampled(const void *ptr) { return find(ptr) != nullptr; }
+
+    /**
+     * @brief 按 pprof 可以读取的 heap profile 格式输出存活的采样
+     * @return bool 写入成功返回true
+     *
+     * 调用栈相同的采样合并成一行，格式为：
+     *   heap profile: 对象数: 字节数 [对象数: 字节数] @ heap_v2/采样间隔
+     *   对象数: 字节数 [对象数: 字节数] @ 返回地址...
+     *   MAPPED_LIBRARIES: 后面是 /proc/self/maps，pprof 用它把地址对应到符号
+     * 只记录存活的采样，方括号中的累计分配与存活相同；pprof 根据采样间隔还原实际的大小
+     */
+    bool writeProfile(FILE *out)
+    {
+        if (!out)
+            return false;
+        struct Record
+        {
+            std::vector<void *> stack;
+            size_t count;
+            size_t bytes;
+        };
+        std::vector<Record> records;
+        for (size_t i = 0; samples_ && i < PROFILE_MAX_SAMPLES; i++)
+        {
+            Sample &sample = samples_[i];
+            uintptr_t key = sample.key.load(std::memory_order_acquire);
+            if (key == EMPTY || key == WRITING || key == DELETED)
+                continue;
+            size_t depth = std::min(sample.depth.load(std::memory_order_relaxed), PROFILE_MAX_DEPTH);
+            Record record{std::vector<void *>(depth), 1, sample.size.load(std::memory_order_relaxed)};
+            for (size_t j = 0; j < depth; j++)
+            {
+                record.stack[j] = sample.stack[j].load(std::memory_order_relaxed);
+            }
+            // 读取期间被释放并重新使用的采样丢弃
+            if (sample.key.load(std::memory_order_acquire) == key)
+                records.push_back(std::move(record));
+        }
+
+        std::sort(records.begin(), records.end(), [](const Record &a, const Record &b) { return a.stack < b.stack; });
+        std::vector<Record> merged;
+        size_t totalCount = 0;
+        size_t totalBytes = 0;
+        for (Record &record : records)
+        {
+            totalCount += record.count;
+            totalBytes += record.bytes;
+            if (!merged.empty() && merged.back().stack == record.stack)
+            {
+                merged.back().count += record.count;
+                merged.back().bytes += record.bytes;
+            }
+            else
+            {
+                merged.push_back(std::move(record));
+            }
+        }
+
+        fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", totalCount, totalBytes, totalCount,
+                totalBytes, std::max<size_t>(getSampleRate(), 1));
+        for (const Record &record : merged)
+        {
+            fprintf(out, "%zu: %zu [%zu: %zu] @", record.count, record.bytes, record.count, record.bytes);
+            for (void *address : record.stack)
+            {
+                fprintf(out, " %p", address);
+            }
+            fprintf(out, "\n");
+        }
+
+        fprintf(out, "\nMAPPED_LIBRARIES:\n");
+        if (FILE *maps = fopen("/proc/self/maps", "r"))
+        {
+            char buffer[4096];
+            size_t n = 0;
+            while ((n = fread(buffer, 1, sizeof(buffer), maps)) > 0)
+            {
+                fwrite(buffer, 1, n, out);
+            }
+            fclose(maps);
+        }
+        return ferror(out) == 0;
+    }
+
+private:
+    // 采样表中 key 的特殊取值，其余取值是内存块的地址
+    static constexpr uintptr_t EMPTY = 0;
+    static constexpr uintptr_t WRITING = 1;
+    static constexpr uintptr_t DELETED = 2;
+
+    /**
+     * 采样表的一项，所有字段都是原子变量，导出时可以和写入同时进行。
+     * key 从不回到 EMPTY，查找时遇到 EMPTY 就可以停止
+     */
+    struct Sample
+    {
+        std::atomic<uintptr_t> key;
+        std::atomic<size_t> size;
+        std::atomic<size_t> depth;
+        std::atomic<void *> stack[PROFILE_MAX_DEPTH];
+    };
+
+    struct UnwindState
+    {
+        std::atomic<void *> *stack;
+        size_t depth;
+        size_t skip;
+    };
+
+    /**
+     * @brief 采样表通过匿名映射申请，只有写入过的页才占用物理内存
+     *
+     * 第一次采样时才创建，从不采样的程序不会映射
+     */
+    HeapProfiler()
+    {
+        void *ptr = mmap(nullptr, sizeof(Sample) * PROFILE_MAX_SAMPLES, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr != MAP_FAILED)
+            samples_ = static_cast<Sample *>(ptr);
+    }
+
+    static size_t hash(uintptr_t key) { return static_cast<size_t>((key >> 4) * 0x9E3779B97F4A7C15ULL >> 32); }
+
+    Sample *find(const void *ptr)
+    {
+        if (!samples_)
+            return nullptr;
+        uintptr_t key = reinterpret_cast<uintptr_t>(ptr);
+        for (size_t i = 0; i < PROFILE_MAX_PROBES; i++)
+        {
+            Sample &sample = samples_[(hash(key) + i) % PROFILE_MAX_SAMPLES];
+            uintptr_t state = sample.key.load(std::memory_order_acquire);
+            if (state == key)
+                return &sample;
+            if (state == EMPTY)
+                return nullptr;
+        }
+        return nullptr;
+    }
+
+    static _Unwind_Reason_Code unwindFrame(_Unwind_Context *context, void *arg)
+    {
+        UnwindState *state = static_cast<UnwindState *>(arg);
+        if (state->skip > 0)
+        {
+            state->skip--;
+            return _URC_NO_REASON;
+        }
+        uintptr_t ip = _Unwind_GetIP(context);
+        if (ip == 0 || state->depth >= PROFILE_MAX_DEPTH)
+            return _URC_END_OF_STACK;
+        state->stack[state->depth++].store(reinterpret_cast<void *>(ip), std::memory_order_relaxed);
+        return _URC_NO_REASON;
+    }
+
+    Sample *samples_ = nullptr;
+    std::atomic<size_t> dropped_{0};
+
+    // 平均采样间隔（字节），0表示关闭
+    static inline std::atomic<size_t> sampleRate_{0};
+    // 存活的采样数量
+    static inline std::atomic<size_t> liveSamples_{0};
+};
+
+#endif
@@ -0,0 +1,325 @@
+// 慢路径的延迟直方图
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+#include "Conmmon.h"
+#include "Stats.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * 计时的慢路径事件，对应一次分配从线程缓存依次落到下层的各个环节
+ */
+enum LatencyEvent : size_t
+{
+    LATENCY_FRONT_MISS,    ///< 线程缓存（或CPU缓存）为空，向中心缓存批量申请的整个过程
+    LATENCY_LOCK_WAIT,     ///< 中心缓存、传输缓存的 SpinLock 发生竞争后等锁的时间
+    LATENCY_SPAN_FETCH,    ///< 中心缓存向页缓存申请Span并切分成内存块
+    LATENCY_SYSTEM_ALLOC,  ///< 页缓存向系统 mmap 新内存
+    LATENCY_SPAN_FREE,     ///< 页缓存释放Span：等锁、与相邻Span合并、按速率归还物理页
+    LATENCY_EVENT_COUNT
+};
+
+/**
+ * @brief 计时用的时钟
+ *
+ * x86 读取 TSC，aarch64 读取虚拟计数器，都不进入内核；其他平台退回 steady_clock 的纳秒数。
+ * 直方图记录时钟周期数，输出时才按 ticksPerNs() 换算成纳秒
+ */
+struct LatencyClock
+{
+    static uint64_t now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        uint64_t ticks;
+        __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+#else
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+                .count());
+#endif
+    }
+
+    /**
+     * @brief 每纳秒的时钟周期数，第一次调用时对照 steady_clock 忙等 10 毫秒测出
+     */
+    static double ticksPerNs()
+    {
+        static const double ratio = []() {
+            auto begin = std::chrono::steady_clock::now();
+            uint64_t ticks = now();
+            auto end = begin;
+            while (end - begin < std::chrono::milliseconds(10))
+            {
+                end = std::chrono::steady_clock::now();
+            }
+            double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+            double elapsed = static_cast<double>(now() - ticks);
+            return elapsed > 0 && ns > 0 ? elapsed / ns : 1.0;
+        }();
+        return ratio;
+    }
+};
+
+/**
+ * @class LatencyHistogram
+ * @brief HDR 风格的对数-线性直方图，记录一种事件的耗时（时钟周期）
+ *
+ * 1. 小于 2^LATENCY_SUB_BUCKET_BITS 的值每个值一个桶；更大的值按最高位分组，
+ *    每个 2 的幂区间再等分成 2^LATENCY_SUB_BUCKET_BITS 个桶，相对误差固定
+ * 2. 线程自己的直方图只由所属线程修改，用一次读和一次写计数；
+ *    没有线程缓存的线程共用一个直方图，shared 为 true，用原子的读改写
+ */
+class LatencyHistogram
+{
+public:
+    static constexpr size_t SUB_BUCKETS = size_t(1) << LATENCY_SUB_BUCKET_BITS;
+    static constexpr size_t BUCKETS = (LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    /**
+     * @brief 值所在的桶
+     */
+    static size_t bucketOf(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+            return static_cast<size_t>(value);
+        value = std::min<uint64_t>(value, (uint64_t(1) << LATENCY_MAX_BITS) - 1);
+        size_t msb = 63 - static_cast<size_t>(__builtin_clzll(value));
+        size_t magnitude = msb - LATENCY_SUB_BUCKET_BITS + 1;
+        return magnitude * SUB_BUCKETS + static_cast<size_t>(value >> (magnitude - 1)) - SUB_BUCKETS;
+    }
+
+    /**
+     * @brief 桶内的最大值，百分位数按这个值报告
+     */
+    static uint64_t bucketMax(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return bucket;
+        size_t magnitude = bucket / SUB_BUCKETS;
+        uint64_t lowest = static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << (magnitude - 1);
+        return lowest + (uint64_t(1) << (magnitude - 1)) - 1;
+    }
+
+    void record(uint64_t ticks, bool shared)
+    {
+        add(counts_[bucketOf(ticks)], 1, shared);
+        add(sum_, ticks, shared);
+        if (ticks > max_.load(std::memory_order_relaxed))
+        {
+            if (shared)
+            {
+                uint64_t current = max_.load(std::memory_order_relaxed);
+                while (ticks > current && !max_.compare_exchange_weak(current, ticks, std::memory_order_relaxed))
+                {
+                }
+            }
+            else
+            {
+                max_.store(ticks, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void reset()
+    {
+        for (std::atomic<uint64_t> &count : counts_)
+        {
+            count.store(0, std::memory_order_relaxed);
+        }
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count(size_t bucket) const { return counts_[bucket].load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+private:
+    static void add(std::atomic<uint64_t> &counter, uint64_t n, bool shared)
+    {
+        if (shared)
+            counter.fetch_add(n, std::memory_order_relaxed);
+        else
+            counterAdd<uint64_t>(counter, n);
+    }
+
+    std::array<std::atomic<uint64_t>, BUCKETS> counts_{};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+/**
+ * @brief 一个线程的所有事件的直方图
+ *
+ * 线程缓存创建时把自己的一份登记为当前线程的 local()，中心缓存、页缓存中的计时
+ * 通过它找到所属线程的直方图，不需要把线程缓存传下去
+ */
+struct LatencyRecorder
+{
+    std::array<LatencyHistogram, LATENCY_EVENT_COUNT> events;
+
+    void reset()
+    {
+        for (LatencyHistogram &histogram : events)
+        {
+            histogram.reset();
+        }
+    }
+
+    // 当前线程的直方图，没有线程缓存时为nullptr
+    static LatencyRecorder *&local()
+    {
+        static thread_local LatencyRecorder *recorder = nullptr;
+        return recorder;
+    }
+
+    // 没有线程缓存的线程（线程缓存创建之前、线程退出之后）共用的直方图
+    static LatencyRecorder &shared()
+    {
+        static LatencyRecorder recorder;
+        return recorder;
+    }
+
+    static void record(LatencyEvent event, uint64_t ticks)
+    {
+        if (LatencyRecorder *recorder = local())
+            recorder->events[event].record(ticks, false);
+        else
+            shared().events[event].record(ticks, true);
+    }
+};
+
+/**
+ * @brief 作用域计时：构造时读时钟，析构时把经过的周期数记入当前线程的直方图
+ *
+ * 通过 MEMPOOL_LATENCY_SCOPE 使用，没有开启 MEMPOOL_LATENCY_HISTOGRAM 时整个宏为空
+ */
+class LatencyTimer
+{
+public:
+    explicit LatencyTimer(LatencyEvent event) : event_(event), start_(LatencyClock::now()) {}
+    LatencyTimer(const LatencyTimer &) = delete;
+    LatencyTimer &operator=(const LatencyTimer &) = delete;
+    ~LatencyTimer() { LatencyRecorder::record(event_, LatencyClock::now() - start_); }
+
+private:
+    LatencyEvent event_;
+    uint64_t start_;
+};
+
+#if MEMPOOL_LATENCY_HISTOGRAM
+#define MEMPOOL_LATENCY_SCOPE(event) LatencyTimer latencyTimer(event)
+#else
+#define MEMPOOL_LATENCY_SCOPE(event) ((void)0)
+#endif
+
+/**
+ * @struct LatencyStats
+ * @brief 所有线程（包括已退出的线程）的直方图之和，由 ThreadCache::getLatencyStats() 收集
+ */
+struct LatencyStats
+{
+    struct Event
+    {
+        std::array<uint64_t, LatencyHistogram::BUCKETS> counts{};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+
+        /**
+         * @brief 百分位数（时钟周期），q 取 0 到 1，没有记录时返回0
+         */
+        uint64_t percentile(double q) const
+        {
+            if (count == 0)
+                return 0;
+            uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * static_cast<double>(count) + 0.5));
+            uint64_t seen = 0;
+            for (size_t bucket = 0; bucket < counts.size(); bucket++)
+            {
+                seen += counts[bucket];
+                if (seen >= rank)
+                    return std::min(LatencyHistogram::bucketMax(bucket), max);
+            }
+            return max;
+        }
+
+        double mean() const { return count ? static_cast<double>(sum) / static_cast<double>(count) : 0.0; }
+    };
+
+    std::array<Event, LATENCY_EVENT_COUNT> events;
+
+    void add(const LatencyRecorder &recorder)
+    {
+        for (size_t event = 0; event < LATENCY_EVENT_COUNT; event++)
+        {
+            const LatencyHistogram &histogram = recorder.events[event];
+            Event &e = events[event];
+            for (size_t bucket = 0; bucket < LatencyHistogram::BUCKETS; bucket++)
+            {
+                uint64_t count = histogram.count(bucket);
+                e.counts[bucket] += count;
+                e.count += count;
+            }
+            e.sum += histogram.sum();
+            e.max = std::max(e.max, histogram.max());
+        }
+    }
+
+    void add(const LatencyStats &other)
+    {
+        for (size_t event = 0; event < LATENCY_EVENT_COUNT; event++)
+        {
+            Event &e = events[event];
+            const Event &o = other.events[event];
+            for (size_t bucket = 0; bucket < LatencyHistogram::BUCKETS; bucket++)
+            {
+                e.counts[bucket] += o.counts[bucket];
+            }
+            e.count += o.count;
+            e.sum += o.sum;
+            e.max = std::max(e.max, o.max);
+        }
+    }
+
+    static const char *eventName(size_t event)
+    {
+        static const char *const names[LATENCY_EVENT_COUNT] = {"front_miss", "lock_wait", "span_fetch",
+                                                               "system_alloc", "span_free"};
+        return names[event];
+    }
+
+    /**
+     * @brief 以文本表格输出每种事件的次数和延迟（纳秒）
+     */
+    void print(FILE *out) const
+    {
+        double perNs = LatencyClock::ticksPerNs();
+        fprintf(out, "------------------------------------------------\n");
+        fprintf(out, "慢路径延迟（纳秒，时钟 %.3f 周期/纳秒）\n", perNs);
+        fprintf(out, "%-14s %12s %10s %10s %10s %10s %12s\n", "event", "count", "mean", "p50", "p99", "p999", "max");
+        for (size_t event = 0; event < LATENCY_EVENT_COUNT; event++)
+        {
+            const Event &e = events[event];
+            fprintf(out, "%-14s %12llu %10.0f %10.0f %10.0f %10.0f %12.0f\n", eventName(event),
+                    static_cast<unsigned long long>(e.count), e.mean() / perNs,
+                    static_cast<double>(e.percentile(0.5)) / perNs, static_cast<double>(e.percentile(0.99)) / perNs,
+                    static_cast<double>(e.percentile(0.999)) / perNs, static_cast<double>(e.max) / perNs);
+        }
+        fprintf(out, "------------------------------------------------\n");
+    }
+};
+
+#endif
@@ -0,0 +1,149 @@
+// 单调分配区域
+
+#ifndef MONOTONIC_REGION_H
+#define MONOTONIC_REGION_H
+#include "Conmmon.h"
+#include "PageCache.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+/**
+ * @class MonotonicRegion
+ * @brief 只分配不单独释放的内存区域，最后通过 release() 一次性归还
+ *
+ * 适合一个请求里分配大量小对象、请求结束时全部丢弃的场景：
+ * 1. 从页缓存申请整页的Span，在Span内移动指针分配，分配只是一次指针加法
+ * 2. 单个对象的释放什么都不做，release() 把所有Span还给页缓存，时间复杂度 O(Span数量)
+ * 3. 继承 std::pmr::memory_resource，可以直接给 pmr 容器使用
+ * 不加锁，同一个区域只能由一个线程使用；区域分配的内存不能交给 free()/ThreadCache 释放
+ */
+class MonotonicRegion : public std::pmr::memory_resource
+{
+public:
+    MonotonicRegion() = default;
+    MonotonicRegion(const MonotonicRegion &) = delete;
+    MonotonicRegion &operator=(const MonotonicRegion &) = delete;
+
+    ~MonotonicRegion() override { release(); }
+
+    /**
+     * @brief 分配 bytes 字节、按 align 对齐的内存
+     * @param bytes 请求的大小
+     * @param align 对齐要求，必须是2的幂且不超过一页
+     * @return void* 内存地址，内存不足或对齐要求不合法时返回nullptr
+     */
+    void *allocateAligned(size_t bytes, size_t align = alignof(std::max_align_t))
+    {
+        uintptr_t start = (current_ + align - 1) & ~(align - 1);
+        if (start < end_ && bytes <= end_ - start)
+        {
+            current_ = start + bytes;
+            return reinterpret_cast<void *>(start);
+        }
+        return allocateSlow(bytes, align);
+    }
+
+    /**
+     * @brief 在区域中构造一个对象
+     *
+     * 区域释放时不会调用析构函数，只适合平凡析构的类型或由调用方自己析构
+     */
+    template <typename T, typename... Args>
+    T *create(Args &&...args)
+    {
+        void *ptr = allocateAligned(sizeof(T), alignof(T));
+        if (!ptr)
+            return nullptr;
+        return new (ptr) T(std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief 把所有Span还给页缓存，之前分配的内存全部失效
+     */
+    void release()
+    {
+        PageCache &pageCache = PageCache::GetInstance();
+        while (chunks_)
+        {
+            Chunk *next = chunks_->next;
+            pageCache.deallocateSpan(static_cast<void *>(chunks_), chunks_->numPages);
+            chunks_ = next;
+        }
+        current_ = 0;
+        end_ = 0;
+        reservedBytes_ = 0;
+        nextPages_ = REGION_CHUNK_PAGES;
+    }
+
+    /**
+     * @brief 区域当前占用的字节数（所有Span的大小之和）
+     */
+    size_t getReservedBytes() const { return reservedBytes_; }
+
+protected:
+    void *do_allocate(size_t bytes, size_t align) override
+    {
+        void *ptr = allocateAligned(bytes, align);
+        if (!ptr)
+            throw std::bad_alloc();
+        return ptr;
+    }
+
+    // 单个对象的释放什么都不做，内存在 release() 时一起归还
+    void do_deallocate(void *, size_t, size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+private:
+    // 每个Span起始位置的头部，把区域的所有Span串成链表
+    struct Chunk
+    {
+        Chunk *next;
+        size_t numPages;
+    };
+
+    /**
+     * @brief 当前Span放不下时申请新的Span
+     *
+     * 大请求单独占一个Span，当前Span继续用于之后的小请求
+     */
+    void *allocateSlow(size_t bytes, size_t align)
+    {
+        if (align == 0 || (align & (align - 1)) != 0 || align > PAGE_SIZE || bytes > SIZE_MAX / 2)
+            return nullptr;
+
+        size_t headerBytes = (sizeof(Chunk) + align - 1) & ~(align - 1);
+        size_t chunkBytes = nextPages_ * PAGE_SIZE;
+        bool dedicated = bytes > chunkBytes / 2;
+        size_t numPages = dedicated ? (headerBytes + bytes + PAGE_SIZE - 1) / PAGE_SIZE : nextPages_;
+
+        char *base = PageCache::GetInstance().allocateSpan<char>(numPages);
+        if (!base)
+            return nullptr;
+        Chunk *chunk = reinterpret_cast<Chunk *>(base);
+        chunk->next = chunks_;
+        chunk->numPages = numPages;
+        chunks_ = chunk;
+        reservedBytes_ += numPages * PAGE_SIZE;
+
+        char *ptr = base + headerBytes;
+        if (!dedicated)
+        {
+            current_ = reinterpret_cast<uintptr_t>(ptr + bytes);
+            end_ = reinterpret_cast<uintptr_t>(base + numPages * PAGE_SIZE);
+            nextPages_ = std::min(nextPages_ * 2, REGION_MAX_CHUNK_PAGES);
+        }
+        return ptr;
+    }
+
+    Chunk *chunks_ = nullptr;                // 区域申请的所有Span
+    uintptr_t current_ = 0;                  // 当前Span中下一次分配的位置
+    uintptr_t end_ = 0;                      // 当前Span的结束位置
+    size_t reservedBytes_ = 0;               // 所有Span的字节数之和
+    size_t nextPages_ = REGION_CHUNK_PAGES;  // 下一个Span的页数
+};
+
+#endif
@@ -0,0 +1,94 @@
+// NUMA 节点信息
+
+#ifndef NUMA_H
+#define NUMA_H
+#include "Conmmon.h"
+#include <cstddef>
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * @class Numa
+ * @brief 查询 NUMA 节点数量、当前线程所在的节点，并把内存绑定到指定节点
+ *
+ * 直接使用系统调用，不依赖 libnuma，也不会调用 malloc。
+ * 只有一个节点时所有函数都直接返回，不产生额外开销
+ */
+class Numa
+{
+public:
+    /**
+     * @brief 系统的 NUMA 节点数量，最多 MAX_NUMA_NODES 个
+     *
+     * 第一次调用时从 /sys/devices/system/node/online 读取（例如 "0-1"），读取失败时按一个节点处理
+     */
+    static size_t nodeCount()
+    {
+        static const size_t count = detectNodeCount();
+        return count;
+    }
+
+    /**
+     * @brief 当前线程所在CPU的节点编号
+     *
+     * getcpu 在 x86-64 上通过 vDSO 实现，不陷入内核；线程随时可能被迁移，结果只作为分配时的提示
+     */
+    static size_t currentNode()
+    {
+        if (nodeCount() == 1)
+            return 0;
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if (getcpu(&cpu, &node) != 0)
+            return 0;
+        return node % nodeCount();
+    }
+
+    /**
+     * @brief 让 [ptr, ptr + bytes) 优先从 node 节点分配物理页
+     *
+     * 使用 MPOL_PREFERRED 而不是 MPOL_BIND，节点内存不足时仍然可以从其他节点分配
+     */
+    static void bindMemory(void *ptr, size_t bytes, size_t node)
+    {
+        if (nodeCount() == 1)
+            return;
+        unsigned long mask = 1UL << node;
+        syscall(SYS_mbind, ptr, bytes, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+    }
+
+private:
+    static size_t detectNodeCount()
+    {
+        int fd = open("/sys/devices/system/node/online", O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return 1;
+        char buf[128];
+        ssize_t len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (len <= 0)
+            return 1;
+        buf[len] = '\0';
+
+        // 取列表中最大的节点编号，例如 "0-1" 或 "0,2-3"
+        size_t maxNode = 0;
+        size_t value = 0;
+        for (ssize_t i = 0; i <= len; i++)
+        {
+            char ch = buf[i];
+            if (ch >= '0' && ch <= '9')
+            {
+                value = value * 10 + static_cast<size_t>(ch - '0');
+                continue;
+            }
+            maxNode = std::max(maxNode, value);
+            value = 0;
+        }
+        return std::min(maxNode + 1, MAX_NUMA_NODES);
+    }
+};
+
+#endif
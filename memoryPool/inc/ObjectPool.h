@@ -0,0 +1,85 @@
+// 定长对象池
+
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+#include "Conmmon.h"
+#include <cstddef>
+#include <new>
+#include <sys/mman.h>
+
+/**
+ * @class ObjectPool
+ * @brief 定长对象池，为内存池自身的元数据（Span、页表节点）提供内存
+ *
+ * 1. 内存直接通过mmap按块申请，不依赖系统 malloc，替换全局 malloc 后也不会递归调用自己
+ * 2. 释放的对象挂在空闲链表上，下次分配优先复用，申请的内存块不会还给系统
+ * 3. 不加锁，调用方必须自己保证互斥（PageCache 在 mutex_ 保护下使用）
+ */
+template <typename T>
+class ObjectPool
+{
+public:
+    /**
+     * @brief 分配一个对象并值初始化
+     * @return T* 对象指针，内存不足返回nullptr
+     */
+    T *allocate()
+    {
+        void *ptr = freeList_;
+        if (ptr)
+        {
+            freeList_ = *reinterpret_cast<void **>(ptr);
+        }
+        else
+        {
+            if (remaining_ < OBJECT_SIZE && !refill())
+                return nullptr;
+            ptr = chunk_;
+            chunk_ += OBJECT_SIZE;
+            remaining_ -= OBJECT_SIZE;
+        }
+        return new (ptr) T();
+    }
+
+    /**
+     * @brief 析构对象，并把内存挂回空闲链表
+     */
+    void deallocate(T *obj)
+    {
+        if (!obj)
+            return;
+        obj->~T();
+        *reinterpret_cast<void **>(obj) = freeList_;
+        freeList_ = obj;
+    }
+
+private:
+    // 每个对象至少能放下一个指针，并满足 T 的对齐要求
+    static constexpr size_t OBJECT_ALIGN = alignof(T) > alignof(void *) ? alignof(T) : alignof(void *);
+    static constexpr size_t OBJECT_SIZE =
+        ((sizeof(T) > sizeof(void *) ? sizeof(T) : sizeof(void *)) + OBJECT_ALIGN - 1) & ~(OBJECT_ALIGN - 1);
+    static_assert(OBJECT_ALIGN <= PAGE_SIZE, "对象的对齐要求不能超过页大小");
+
+    // 一次向系统申请的内存块大小：128KB，大对象至少能放下8个
+    static constexpr size_t CHUNK_SIZE =
+        (128 * 1024 > OBJECT_SIZE * 8 ? 128 * 1024 : (OBJECT_SIZE * 8 + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+
+    /**
+     * @brief 向系统申请一块新的内存，剩余的零头直接丢弃
+     */
+    bool refill()
+    {
+        void *ptr = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED)
+            return false;
+        chunk_ = static_cast<char *>(ptr);
+        remaining_ = CHUNK_SIZE;
+        return true;
+    }
+
+    void *freeList_ = nullptr;  // 已释放对象组成的链表
+    char *chunk_ = nullptr;     // 当前内存块中还没有分配过的位置
+    size_t remaining_ = 0;      // 当前内存块剩余的字节数
+};
+
+#endif
@@ -2,106 +2,377 @@
 
 #pragma once
 #include "Conmmon.h"
+#include "LatencyHistogram.h"
+#include "Numa.h"
+#include "ObjectPool.h"
+#include "PageMap.h"
+#include "Stats.h"
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
-#include <map>
+#include <cstdint>
+#include <cstdlib>
 #include <mutex>
 #include <sys/mman.h>
+#include <thread>
+
+/**
+ * @struct Span
+ * @brief 内存页面管理结构
+ *
+ * Span 结构表示一段连续的内存页，用于管理大块内存
+ */
+struct Span
+{
+    void *PageAddr;    ///< 页面的起始地址
+    size_t sizePages;  ///< 页面的数量
+    Span *next;        ///< 指向下一个Span的指针，形成双向链表
+    Span *prev;        ///< 指向上一个Span的指针，形成双向链表
+    size_t sizeClass;  ///< 切分的小对象所属的大小类，仅在 objSize <= MAX_BYTES 时有效
+    size_t objSize;    ///< 内存块大小，大对象为整个Span的字节数，空闲Span为0
+    void *freeList;    ///< 中心缓存中这个Span上空闲的小对象链表
+    void *bumpNext;    ///< 中心缓存中这个Span上还没有切分过的第一个小对象
+    void *bumpEnd;     ///< 可以切分的区域的末尾，bumpNext 到达这里后只能从 freeList 取
+    size_t useCount;   ///< 已经分配给线程缓存的小对象数量
+    bool isUse;        ///< 是否已经从页缓存分配出去（空闲Span为false）
+    bool isReleased;   ///< 空闲Span的物理页是否已经通过madvise归还操作系统
+    bool isDirect;     ///< 是否是超大对象单独mmap的映射，这种Span不分割也不合并
+    uint32_t node;     ///< 所属的NUMA节点，只会和同一节点的相邻Span合并
+    uint64_t freeTime; ///< 成为空闲Span的时间（毫秒），用于判断闲置了多久
+    Span *left;        ///< 大Span索引（SpanTree）中的左子节点
+    Span *right;       ///< 大Span索引（SpanTree）中的右子节点
+    std::atomic<void *> owner;  ///< 独占这个Span的线程缓存，其他线程释放时交还给它；还没有分给线程缓存时为nullptr，被多个线程缓存共用时为 sharedOwner()
+    std::atomic<bool> isReady;  ///< 是否在页缓存的无锁槽位中或正在锁外归还物理页，这时 isUse 仍为true，不参与合并
+
+    // 被多个线程缓存共用的Span的 owner，不指向任何线程缓存
+    static void *sharedOwner() { return reinterpret_cast<void *>(uintptr_t(1)); }
+};
+
+/**
+ * @class SpanList
+ * @brief 带哨兵节点的Span双向循环链表
+ *
+ * 哨兵节点的 next 指向第一个Span，prev 指向最后一个Span，
+ * 已知Span指针时可以 O(1) 地把它从所在链表中摘除，不需要知道链表头
+ */
+class SpanList
+{
+public:
+    SpanList()
+    {
+        head_.next = &head_;
+        head_.prev = &head_;
+    }
+
+    SpanList(const SpanList &) = delete;
+    SpanList &operator=(const SpanList &) = delete;
+
+    bool empty() const { return head_.next == &head_; }
+
+    Span *begin() { return head_.next; }
+
+    // 最后一个Span，也就是最早插入的Span
+    Span *rbegin() { return head_.prev; }
+
+    Span *end() { return &head_; }
+
+    // 头插法插入一个Span
+    void pushFront(Span *span)
+    {
+        span->next = head_.next;
+        span->prev = &head_;
+        head_.next->prev = span;
+        head_.next = span;
+    }
+
+    // 把Span从它所在的链表中摘除
+    static void erase(Span *span)
+    {
+        span->prev->next = span->next;
+        span->next->prev = span->prev;
+        span->next = nullptr;
+        span->prev = nullptr;
+    }
+
+private:
+    Span head_{};
+};
+
+/**
+ * @class SpanTree
+ * @brief 超过 MAX_FREE_PAGES 页的空闲Span的最佳适配索引
+ *
+ * 以（页数，起始地址）为键的侵入式 treap，节点就是Span本身，不需要额外申请内存：
+ * 1. lowerBound(n) 在 O(log n) 内找到页数不少于 n 的最小Span，页数相同时取地址最低的
+ * 2. 优先级由起始地址散列得到，树的期望高度为 O(log n)
+ * 3. Span 在树中时不能修改页数和起始地址，修改前必须先 erase
+ */
+class SpanTree
+{
+public:
+    bool empty() const { return root_ == nullptr; }
+
+    void insert(Span *span)
+    {
+        span->left = nullptr;
+        span->right = nullptr;
+        root_ = insert(root_, span);
+    }
+
+    void erase(Span *span)
+    {
+        root_ = erase(root_, span);
+        span->left = nullptr;
+        span->right = nullptr;
+    }
+
+    /**
+     * @brief 查找页数不少于 numPages 的最合适的Span
+     * @return Span* 找不到时返回nullptr
+     */
+    Span *lowerBound(size_t numPages) const
+    {
+        Span *best = nullptr;
+        for (Span *node = root_; node;)
+        {
+            if (node->sizePages >= numPages)
+            {
+                best = node;
+                node = node->left;
+            }
+            else
+            {
+                node = node->right;
+            }
+        }
+        return best;
+    }
+
+private:
+    static bool less(const Span *a, const Span *b)
+    {
+        return a->sizePages < b->sizePages || (a->sizePages == b->sizePages && a->PageAddr < b->PageAddr);
+    }
+
+    static uint32_t priority(const Span *span)
+    {
+        return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(span->PageAddr) >> PAGE_SHIFT) * 2654435761u;
+    }
+
+    // 把子树按 key 分成小于 key 和不小于 key 的两部分
+    static void split(Span *node, const Span *key, Span *&left, Span *&right)
+    {
+        if (!node)
+        {
+            left = right = nullptr;
+        }
+        else if (less(node, key))
+        {
+            split(node->right, key, node->right, right);
+            left = node;
+        }
+        else
+        {
+            split(node->left, key, left, node->left);
+            right = node;
+        }
+    }
+
+    // 合并两棵子树，left 中所有节点都小于 right 中的节点
+    static Span *merge(Span *left, Span *right)
+    {
+        if (!left || !right)
+            return left ? left : right;
+        if (priority(left) > priority(right))
+        {
+            left->right = merge(left->right, right);
+            return left;
+        }
+        right->left = merge(left, right->left);
+        return right;
+    }
+
+    static Span *insert(Span *node, Span *span)
+    {
+        if (!node)
+            return span;
+        if (priority(span) > priority(node))
+        {
+            split(node, span, span->left, span->right);
+            return span;
+        }
+        if (less(span, node))
+            node->left = insert(node->left, span);
+        else
+            node->right = insert(node->right, span);
+        return node;
+    }
+
+    static Span *erase(Span *node, Span *span)
+    {
+        if (!node)
+            return nullptr;
+        if (node == span)
+            return merge(node->left, node->right);
+        if (less(span, node))
+            node->left = erase(node->left, span);
+        else
+            node->right = erase(node->right, span);
+        return node;
+    }
+
+    Span *root_ = nullptr;
+};
+
 /**
  * @class PageCache
  * @brief 页面缓存管理类，管理系统级内存分配
  *
  * PageCache 使用 Span 结构来管理内存块，每个 Span 包含一定数量的连续页，
- * 通过 std::map 映射页数到对应的空闲 Span 链表，实现高效的内存分配和回收。
+ * 空闲 Span 按页数挂在双向链表数组上，超过 MAX_FREE_PAGES 页的挂在大 Span 链表上，
+ * 并由 SpanTree 按页数建立最佳适配索引；不小于 directMmapBytes 的请求单独mmap，释放后缓存复用。
+ * 页号到 Span 的映射保存在基数树 PageMap 中，查找不需要加锁。
+ * 闲置超过 SPAN_IDLE_MS 的空闲 Span 会按 releaseRate 通过 madvise 归还操作系统，
+ * 可以在释放路径上按时间间隔触发，也可以由后台线程（startScavenger）周期性执行。
+ * 不超过 READY_SPAN_MAX_PAGES 页的Span释放后先放进按页数划分的无锁槽位，同样页数的请求
+ * 直接取走，不经过 mutex_；mmap 期间也不持有 mutex_，持锁的只有分割与合并。
+ *
+ * 每个 NUMA 节点有一个独立的页缓存（各自的锁和空闲链表），新申请的内存通过 mbind 优先放在该节点上；
+ * 页表是所有节点共享的，释放时由Span记录的节点找到所属的页缓存。
  */
 class PageCache
 {
 public:
     /**
-     * @brief 获取 PageCache 的单例实例
+     * @brief 获取当前线程所在节点的 PageCache 实例
      * @return PageCache& 返回 PageCache 的引用
      *
-     * 使用 static 成员变量实现单例模式
+     * 只有一个节点时和原来的单例相同
+     */
+    static PageCache &GetInstance() { return forNode(Numa::currentNode()); }
+
+    /**
+     * @brief 获取指定节点的 PageCache 实例，第一次使用时创建
+     * @param node 节点编号，必须小于 Numa::nodeCount()
+     */
+    static PageCache &forNode(size_t node)
+    {
+        static std::atomic<PageCache *> instances[MAX_NUMA_NODES] = {};
+        PageCache *cache = instances[node].load(std::memory_order_acquire);
+        if (cache)
+            return *cache;
+
+        static ObjectPool<PageCache> pool;
+        std::lock_guard<std::mutex> lock(createMutex());
+        cache = instances[node].load(std::memory_order_relaxed);
+        if (!cache)
+        {
+            cache = pool.allocate();
+            // 元数据的内存都申请不到时无法继续运行
+            if (!cache)
+                abort();
+            cache->node_ = node;
+            instances[node].store(cache, std::memory_order_release);
+            createdNodes_.fetch_or(1u << node, std::memory_order_release);
+        }
+        return *cache;
+    }
+
+    /**
+     * @brief 已经创建的节点页缓存，未创建时返回nullptr
      */
-    static PageCache &GetInstance()
+    static PageCache *existingNode(size_t node)
     {
-        static PageCache instance;
-        return instance;
+        return node < Numa::nodeCount() && nodeCreated(node) ? &forNode(node) : nullptr;
     }
+
+    /**
+     * @brief 这个页缓存所属的节点
+     */
+    size_t getNode() const { return node_; }
     /**
      * @brief 分配指定页数的内存
      * @param numPages 请求的页数
      * @return void* 分配的内存块起始地址，失败返回nullptr
      *
      * 分配流程：
-     * 1. 在空闲Span映射表中查找合适大小的Span
-     * 2. 如果找到，可能需要分割Span
-     * 3. 如果没找到，向系统申请新内存
+     * 1. 小Span先从对应页数的无锁槽位中取，取到时不加锁，页表也已经记录好
+     * 2. 从 numPages 开始依次查找按页数分组的空闲链表，再在大 Span 链表中找最合适的
+     * 3. 如果找到，可能需要分割Span
+     * 4. 如果没找到，释放锁后向系统申请新内存（大页模式下先预留一个大页区域再重新查找）
+     * 5. 把Span覆盖的每一页都记录到页表中，便于通过任意地址找到Span
      */
     template <typename T, typename N>
     T *allocateSpan(N numPages)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        // 返回一个大于或者等于 numPages 的第一个Span
-        auto it = FreeSpans_.lower_bound(numPages);
-        // 如果it 不等于 FreeSpans_ 的end
-        if (it != FreeSpans_.end())
-        {
-            // 获取到 it对应的值
-            Span *span = it->second;
-            // 如果span 的next 不为空
-            if (span->next)
-            {
-                // 获取到key  就是 span 中的next
-                FreeSpans_[it->first] = span->next;
-            }
-            else
+        if (numPages == 0)
+            return nullptr;
+        bool direct = numPages * PAGE_SIZE >= directMmapBytes_.load(std::memory_order_relaxed);
+        if (!direct && numPages <= READY_SPAN_MAX_PAGES)
+        {
+            if (Span *span = popReady(numPages))
             {
-                // 如果当前Span链表中没有后续节点
-                // 直接从FreeSpans_中删除这个大小的映射
-                FreeSpans_.erase(it);
+                readyHits_.fetch_add(1, std::memory_order_relaxed);
+                return static_cast<T *>(span->PageAddr);
             }
-            if (span->sizePages > numPages)
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (direct)
+        {
+            return static_cast<T *>(allocateDirect(numPages, lock));
+        }
+        Span *span = findFreeSpan(numPages);
+        if (span)
+            spanHits_++;
+        else
+            spanMisses_++;
+#if MEMPOOL_HUGE_PAGES
+        if (!span && reserveArena(numPages, lock))
+        {
+            span = findFreeSpan(numPages);
+        }
+#endif
+        if (span)
+        {
+            eraseFreeSpan(span);
+            // 申请不到Span描述符时不分割，整个Span交给调用方
+            Span *newSpan = span->sizePages > numPages ? spanPool_.allocate() : nullptr;
+            if (newSpan)
             {
-                // 创建新的Span管理剩余内存
-                Span *newSpan = new Span;
-                // 计算新Span的起始地址：原地址 + 已分配页数 * 页大小
+                // 用新的Span管理剩余内存，计算新Span的起始地址：原地址 + 已分配页数 * 页大小
                 newSpan->PageAddr = static_cast<char *>(span->PageAddr) + numPages * PAGE_SIZE;
                 // 新Span的页数为原Span页数减去已分配页数
                 newSpan->sizePages = span->sizePages - numPages;
-                newSpan->next = nullptr;
-
-                // 将newspan 中的 sizePages 当做主键存在 map中
-                auto &list = FreeSpans_[newSpan->sizePages];
-                /*
-                    这里就是链表的头插法
-                    list就是整个链表的头部指针，将新的内存指向lsit  newSpan 为新的 节点
-                    然后lsit=newSpan  就是让list 这个头指针 指向newSpan 起始地址 更新头指针
-                */
-                newSpan->next = list;
-                list = newSpan;
+                newSpan->isReleased = span->isReleased;
+                newSpan->freeTime = span->freeTime;
+                newSpan->node = span->node;
+                // 剩余部分重新挂回空闲链表，空闲Span只需要记录首尾两页，合并时能找到即可
+                insertFreeSpan(newSpan);
                 // 将传入的字节数设置到 span 中
                 span->sizePages = numPages;
             }
-            // 在SpanMap_中记录分配的Span，便于后续释放
-            SpanMap_[span->PageAddr] = span;
-            return span->PageAddr;
         }
-
-        // 如果没有找到合适大小的Span，向系统申请新内存
-        T *memory = systemaAlloc<N>(numPages);
-        if (!memory)
+        else
         {
-            return nullptr;
+            // 如果没有找到合适大小的Span，向系统申请新内存
+            span = mapNewSpan(numPages, lock);
+            if (!span)
+            {
+                return nullptr;
+            }
         }
-        // 创建新的Span管理新分配的内存
-        Span *span = new Span;
-        span->PageAddr = memory;
-        span->sizePages = numPages;
-        span->next = nullptr;
 
-        // 记录span信息用于回收
-        SpanMap_[memory] = span;
-        return memory;
+        span->isUse = true;
+        span->isReleased = false;
+        span->sizeClass = 0;
+        span->objSize = 0;
+        span->freeList = nullptr;
+        span->useCount = 0;
+        // 在页表中记录分配的Span，便于后续释放
+        mapSpan(span);
+        return static_cast<T *>(span->PageAddr);
     }
 
 
@@ -111,131 +382,974 @@ public:
      * @param numPages 释放的页数
      *
      * 释放流程：
-     * 1. 查找对应的Span
-     * 2. 尝试合并相邻的空闲Span
-     * 3. 将合并后的Span放回空闲链表
+     * 1. 通过页表查找对应的Span
+     * 2. 不超过 READY_SPAN_MAX_PAGES 页的Span放进无锁槽位，槽位满时才加锁
+     * 3. 分别通过前一页和后一页查找相邻的Span，空闲时 O(1) 地从链表摘除并合并
+     * 4. 将合并后的Span放回空闲链表
+     * 5. 距离上次归还超过 SCAVENGE_INTERVAL_MS 时，按速率归还闲置的空闲Span
+     * 其他节点的Span转交给所属节点的页缓存释放
      */
     template <typename T, typename N>
     void deallocateSpan(T *ptr, N numPages)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
         // 查找和ptr 对应的span
-        auto it = SpanMap_.find(ptr);
-        if (it == SpanMap_.end())
+        Span *span = pageMap().get(pageId(ptr));
+        if (!span)
+            return;
+        if (span->node != node_)
+        {
+            forNode(span->node).deallocateSpan(ptr, numPages);
+            return;
+        }
+
+        // 已分配的Span只由释放它的线程修改，不加锁也可以读取这些字段
+        if (span->sizePages <= READY_SPAN_MAX_PAGES && span->PageAddr == ptr && span->isUse && !span->isDirect)
+        {
+            // 已经在槽位中说明是重复释放，忽略
+            if (span->isReady.exchange(true, std::memory_order_relaxed))
+                return;
+            if (pushReady(span))
+                return;
+            span->isReady.store(false, std::memory_order_relaxed);
+        }
+
+        MEMPOOL_LATENCY_SCOPE(LATENCY_SPAN_FREE);
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (span->PageAddr != ptr || !span->isUse || span->isReady.load(std::memory_order_relaxed))
         {
             return;
         }
-        // 获取到ptr 对应的span
-        Span *span = it->second;
-
-        // 将指针转换为字节数+将页数转换为实际的字节数当前span的下一个span
-        auto *nextAddr = static_cast<char *>(ptr) + numPages * PAGE_SIZE;
-        // 查找nextAddr 对应的span
-        auto nextIt = SpanMap_.find(nextAddr);
-        // 如果nextAddr 对应的span 存在
-        if (nextIt != SpanMap_.end())
-        {
-            // 如果找到了相邻的Span，就获取到nextSpan
-            Span *nextSpan = nextIt->second;
-            bool found = false;
-            // 获取相邻Span大小对应的空闲链表,NextLis 是链表头部指针引用
-            auto &NextList = FreeSpans_[nextSpan->sizePages];
-            // 如果nextSpan 是链表的头部指针
-            if (NextList == nextSpan)
+        if (span->isDirect)
+        {
+            releaseDirect(span);
+            return;
+        }
+        freeSpanLocked(span);
+        scavengeLocked(lock);
+    }
+
+
+    /**
+     * @brief 把Span与前后相邻的空闲Span合并后放回空闲链表，调用方必须持有 mutex_
+     * @param released Span的物理页是否已经归还，只有前后合并的Span也都已归还时合并结果才算已归还
+     * @param freeTime 释放时间，合并后取较晚的一个
+     */
+    void freeSpanLocked(Span *span, bool released = false, uint64_t freeTime = nowMs())
+    {
+        span->isUse = false;
+        span->isReleased = released;
+        span->freeTime = freeTime;
+
+        // 向前合并：前一页是前一个Span的尾页
+        size_t startId = pageId(span->PageAddr);
+        Span *prevSpan = pageMap().get(startId - 1);
+        if (prevSpan && !prevSpan->isUse && prevSpan->node == node_ && !prevSpan->isDirect &&
+            pageId(prevSpan->PageAddr) + prevSpan->sizePages == startId)
+        {
+            eraseFreeSpan(prevSpan);
+            span->PageAddr = prevSpan->PageAddr;
+            span->sizePages += prevSpan->sizePages;
+            span->isReleased = span->isReleased && prevSpan->isReleased;
+            span->freeTime = std::max(span->freeTime, prevSpan->freeTime);
+            spanPool_.deallocate(prevSpan);
+        }
+
+        // 向后合并：当前span的下一页是后一个Span的首页
+        size_t endId = pageId(span->PageAddr) + span->sizePages;
+        Span *nextSpan = pageMap().get(endId);
+        if (nextSpan && !nextSpan->isUse && nextSpan->node == node_ && !nextSpan->isDirect &&
+            pageId(nextSpan->PageAddr) == endId)
+        {
+            eraseFreeSpan(nextSpan);
+            span->sizePages += nextSpan->sizePages;
+            span->isReleased = span->isReleased && nextSpan->isReleased;
+            span->freeTime = std::max(span->freeTime, nextSpan->freeTime);
+            spanPool_.deallocate(nextSpan);
+        }
+
+        // 将合并后的span通过头插法插入空闲列表
+        insertFreeSpan(span);
+    }
+
+
+    /**
+     * @brief 不复制数据地扩大一个已分配的Span
+     * @param ptr Span的起始地址
+     * @param numPages 扩大后的页数
+     * @return void* 扩大后的起始地址，无法原地扩大时返回nullptr，原Span保持不变
+     *
+     * 1. 普通Span：紧跟在后面的空闲Span足够大时，从中切下需要的页数接到当前Span上
+     * 2. 单独mmap的Span：通过 mremap 扩大映射，内核移动页表而不复制内存，地址可能改变
+     * 页数不超过当前页数时直接返回 ptr
+     */
+    void *growSpan(void *ptr, size_t numPages)
+    {
+        Span *span = pageMap().get(pageId(ptr));
+        if (!span)
+            return nullptr;
+        if (span->node != node_)
+            return forNode(span->node).growSpan(ptr, numPages);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (span->PageAddr != ptr || !span->isUse)
+            return nullptr;
+        if (numPages <= span->sizePages)
+            return ptr;
+        if (span->isDirect)
+            return remapDirect(span, numPages);
+
+        size_t endId = pageId(span->PageAddr) + span->sizePages;
+        size_t extra = numPages - span->sizePages;
+        Span *nextSpan = pageMap().get(endId);
+        if (!nextSpan || nextSpan->isUse || nextSpan->node != node_ || nextSpan->isDirect ||
+            pageId(nextSpan->PageAddr) != endId || nextSpan->sizePages < extra)
+            return nullptr;
+
+        eraseFreeSpan(nextSpan);
+        if (nextSpan->sizePages > extra)
+        {
+            // 剩余部分继续作为空闲Span，保留原来的归还状态和释放时间
+            nextSpan->PageAddr = static_cast<char *>(nextSpan->PageAddr) + extra * PAGE_SIZE;
+            nextSpan->sizePages -= extra;
+            insertFreeSpan(nextSpan);
+        }
+        else
+        {
+            spanPool_.deallocate(nextSpan);
+        }
+        span->sizePages = numPages;
+        mapSpan(span);
+        return ptr;
+    }
+
+
+    /**
+     * @brief 立即把空闲Span的物理页归还操作系统
+     * @param maxBytes 最多归还的字节数
+     * @return size_t 实际归还的字节数
+     *
+     * 不考虑闲置时间和保留目标，用于内存压力事件等需要立刻降低RSS的场景
+     */
+    size_t releaseFreeMemory(size_t maxBytes = SIZE_MAX)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // 槽位中的Span先合并回空闲链表，才能和其他空闲Span一起归还
+        for (size_t numPages = 1; numPages <= READY_SPAN_MAX_PAGES; numPages++)
+        {
+            while (Span *span = popReady(numPages))
             {
-                // 如果nextSpan 是链表的头部指针，就将nextSpan的next 赋值给NextList
-                NextList = nextSpan->next;
-                found = true;
+                freeSpanLocked(span);
             }
-            else if (NextList)
-            {
-                // 如果nextSpan 不是链表的头部指针，就遍历链表，找到nextSpan
-                Span *prev = NextList;
-                while (prev->next)
+        }
+        size_t released = 0;
+        // 缓存的超大映射直接munmap
+        while (released < maxBytes && !directCache_.empty())
+        {
+            Span *span = directCache_.rbegin();
+            released += span->sizePages * PAGE_SIZE;
+            unmapDirect(span);
+        }
+        if (released < maxBytes)
+            released += releaseLocked(maxBytes - released, UINT64_MAX, 0, lock);
+        return released;
+    }
+
+    /**
+     * @brief 所有已创建节点的页缓存都立即归还空闲内存
+     * @return size_t 实际归还的字节数
+     */
+    static size_t releaseAllNodes(size_t maxBytes = SIZE_MAX)
+    {
+        size_t released = 0;
+        for (size_t node = 0; node < Numa::nodeCount() && released < maxBytes; node++)
+        {
+            if (PageCache *cache = existingNode(node))
+                released += cache->releaseFreeMemory(maxBytes - released);
+        }
+        return released;
+    }
+
+    /**
+     * @brief 设置单独mmap的阈值（字节），不小于该值的请求不再从Span中切分，对所有节点生效
+     */
+    static void setDirectMmapThreshold(size_t bytes) { directMmapBytes_.store(bytes, std::memory_order_relaxed); }
+
+    /**
+     * @brief 设置缓存的超大映射总字节数上限，0 表示释放后立即munmap
+     */
+    void setDirectCacheBytes(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        directCacheLimit_ = bytes;
+        trimDirectCache();
+    }
+
+    /**
+     * @brief 设置每个节点的归还速率（字节/秒），0 表示不再自动归还
+     */
+    static void setReleaseRate(size_t bytesPerSecond) { releaseRate_.store(bytesPerSecond, std::memory_order_relaxed); }
+
+    /**
+     * @brief 设置每个节点的保留目标：未归还的空闲内存不超过该值时不再自动归还
+     */
+    static void setRetainBytes(size_t bytes) { retainBytes_.store(bytes, std::memory_order_relaxed); }
+
+    /**
+     * @brief 选择归还方式
+     * @param useFree true 使用 MADV_FREE（内核在内存紧张时才回收，再次使用更快），
+     *                false 使用 MADV_DONTNEED（立即降低RSS，默认）
+     */
+    static void setUseMadvFree(bool useFree) { useMadvFree_.store(useFree, std::memory_order_relaxed); }
+
+    /**
+     * @brief 启动后台归还线程
+     * @param intervalMs 两次检查之间的间隔（毫秒）
+     * @return bool 启动成功返回true，已经在运行或创建线程失败返回false
+     *
+     * 释放路径上的归还只在有Span被释放时才会触发，进程进入空闲期后由后台线程继续归还。
+     * 一个线程依次处理所有已创建节点的页缓存
+     */
+    static bool startScavenger(size_t intervalMs = SCAVENGE_INTERVAL_MS)
+    {
+        int expected = SCAVENGER_STOPPED;
+        if (!scavengerState_.compare_exchange_strong(expected, SCAVENGER_RUNNING))
+            return false;
+        try
+        {
+            std::thread([intervalMs]() {
+                while (scavengerState_.load(std::memory_order_acquire) == SCAVENGER_RUNNING)
                 {
-                    // 如果prev的next 是nextSpan
-                    if (prev->next == nextSpan)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+                    for (size_t node = 0; node < Numa::nodeCount(); node++)
                     {
-                        // 将nextSpan从空闲链表中移除
-                        prev->next = nextSpan->next;
-                        found = true;
-                        break;
+                        if (PageCache *cache = existingNode(node))
+                        {
+                            std::unique_lock<std::mutex> lock(cache->mutex_);
+                            cache->scavengeLocked(lock);
+                        }
                     }
-                    prev = prev->next;
                 }
+                scavengerState_.store(SCAVENGER_STOPPED, std::memory_order_release);
+            }).detach();
+        }
+        catch (...)
+        {
+            scavengerState_.store(SCAVENGER_STOPPED, std::memory_order_release);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 停止后台归还线程，等待线程退出后返回
+     */
+    static void stopScavenger()
+    {
+        int expected = SCAVENGER_RUNNING;
+        if (!scavengerState_.compare_exchange_strong(expected, SCAVENGER_STOPPING))
+            return;
+        while (scavengerState_.load(std::memory_order_acquire) != SCAVENGER_STOPPED)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    /**
+     * @brief fork 之前获取创建实例的锁、所有节点的 mutex_ 和页表的锁
+     *
+     * 由 ThreadCache 注册的 pthread_atfork 处理函数在中心缓存的锁之后调用，顺序与正常路径一致。
+     * 无锁槽位中的Span不需要处理：fork 时正在被其他线程取出的Span在子进程中只是不再使用
+     */
+    static void prepareFork()
+    {
+        createMutex().lock();
+        for (size_t node = 0; node < MAX_NUMA_NODES; node++)
+        {
+            if (nodeCreated(node))
+                forNode(node).mutex_.lock();
+        }
+        mapMutex().lock();
+    }
+
+    /**
+     * @brief fork 之后释放 prepareFork() 获取的锁
+     * @param child 是否在子进程中：子进程里后台归还线程不存在了，状态改为已停止，可以重新启动
+     *
+     * glibc 的普通互斥锁解锁时不检查持有者，子进程中也可以直接解锁
+     */
+    static void afterFork(bool child)
+    {
+        mapMutex().unlock();
+        for (size_t node = 0; node < MAX_NUMA_NODES; node++)
+        {
+            if (nodeCreated(node))
+                forNode(node).mutex_.unlock();
+        }
+        createMutex().unlock();
+        if (child)
+            scavengerState_.store(SCAVENGER_STOPPED, std::memory_order_release);
+    }
+
+    /**
+     * @brief 页缓存中还占用物理内存的空闲字节数，包括无锁槽位中的Span
+     */
+    size_t getFreeBytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return freeBytes_ + readyBytes_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 页缓存中已经归还操作系统的空闲字节数
+     *
+     * 已归还的Span与刚释放的Span合并后按未归还计算，所以这是一个下限
+     */
+    size_t getReleasedBytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return releasedBytes_;
+    }
+
+
+    /**
+     * @brief 把这个节点的映射字节数、空闲字节数和命中次数累加到统计中
+     */
+    void collectStats(MemoryPoolStats &stats)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats.pageCache.hits += spanHits_ + readyHits_.load(std::memory_order_relaxed);
+        stats.pageCache.misses += spanMisses_;
+        stats.mappedBytes += mappedBytes_;
+        stats.freeBytes += freeBytes_ + readyBytes_.load(std::memory_order_relaxed);
+        stats.releasedBytes += releasedBytes_;
+        stats.directCacheBytes += directCacheBytes_;
+    }
+
+
+    /**
+     * @brief 查找地址所在的Span
+     * @param ptr 任意一个属于已分配Span的地址
+     * @return Span* 地址所在的Span，不属于内存池时返回nullptr
+     *
+     * 只读取所有节点共享的页表，不需要加锁
+     */
+    static Span *mapObjectToSpan(const void *ptr) { return pageMap().get(pageId(ptr)); }
+
+private:
+    friend class ObjectPool<PageCache>;
+
+    PageCache() = default;
+
+    /**
+     * @brief 所有节点共享的页表
+     *
+     * 不同节点的Span不会重叠，set() 只修改各自Span的页；
+     * 创建树节点的 ensure() 会修改树结构，由 mapMutex() 保护
+     */
+    static PageMap<Span> &pageMap()
+    {
+        static PageMap<Span> map;
+        return map;
+    }
+
+    static std::mutex &mapMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    // 创建节点实例的锁
+    static std::mutex &createMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static bool ensureMapped(void *ptr, size_t numPages)
+    {
+        std::lock_guard<std::mutex> lock(mapMutex());
+        return pageMap().ensure(pageId(ptr), numPages);
+    }
+
+    static bool nodeCreated(size_t node)
+    {
+        // 只判断节点的页缓存是否已经存在，不会创建实例
+        return createdNodes_.load(std::memory_order_acquire) & (1u << node);
+    }
+
+    /**
+     * @brief 计算地址对应的页号
+     */
+    static size_t pageId(const void *ptr) { return reinterpret_cast<uintptr_t>(ptr) >> PAGE_SHIFT; }
+
+    /**
+     * @brief 查找至少 numPages 页的空闲Span
+     *
+     * 1. 先按页数从小到大查找 FreeSpans_，找到的第一个就是最合适的
+     * 2. 再在 LargeTree_ 中找页数最少的，页数相同时取地址最低的，减少碎片
+     */
+    Span *findFreeSpan(size_t numPages)
+    {
+        for (size_t n = numPages; n <= MAX_FREE_PAGES; n++)
+        {
+            if (!FreeSpans_[n].empty())
+            {
+                return FreeSpans_[n].begin();
             }
-            // 只有在找到nextSpan的情况下才进行合并
-            if (found)
+        }
+
+        return LargeTree_.lowerBound(numPages);
+    }
+
+    /**
+     * @brief 分配一个单独mmap的超大Span
+     *
+     * 先在缓存中找页数足够且浪费不超过1/4的映射，找不到时再向系统申请，调用方持有 mutex_
+     */
+    void *allocateDirect(size_t numPages, std::unique_lock<std::mutex> &lock)
+    {
+        Span *span = nullptr;
+        for (Span *cached = directCache_.begin(); cached != directCache_.end(); cached = cached->next)
+        {
+            if (cached->sizePages >= numPages && cached->sizePages - numPages <= numPages / 4 &&
+                (!span || cached->sizePages < span->sizePages))
             {
-                // 合并span
-                span->sizePages += nextSpan->sizePages;
-                SpanMap_.erase(nextAddr);
-                delete nextSpan;
+                span = cached;
             }
         }
+        if (span)
+        {
+            SpanList::erase(span);
+            directCacheBytes_ -= span->sizePages * PAGE_SIZE;
+            spanHits_++;
+        }
+        else
+        {
+            spanMisses_++;
+            span = mapNewSpan(numPages, lock);
+            if (!span)
+                return nullptr;
+            span->isDirect = true;
+            mapSpan(span);
+        }
+        span->isUse = true;
+        span->sizeClass = 0;
+        span->objSize = 0;
+        span->freeList = nullptr;
+        span->useCount = 0;
+        return span->PageAddr;
+    }
 
-        // 将合并后的span通过头插法插入空闲列表
-        auto &list = FreeSpans_[span->sizePages];
-        span->next = list;
-        list = span;
+    /**
+     * @brief 释放单独mmap的超大Span：放进缓存，缓存超过上限时munmap最早放入的
+     *
+     * 缓存中的Span仍然映射在页表中，isUse 为false，重复释放会被忽略
+     */
+    void releaseDirect(Span *span)
+    {
+        span->isUse = false;
+        span->objSize = 0;
+        span->freeTime = nowMs();
+        directCache_.pushFront(span);
+        directCacheBytes_ += span->sizePages * PAGE_SIZE;
+        trimDirectCache();
     }
 
-private:
-    PageCache() = default;
+    void trimDirectCache()
+    {
+        while (directCacheBytes_ > directCacheLimit_)
+        {
+            unmapDirect(directCache_.rbegin());
+        }
+    }
+
+    /**
+     * @brief 用 mremap 扩大单独mmap的Span，调用方必须持有 mutex_
+     *
+     * 映射移动到新地址时清除旧地址的页表记录；新地址的页表节点申请失败时把映射移回原处
+     */
+    void *remapDirect(Span *span, size_t numPages)
+    {
+        void *oldAddr = span->PageAddr;
+        size_t oldBytes = span->sizePages * PAGE_SIZE;
+        size_t newBytes = numPages * PAGE_SIZE;
+        void *newAddr = mremap(oldAddr, oldBytes, newBytes, MREMAP_MAYMOVE);
+        if (newAddr == MAP_FAILED)
+            return nullptr;
+        if (!ensureMapped(newAddr, numPages))
+        {
+            if (newAddr != oldAddr)
+                mremap(newAddr, newBytes, oldBytes, MREMAP_MAYMOVE | MREMAP_FIXED, oldAddr);
+            else
+                mremap(newAddr, newBytes, oldBytes, 0);
+            return nullptr;
+        }
+        if (newAddr != oldAddr)
+        {
+            size_t start = pageId(oldAddr);
+            for (size_t i = 0; i < span->sizePages; i++)
+            {
+                pageMap().set(start + i, nullptr);
+            }
+        }
+        Numa::bindMemory(newAddr, newBytes, node_);
+        mappedBytes_ += newBytes - oldBytes;
+        span->PageAddr = newAddr;
+        span->sizePages = numPages;
+        mapSpan(span);
+        return newAddr;
+    }
+
+    /**
+     * @brief 把缓存中的超大映射还给系统，清除页表记录并回收Span描述符
+     */
+    void unmapDirect(Span *span)
+    {
+        SpanList::erase(span);
+        size_t bytes = span->sizePages * PAGE_SIZE;
+        directCacheBytes_ -= bytes;
+        size_t start = pageId(span->PageAddr);
+        for (size_t i = 0; i < span->sizePages; i++)
+        {
+            pageMap().set(start + i, nullptr);
+        }
+        systemFree(span->PageAddr, bytes);
+        spanPool_.deallocate(span);
+    }
+
+    /**
+     * @brief 单调时钟的当前时间（毫秒）
+     */
+    static uint64_t nowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    /**
+     * @brief 按速率归还闲置的空闲Span，调用方持有 mutex_
+     *
+     * 距离上次归还不足 SCAVENGE_INTERVAL_MS 时直接返回；
+     * 否则本次最多归还 releaseRate × 距上次归还的时间（最多按1秒计算）
+     */
+    void scavengeLocked(std::unique_lock<std::mutex> &lock)
+    {
+        size_t rate = releaseRate_.load(std::memory_order_relaxed);
+        if (rate == 0)
+            return;
+        uint64_t now = nowMs();
+        uint64_t elapsed = now - lastScavengeMs_;
+        if (elapsed < SCAVENGE_INTERVAL_MS)
+            return;
+        lastScavengeMs_ = now;
+        size_t budget = rate / 1000 * std::min<uint64_t>(elapsed, 1000);
+        releaseLocked(budget, now - SPAN_IDLE_MS, retainBytes_.load(std::memory_order_relaxed), lock);
+    }
+
+    /**
+     * @brief 归还空闲Span的物理页，调用方持有 mutex_
+     * @param maxBytes 最多归还的字节数
+     * @param idleBefore 只归还 freeTime 不晚于该时间的Span
+     * @param retain 未归还的空闲内存降到该值以下时停止
+     * @return size_t 实际归还的字节数
+     *
+     * 从最大的Span开始，每个链表从尾部（最早释放的）向前遍历，一次madvise归还尽可能多的内存。
+     * 选中的Span先从空闲链表摘下，设置 isUse 和 isReady，与槽位中的Span一样不参与合并、
+     * 重复释放时被忽略；madvise 期间释放 mutex_，重新加锁后再与相邻的空闲Span合并放回
+     */
+    size_t releaseLocked(size_t maxBytes, uint64_t idleBefore, size_t retain, std::unique_lock<std::mutex> &lock)
+    {
+        Span *pending = nullptr;
+        size_t selected = 0;
+        for (size_t n = MAX_FREE_PAGES + 1; n > 0 && selected < maxBytes && freeBytes_ > retain; n--)
+        {
+            SpanList &list = n > MAX_FREE_PAGES ? LargeSpans_ : FreeSpans_[n];
+            Span *span = list.rbegin();
+            while (span != list.end() && selected < maxBytes && freeBytes_ > retain)
+            {
+                Span *prev = span->prev;
+                if (!span->isReleased && span->freeTime <= idleBefore)
+                {
+                    eraseFreeSpan(span);
+                    span->isUse = true;
+                    span->isReady.store(true, std::memory_order_relaxed);
+                    span->next = pending;
+                    pending = span;
+                    selected += span->sizePages * PAGE_SIZE;
+                }
+                span = prev;
+            }
+        }
+        if (!pending)
+            return 0;
+
+        int advice = useMadvFree_.load(std::memory_order_relaxed) ? MADV_FREE : MADV_DONTNEED;
+        lock.unlock();
+        for (Span *span = pending; span; span = span->next)
+        {
+            span->isReleased = madvise(span->PageAddr, span->sizePages * PAGE_SIZE, advice) == 0;
+        }
+        lock.lock();
+
+        size_t released = 0;
+        while (Span *span = pending)
+        {
+            pending = span->next;
+            if (span->isReleased)
+                released += span->sizePages * PAGE_SIZE;
+            span->isReady.store(false, std::memory_order_relaxed);
+            freeSpanLocked(span, span->isReleased, span->freeTime);
+        }
+        return released;
+    }
+
+    /**
+     * @brief 把空闲Span从链表中摘除，并扣除对应的空闲字节统计
+     */
+    void eraseFreeSpan(Span *span)
+    {
+        SpanList::erase(span);
+        if (span->sizePages > MAX_FREE_PAGES)
+            LargeTree_.erase(span);
+        size_t bytes = span->sizePages * PAGE_SIZE;
+        if (span->isReleased)
+            releasedBytes_ -= bytes;
+        else
+            freeBytes_ -= bytes;
+    }
+
+    /**
+     * @brief 把空闲Span挂到对应页数的链表上，并记录首尾两页
+     *
+     * 调用前需要设置好 isReleased 和 freeTime
+     */
+    void insertFreeSpan(Span *span)
+    {
+        size_t bytes = span->sizePages * PAGE_SIZE;
+        if (span->isReleased)
+            releasedBytes_ += bytes;
+        else
+            freeBytes_ += bytes;
+        span->isUse = false;
+        span->sizeClass = 0;
+        span->objSize = 0;
+        span->freeList = nullptr;
+        span->useCount = 0;
+        mapSpanEdges(span);
+        if (span->sizePages <= MAX_FREE_PAGES)
+        {
+            FreeSpans_[span->sizePages].pushFront(span);
+        }
+        else
+        {
+            LargeSpans_.pushFront(span);
+            LargeTree_.insert(span);
+        }
+    }
+
+    /**
+     * @brief 把Span覆盖的每一页都映射到Span
+     *
+     * 已分配的Span需要支持通过内部任意地址查找
+     */
+    void mapSpan(Span *span)
+    {
+        size_t start = pageId(span->PageAddr);
+        for (size_t i = 0; i < span->sizePages; i++)
+        {
+            pageMap().set(start + i, span);
+        }
+    }
+
+    /**
+     * @brief 只映射Span的首页和尾页
+     *
+     * 空闲Span只会在合并时被相邻Span通过边界页查找到
+     */
+    void mapSpanEdges(Span *span)
+    {
+        size_t start = pageId(span->PageAddr);
+        pageMap().set(start, span);
+        pageMap().set(start + span->sizePages - 1, span);
+    }
+
+#if MEMPOOL_HUGE_PAGES
+    /**
+     * @brief 预留一个按2MB对齐的大页区域，作为一个空闲Span放入页缓存
+     * @param numPages 本次请求的页数，区域至少能容纳这么多页
+     * @return bool 预留成功返回true
+     *
+     * 新区域还没有被访问过，不占用物理内存，按已归还处理，避免被 scavenger 重复 madvise。
+     * 调用方持有 mutex_，映射期间释放
+     */
+    bool reserveArena(size_t numPages, std::unique_lock<std::mutex> &lock)
+    {
+        size_t bytes = std::max(numPages * PAGE_SIZE, ARENA_SIZE);
+        bytes = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        lock.unlock();
+        void *ptr = mapArena(bytes);
+        bool mapped = ptr && ensureMapped(ptr, bytes / PAGE_SIZE);
+        lock.lock();
+        if (!ptr)
+            return false;
+
+        size_t pages = bytes / PAGE_SIZE;
+        mappedBytes_ += bytes;
+        Span *span = mapped ? spanPool_.allocate() : nullptr;
+        if (!span)
+        {
+            systemFree(ptr, bytes);
+            return false;
+        }
+        span->PageAddr = ptr;
+        span->sizePages = pages;
+        span->isReleased = true;
+        span->freeTime = nowMs();
+        span->node = static_cast<uint32_t>(node_);
+        insertFreeSpan(span);
+        return true;
+    }
+
+    /**
+     * @brief 映射一个按2MB对齐的大页区域，不访问页缓存的状态，调用时不持有 mutex_
+     * @return void* 区域的起始地址，失败返回nullptr
+     */
+    void *mapArena(size_t bytes)
+    {
+        MEMPOOL_LATENCY_SCOPE(LATENCY_SYSTEM_ALLOC);
+        void *ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED)
+        {
+            // 没有预留的 hugetlbfs 大页：多映射2MB，裁掉首尾使区域按2MB对齐，再交给透明大页
+            void *raw = mmap(nullptr, bytes + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (raw == MAP_FAILED)
+                return nullptr;
+            uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+            uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+            if (aligned > start)
+                munmap(raw, aligned - start);
+            munmap(reinterpret_cast<void *>(aligned + bytes), HUGE_PAGE_SIZE - (aligned - start));
+            ptr = reinterpret_cast<void *>(aligned);
+            madvise(ptr, bytes, MADV_HUGEPAGE);
+        }
+        Numa::bindMemory(ptr, bytes, node_);
+        return ptr;
+    }
+#endif
 
     /**
      * @brief 向系统申请内存
      * @param numPages 请求的页数
      * @return void* 分配的内存指针，失败返回nullptr
      *
-     * 使用mmap系统调用直接向操作系统申请内存
+     * 使用mmap系统调用直接向操作系统申请内存，匿名映射的页已经由内核清零，
+     * 第一次访问时才分配物理页，这里不再memset，避免一次性把所有页都换入内存。
+     * 不访问页缓存的状态，调用时不持有 mutex_，映射字节数由调用方加锁后登记
      */
     template <typename T, typename N>
     T *systemaAlloc(N numPages)
     {
+        MEMPOOL_LATENCY_SCOPE(LATENCY_SYSTEM_ALLOC);
         // 计算需要分配的总字节数
         N size = numPages * PAGE_SIZE;
 
         // 使用mmap分配内存
-        T *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
         if (ptr == MAP_FAILED)
             return nullptr;
+        // 还没有访问过，物理页在第一次访问时按节点策略分配
+        Numa::bindMemory(ptr, size, node_);
+        return static_cast<T *>(ptr);
+    }
 
-        // 初始化内存为0
-        memset(ptr, 0, size);
-        return ptr;
+    /**
+     * @brief 向系统映射新内存并创建管理它的Span，调用方持有 mutex_
+     * @return Span* 新的Span，只设置了地址、页数和节点，失败返回nullptr
+     *
+     * mmap 和创建页表节点期间释放 mutex_，其他线程可以继续分配、释放Span；
+     * 重新加锁后再登记映射字节数、申请Span描述符
+     */
+    Span *mapNewSpan(size_t numPages, std::unique_lock<std::mutex> &lock)
+    {
+        lock.unlock();
+        void *memory = systemaAlloc<void, size_t>(numPages);
+        // 页表节点申请失败时，这段内存无法被管理，直接还给系统
+        bool mapped = memory && ensureMapped(memory, numPages);
+        lock.lock();
+        if (!memory)
+            return nullptr;
+        mappedBytes_ += numPages * PAGE_SIZE;
+        Span *span = mapped ? spanPool_.allocate() : nullptr;
+        if (!span)
+        {
+            systemFree(memory, numPages * PAGE_SIZE);
+            return nullptr;
+        }
+        span->PageAddr = memory;
+        span->sizePages = numPages;
+        span->node = static_cast<uint32_t>(node_);
+        return span;
+    }
+
+    /**
+     * @brief 每种页数的无锁槽位最多保存的Span数
+     */
+    static constexpr size_t readyCapacity(size_t numPages)
+    {
+        return std::min(READY_SPAN_SLOTS, std::max<size_t>(1, READY_SPAN_BYTES / (numPages * PAGE_SIZE)));
     }
 
+    /**
+     * @brief 把已分配的Span放进对应页数的无锁槽位
+     * @return bool 槽位已满时返回false，由调用方加锁释放
+     *
+     * 调用前已经把 isReady 设为true；Span保持 isUse 和页表中每一页的记录，取出时不需要重新映射
+     */
+    bool pushReady(Span *span)
+    {
+        span->sizeClass = 0;
+        span->objSize = 0;
+        span->freeList = nullptr;
+        span->useCount = 0;
+        // 放入槽位后Span随时可能被其他线程取走，之后不能再访问；
+        // 字节数先加上，保证取走的线程减去时不会减到0以下
+        size_t numPages = span->sizePages;
+        readyBytes_.fetch_add(numPages * PAGE_SIZE, std::memory_order_relaxed);
+        std::array<std::atomic<Span *>, READY_SPAN_SLOTS> &slots = readySpans_[numPages].slots;
+        for (size_t i = 0; i < readyCapacity(numPages); i++)
+        {
+            Span *empty = nullptr;
+            if (!slots[i].load(std::memory_order_relaxed) &&
+                slots[i].compare_exchange_strong(empty, span, std::memory_order_release, std::memory_order_relaxed))
+                return true;
+        }
+        readyBytes_.fetch_sub(numPages * PAGE_SIZE, std::memory_order_relaxed);
+        return false;
+    }
 
-private:
     /**
-     * @struct Span
-     * @brief 内存页面管理结构
+     * @brief 从对应页数的无锁槽位中取一个Span
+     * @return Span* 槽位为空时返回nullptr
      *
-     * Span 结构表示一段连续的内存页，用于管理大块内存
+     * 用 exchange 清空槽位，同一个Span只会被一个线程取走
+     */
+    Span *popReady(size_t numPages)
+    {
+        std::array<std::atomic<Span *>, READY_SPAN_SLOTS> &slots = readySpans_[numPages].slots;
+        for (size_t i = 0; i < readyCapacity(numPages); i++)
+        {
+            if (!slots[i].load(std::memory_order_relaxed))
+                continue;
+            if (Span *span = slots[i].exchange(nullptr, std::memory_order_acquire))
+            {
+                span->isReady.store(false, std::memory_order_relaxed);
+                readyBytes_.fetch_sub(numPages * PAGE_SIZE, std::memory_order_relaxed);
+                return span;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 把映射还给系统
+     */
+    void systemFree(void *ptr, size_t bytes)
+    {
+        munmap(ptr, bytes);
+        mappedBytes_ -= bytes;
+    }
+
+
+private:
+    /**
+     * 按页数分组的空闲Span链表，下标就是页数（下标0不使用）
+     * 1. 查找时从请求的页数开始向上找第一个非空链表
+     * 2. 双向链表，合并时可以 O(1) 地摘除相邻的空闲Span
+     */
+    std::array<SpanList, MAX_FREE_PAGES + 1> FreeSpans_;
+
+    /**
+     * 超过 MAX_FREE_PAGES 页的空闲Span
+     * 1. LargeSpans_ 按释放时间排列，归还操作系统时从最早释放的开始
+     * 2. LargeTree_ 按页数排列，分配时最佳适配
+     */
+    SpanList LargeSpans_;
+    SpanTree LargeTree_;
+
+    /**
+     * 不超过 READY_SPAN_MAX_PAGES 页的已分配Span的无锁缓存，下标就是页数（下标0不使用）
+     * 1. 每个槽位保存一个Span或nullptr，放入时用CAS占用空槽位，取出时用exchange清空槽位，
+     *    不经过Span的链表指针，没有ABA问题
+     * 2. 槽位中的Span仍然标记为使用中，不会被相邻Span合并；releaseFreeMemory() 时才合并回空闲链表
+     * 3. 每种页数的槽位单独占用缓存行，不同页数的请求互不干扰
      */
-    struct Span
+    struct alignas(64) ReadySlots
     {
-        void *PageAddr;    ///< 页面的起始地址
-        size_t sizePages;  ///< 页面的数量
-        Span *next;        ///< 指向下一个Span的指针，形成链表
+        std::array<std::atomic<Span *>, READY_SPAN_SLOTS> slots{};
     };
+    std::array<ReadySlots, READY_SPAN_MAX_PAGES + 1> readySpans_;
+    std::atomic<size_t> readyBytes_{0};
+    std::atomic<uint64_t> readyHits_{0};
+
+    /**
+     * 单独mmap的超大Span释放后的缓存（mutex_ 保护），按释放时间排列
+     */
+    SpanList directCache_;
+    size_t directCacheBytes_ = 0;
+    size_t directCacheLimit_ = DIRECT_CACHE_BYTES;
+    static inline std::atomic<size_t> directMmapBytes_{DIRECT_MMAP_BYTES};
 
     /**
-     * 空闲Span映射表，以页数为键，对应页数的Span链表为值
-     * 使用std::map便于查找最接近请求页数的Span
-     * size_t 是主键类型，Span* 是值类型
+     * 页表（pageMap()）：页号 -> Span，基数树实现，所有节点共享
+     * 1. 已分配的Span每一页都有记录，用于释放时通过地址快速找到Span
+     * 2. 空闲的Span只记录首尾两页，用于合并相邻Span
+     * 3. 读操作无锁，写操作在所属节点的 mutex_ 保护下进行
      */
-    std::map<size_t, Span *> FreeSpans_;
+
+    // 所属的NUMA节点
+    size_t node_ = 0;
+
+    // 已经创建的节点（位图）
+    static inline std::atomic<unsigned> createdNodes_{0};
 
     /**
-     * 已分配Span映射表，以内存地址为键，Span指针为值
-     * 用于在内存释放时快速找到对应的Span
+     * Span描述符的对象池（mutex_ 保护）
+     * 描述符的申请和释放都在持锁期间进行，不调用系统 malloc，持锁时间不受其影响
      */
-    std::map<void *, Span *> SpanMap_;
+    ObjectPool<Span> spanPool_;
 
     /**
      * 互斥锁，保证多线程环境下的线程安全
      */
     std::mutex mutex_;
-};
\ No newline at end of file
+
+    /**
+     * 空闲内存统计（mutex_ 保护）
+     * freeBytes_ 是还占用物理内存的空闲字节数，releasedBytes_ 是已经madvise归还的空闲字节数
+     */
+    size_t freeBytes_ = 0;
+    size_t releasedBytes_ = 0;
+
+    /**
+     * 统计（mutex_ 保护）
+     * mappedBytes_ 是向系统映射的字节数，spanHits_/spanMisses_ 是Span请求由空闲Span满足、需要新映射的次数
+     */
+    size_t mappedBytes_ = 0;
+    uint64_t spanHits_ = 0;
+    uint64_t spanMisses_ = 0;
+
+    // 上次按速率归还的时间（毫秒，mutex_ 保护）
+    uint64_t lastScavengeMs_ = 0;
+
+    // 归还策略，所有节点共用，可以在任意线程修改
+    static inline std::atomic<size_t> releaseRate_{RELEASE_RATE};
+    static inline std::atomic<size_t> retainBytes_{RETAIN_BYTES};
+    static inline std::atomic<bool> useMadvFree_{false};
+
+    // 后台归还线程的状态
+    static constexpr int SCAVENGER_STOPPED = 0;
+    static constexpr int SCAVENGER_RUNNING = 1;
+    static constexpr int SCAVENGER_STOPPING = 2;
+    static inline std::atomic<int> scavengerState_{SCAVENGER_STOPPED};
+};
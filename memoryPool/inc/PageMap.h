@@ -0,0 +1,129 @@
+// 页号到Span的映射表
+
+#ifndef PAGE_MAP_H
+#define PAGE_MAP_H
+#include "Conmmon.h"
+#include "ObjectPool.h"
+#include <atomic>
+#include <cstddef>
+
+/**
+ * @class PageMap
+ * @brief 三层基数树（radix tree），以页号（地址 >> PAGE_SHIFT）为键保存 T* 指针
+ *
+ * x86-64 用户态地址为48位，去掉12位页内偏移后页号共36位，按 12/12/12 分成三层：
+ *    页号: | ROOT(12位) | MID(12位) | LEAF(12位) |
+ * 1. 根节点数组固定在对象内部（32KB），中间节点和叶子节点按需从对象池申请
+ * 2. get() 只做三次原子读，不需要加锁，时间复杂度 O(1)
+ * 3. set()/ensure() 会修改树结构，必须由调用方（PageCache）在持有锁的情况下调用
+ * 4. 节点一旦创建就不再释放，读线程不会访问到被回收的节点
+ */
+template <typename T>
+class PageMap
+{
+public:
+    /**
+     * @brief 查找页号对应的值
+     * @param pageId 页号
+     * @return T* 页号对应的值，不存在时返回nullptr
+     *
+     * 无锁读取，可以和持锁的写操作并发执行
+     */
+    T *get(size_t pageId) const
+    {
+        size_t i1 = pageId >> (MID_BITS + LEAF_BITS);
+        if (i1 >= ROOT_LENGTH)
+            return nullptr;
+        Node *node = root_[i1].load(std::memory_order_acquire);
+        if (!node)
+            return nullptr;
+        Leaf *leaf = node->leafs[(pageId >> LEAF_BITS) & (MID_LENGTH - 1)].load(std::memory_order_acquire);
+        if (!leaf)
+            return nullptr;
+        return leaf->values[pageId & (LEAF_LENGTH - 1)].load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief 设置页号对应的值
+     * @param pageId 页号
+     * @param value 要保存的值
+     *
+     * 调用前必须保证 ensure() 已经为该页号创建了节点
+     */
+    void set(size_t pageId, T *value)
+    {
+        Node *node = root_[pageId >> (MID_BITS + LEAF_BITS)].load(std::memory_order_relaxed);
+        Leaf *leaf = node->leafs[(pageId >> LEAF_BITS) & (MID_LENGTH - 1)].load(std::memory_order_relaxed);
+        // release 保证读线程拿到指针时，T 的内容已经初始化完成
+        leaf->values[pageId & (LEAF_LENGTH - 1)].store(value, std::memory_order_release);
+    }
+
+    /**
+     * @brief 为 [start, start + numPages) 范围内的页号创建中间节点和叶子节点
+     * @param start 起始页号
+     * @param numPages 页数
+     * @return bool 节点全部创建成功返回true，地址超出范围或内存不足返回false
+     */
+    bool ensure(size_t start, size_t numPages)
+    {
+        for (size_t key = start; key < start + numPages;)
+        {
+            size_t i1 = key >> (MID_BITS + LEAF_BITS);
+            if (i1 >= ROOT_LENGTH)
+                return false;
+
+            Node *node = root_[i1].load(std::memory_order_relaxed);
+            if (!node)
+            {
+                node = nodePool_.allocate();
+                if (!node)
+                    return false;
+                root_[i1].store(node, std::memory_order_release);
+            }
+
+            auto &leafSlot = node->leafs[(key >> LEAF_BITS) & (MID_LENGTH - 1)];
+            if (!leafSlot.load(std::memory_order_relaxed))
+            {
+                Leaf *leaf = leafPool_.allocate();
+                if (!leaf)
+                    return false;
+                leafSlot.store(leaf, std::memory_order_release);
+            }
+            // 跳到下一个叶子节点覆盖的第一个页号
+            key = ((key >> LEAF_BITS) + 1) << LEAF_BITS;
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t ADDRESS_BITS = 48;
+    static constexpr size_t KEY_BITS = ADDRESS_BITS - PAGE_SHIFT;
+    static constexpr size_t LEAF_BITS = KEY_BITS / 3;
+    static constexpr size_t MID_BITS = KEY_BITS / 3;
+    static constexpr size_t ROOT_BITS = KEY_BITS - LEAF_BITS - MID_BITS;
+
+    static constexpr size_t ROOT_LENGTH = size_t(1) << ROOT_BITS;
+    static constexpr size_t MID_LENGTH = size_t(1) << MID_BITS;
+    static constexpr size_t LEAF_LENGTH = size_t(1) << LEAF_BITS;
+
+    // 叶子节点：直接保存值
+    struct Leaf
+    {
+        std::atomic<T *> values[LEAF_LENGTH];
+    };
+
+    // 中间节点：保存叶子节点指针
+    struct Node
+    {
+        std::atomic<Leaf *> leafs[MID_LENGTH];
+    };
+
+    // 根节点数组
+    std::atomic<Node *> root_[ROOT_LENGTH] = {};
+
+    // 树节点的对象池，不依赖系统malloc；值初始化后所有指针都是nullptr
+    ObjectPool<Node> nodePool_;
+    ObjectPool<Leaf> leafPool_;
+};
+
+#endif
@@ -0,0 +1,87 @@
+// 标准库容器使用的分配器
+
+#ifndef POOL_ALLOCATOR_H
+#define POOL_ALLOCATOR_H
+#include "ThreadCache.h"
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+/**
+ * @class PoolAllocator
+ * @brief 满足 std::allocator 要求的分配器，内存来自内存池
+ *
+ * 例如 std::vector<Node, PoolAllocator<Node>>、std::map<K, V, std::less<K>, PoolAllocator<std::pair<const K, V>>>。
+ * 1. 一次只分配一个对象时（链表、map 等节点容器的节点）走 allocateFixed<sizeof(T)>，
+ *    大小类在编译期确定
+ * 2. 一次分配多个对象时（vector 等连续容器）按运行时大小分配
+ * 分配器没有状态，所有实例都相等，容器之间可以交换、移动内存
+ */
+template <typename T>
+class PoolAllocator
+{
+public:
+    static_assert(alignof(T) <= PAGE_SIZE, "对齐超过一页的类型不能使用 PoolAllocator");
+
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
+
+    PoolAllocator() noexcept = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &) noexcept
+    {
+    }
+
+    /**
+     * @brief 分配 n 个 T 的内存
+     * @throw std::bad_array_new_length n 太大，std::bad_alloc 内存不足
+     */
+    T *allocate(size_type n)
+    {
+        void *ptr = nullptr;
+        if (n == 1)
+        {
+            ptr = ThreadCache::getThreadCache()->allocateFixed<sizeof(T)>();
+        }
+        else
+        {
+            if (n > SIZE_MAX / 2 / sizeof(T))
+                throw std::bad_array_new_length();
+            // n * sizeof(T) 仍然是 alignof(T) 的倍数，对应的大小类满足对齐要求
+            ptr = ThreadCache::getThreadCache()->allocate<void>(n * sizeof(T));
+        }
+        if (!ptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(ptr);
+    }
+
+    /**
+     * @brief 释放 allocate(n) 分配的内存，n 必须与分配时相同
+     */
+    void deallocate(T *ptr, size_type n) noexcept
+    {
+        if (n == 1)
+            ThreadCache::getThreadCache()->deallocateFixed<sizeof(T)>(ptr);
+        else
+            ThreadCache::getThreadCache()->deallocate(ptr, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T> &, const PoolAllocator<U> &) noexcept
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T> &, const PoolAllocator<U> &) noexcept
+{
+    return false;
+}
+
+#endif
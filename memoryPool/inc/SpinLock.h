@@ -0,0 +1,119 @@
+// 自旋后休眠的锁
+
+#ifndef SPIN_LOCK_H
+#define SPIN_LOCK_H
+#include "Conmmon.h"
+#include "LatencyHistogram.h"
+#include <atomic>
+#include <cstdint>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * @class SpinLock
+ * @brief 先自旋、再通过 futex 休眠的锁，独占一个缓存行
+ *
+ * state_ 为0表示未加锁、1表示已加锁，waiters_ 是在 futex 上休眠（或准备休眠）的线程数
+ * 1. 没有竞争时加锁、解锁各一次原子操作，不进入内核
+ * 2. 有竞争时用 pause 指令自旋，等待时间指数增长，每轮最多 SPIN_MAX_PAUSES 次 pause
+ * 3. 仍然拿不到锁时在 futex 上休眠，持锁线程被抢占时等待者不会一直占着CPU调用 sched_yield，
+ *    解锁时只有 waiters_ 不为0才进入内核唤醒
+ * 满足 Lockable 的要求，可以配合 std::lock_guard 使用。
+ * 进入慢路径的次数记录在 contentions_ 中，只在发生竞争时修改，用于统计锁竞争
+ */
+class alignas(64) SpinLock
+{
+public:
+    SpinLock() = default;
+    SpinLock(const SpinLock &) = delete;
+    SpinLock &operator=(const SpinLock &) = delete;
+
+    void lock()
+    {
+        uint32_t expected = 0;
+        if (__builtin_expect(state_.compare_exchange_strong(expected, 1, std::memory_order_acquire,
+                                                            std::memory_order_relaxed), 1))
+            return;
+        lockSlow();
+    }
+
+    bool try_lock()
+    {
+        uint32_t expected = 0;
+        return state_.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock()
+    {
+        state_.exchange(0, std::memory_order_seq_cst);
+        // 有线程在 futex 上休眠时唤醒其中一个
+        if (waiters_.load(std::memory_order_seq_cst) != 0)
+            syscall(SYS_futex, &state_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+
+    /**
+     * @brief fork 之后在子进程中释放锁
+     *
+     * 子进程中只有调用 fork 的线程，父进程里在 futex 上休眠的等待者不存在了，
+     * 等待者计数一起清零，之后解锁不会因为残留的计数每次都进入内核
+     */
+    void unlockInChild()
+    {
+        waiters_.store(0, std::memory_order_relaxed);
+        state_.store(0, std::memory_order_release);
+    }
+
+    /**
+     * @brief 加锁时发生竞争（没能一次拿到锁）的次数
+     */
+    uint64_t contentions() const { return contentions_.load(std::memory_order_relaxed); }
+
+private:
+    void lockSlow()
+    {
+        MEMPOOL_LATENCY_SCOPE(LATENCY_LOCK_WAIT);
+        contentions_.fetch_add(1, std::memory_order_relaxed);
+        // 有限次数的指数退避自旋；只有一个CPU时持锁线程不可能同时在运行，不自旋
+        for (size_t pauses = 1; pauses <= SPIN_MAX_PAUSES && multiCpu(); pauses <<= 1)
+        {
+            for (size_t i = 0; i < pauses; i++)
+            {
+                cpuRelax();
+            }
+            uint32_t state = state_.load(std::memory_order_relaxed);
+            if (state == 0 &&
+                state_.compare_exchange_weak(state, 1, std::memory_order_acquire, std::memory_order_relaxed))
+                return;
+        }
+
+        // 先登记为等待者再抢锁，解锁的线程一定能看到登记，不会漏掉唤醒
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        while (state_.exchange(1, std::memory_order_seq_cst) != 0)
+        {
+            syscall(SYS_futex, &state_, FUTEX_WAIT_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    static bool multiCpu()
+    {
+        static const bool multi = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+        return multi;
+    }
+
+    static void cpuRelax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    std::atomic<uint32_t> state_{0};
+    std::atomic<uint32_t> waiters_{0};
+    std::atomic<uint64_t> contentions_{0};
+};
+
+#endif
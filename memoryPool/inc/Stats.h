@@ -0,0 +1,185 @@
+// 内存池的统计信息
+
+#ifndef STATS_H
+#define STATS_H
+#include "Conmmon.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <unistd.h>
+
+/**
+ * @brief 统计计数器加 n
+ *
+ * 计数器只由一个线程修改（线程缓存自己的计数器），或者只在持有锁时修改，
+ * 用一次读和一次写代替原子的读改写，不加 lock 前缀；其他线程随时可以读取
+ */
+template <typename T>
+inline void counterAdd(std::atomic<T> &counter, T n)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+template <typename T>
+inline void counterSub(std::atomic<T> &counter, T n)
+{
+    counter.store(counter.load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 一个大小类的统计
+ *
+ * 计数器从程序启动开始累计，对象数和字节数是收集时的快照。
+ * 各个线程的计数器不加锁读取，有线程正在分配、释放时各项之间可能有少量偏差
+ */
+struct ClassStats
+{
+    size_t size = 0;                ///< 大小类的字节数
+    uint64_t allocs = 0;            ///< 分配的内存块数
+    uint64_t frees = 0;             ///< 释放的内存块数
+    uint64_t frontMisses = 0;       ///< 线程缓存为空、向中心缓存申请的次数（按CPU划分的缓存不统计）
+    uint64_t transferHits = 0;      ///< 从传输缓存整批取走的次数
+    uint64_t transferMisses = 0;    ///< 传输缓存取不到、进入中心缓存Span链表的次数
+    uint64_t spanFetches = 0;       ///< 向页缓存申请新Span的次数
+    uint64_t lockContentions = 0;   ///< 中心缓存和传输缓存的锁发生竞争的次数
+    size_t liveObjects = 0;         ///< 用户正在使用的内存块数
+    size_t frontObjects = 0;        ///< 线程缓存（或CPU缓存）和远程队列中的内存块数
+    size_t transferObjects = 0;     ///< 传输缓存中的内存块数
+    size_t centralObjects = 0;      ///< 中心缓存Span上的空闲内存块数
+    size_t spans = 0;               ///< 切分给这个大小类的Span数
+    size_t spanBytes = 0;           ///< 这些Span的总字节数
+
+    /**
+     * @brief 碎片率：Span中没有被用户使用的字节所占的比例
+     */
+    double fragmentation() const
+    {
+        return spanBytes ? 1.0 - static_cast<double>(liveObjects * size) / static_cast<double>(spanBytes) : 0.0;
+    }
+};
+
+/**
+ * @brief 一层缓存的命中统计
+ */
+struct TierStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    double hitRate() const { return hits + misses ? static_cast<double>(hits) / static_cast<double>(hits + misses) : 0.0; }
+};
+
+/**
+ * @struct MemoryPoolStats
+ * @brief 整个内存池的统计快照，由 ThreadCache::getStats() 收集
+ *
+ * 1. 分配、释放次数记录在各个线程缓存自己的计数器中，快路径上没有共享的原子操作，
+ *    收集时汇总所有线程（包括已退出的线程）
+ * 2. 中心缓存、传输缓存、页缓存的计数器在各自已经持有的锁内修改
+ * 3. 各层缓存中的内存块数由中心缓存切出的数量依次减去下层缓存和用户持有的数量得到
+ */
+struct MemoryPoolStats
+{
+    std::array<ClassStats, FREE_LIST_SIZE> classes;
+    TierStats threadCache;     ///< 小对象分配在线程缓存命中
+    TierStats transferCache;   ///< 中心缓存的请求在传输缓存命中
+    TierStats centralCache;    ///< 没有命中传输缓存的请求不需要新的Span
+    TierStats pageCache;       ///< Span请求不需要向系统申请内存
+    size_t threadCaches = 0;   ///< 存活的线程缓存数量
+    size_t mappedBytes = 0;    ///< 向系统映射、仍未归还映射的字节数（不含元数据）
+    size_t freeBytes = 0;      ///< 页缓存中还占用物理内存的空闲字节数
+    size_t releasedBytes = 0;  ///< 页缓存中已经归还物理内存的空闲字节数
+    size_t directCacheBytes = 0; ///< 缓存的单独映射的超大Span字节数
+    size_t rssBytes = 0;       ///< 进程的常驻内存，读取 /proc/self/statm
+
+    /**
+     * @brief 以文本表格输出，只列出使用过的大小类
+     */
+    void print(FILE *out) const
+    {
+        fprintf(out, "------------------------------------------------\n");
+        fprintf(out, "内存池统计: 线程缓存 %zu 个\n", threadCaches);
+        fprintf(out, "映射 %zu 字节, 常驻内存 %zu 字节, 空闲 %zu 字节, 已归还 %zu 字节, 超大映射缓存 %zu 字节\n",
+                mappedBytes, rssBytes, freeBytes, releasedBytes, directCacheBytes);
+        printTier(out, "线程缓存", threadCache);
+        printTier(out, "传输缓存", transferCache);
+        printTier(out, "中心缓存", centralCache);
+        printTier(out, "页缓存", pageCache);
+        fprintf(out, "%6s %10s %12s %10s %10s %10s %10s %8s %12s %6s %8s\n", "size", "allocs", "live", "front",
+                "transfer", "central", "misses", "spans", "span_bytes", "frag", "contend");
+        for (const ClassStats &c : classes)
+        {
+            if (c.allocs == 0 && c.spans == 0)
+                continue;
+            fprintf(out, "%6zu %10llu %12zu %10zu %10zu %10zu %10llu %8zu %12zu %5.1f%% %8llu\n", c.size,
+                    static_cast<unsigned long long>(c.allocs), c.liveObjects, c.frontObjects, c.transferObjects,
+                    c.centralObjects, static_cast<unsigned long long>(c.frontMisses), c.spans, c.spanBytes,
+                    c.fragmentation() * 100.0, static_cast<unsigned long long>(c.lockContentions));
+        }
+        fprintf(out, "------------------------------------------------\n");
+    }
+
+    /**
+     * @brief 以一个 JSON 对象输出，包含所有大小类
+     */
+    void printJson(FILE *out) const
+    {
+        fprintf(out, "{\"thread_caches\":%zu,\"mapped_bytes\":%zu,\"rss_bytes\":%zu,\"free_bytes\":%zu,"
+                     "\"released_bytes\":%zu,\"direct_cache_bytes\":%zu,\"tiers\":{",
+                threadCaches, mappedBytes, rssBytes, freeBytes, releasedBytes, directCacheBytes);
+        printTierJson(out, "thread_cache", threadCache, ",");
+        printTierJson(out, "transfer_cache", transferCache, ",");
+        printTierJson(out, "central_cache", centralCache, ",");
+        printTierJson(out, "page_cache", pageCache, "");
+        fprintf(out, "},\"classes\":[");
+        for (size_t index = 0; index < FREE_LIST_SIZE; index++)
+        {
+            const ClassStats &c = classes[index];
+            fprintf(out,
+                    "%s{\"size\":%zu,\"allocs\":%llu,\"frees\":%llu,\"live\":%zu,\"front\":%zu,\"transfer\":%zu,"
+                    "\"central\":%zu,\"front_misses\":%llu,\"transfer_hits\":%llu,\"transfer_misses\":%llu,"
+                    "\"span_fetches\":%llu,\"spans\":%zu,\"span_bytes\":%zu,\"fragmentation\":%.4f,"
+                    "\"lock_contentions\":%llu}",
+                    index ? "," : "", c.size, static_cast<unsigned long long>(c.allocs),
+                    static_cast<unsigned long long>(c.frees), c.liveObjects, c.frontObjects, c.transferObjects,
+                    c.centralObjects, static_cast<unsigned long long>(c.frontMisses),
+                    static_cast<unsigned long long>(c.transferHits), static_cast<unsigned long long>(c.transferMisses),
+                    static_cast<unsigned long long>(c.spanFetches), c.spans, c.spanBytes, c.fragmentation(),
+                    static_cast<unsigned long long>(c.lockContentions));
+        }
+        fprintf(out, "]}\n");
+    }
+
+    /**
+     * @brief 读取进程的常驻内存字节数，读取失败返回0
+     */
+    static size_t readRss()
+    {
+        FILE *file = fopen("/proc/self/statm", "r");
+        if (!file)
+            return 0;
+        unsigned long long sizePages = 0;
+        unsigned long long residentPages = 0;
+        int n = fscanf(file, "%llu %llu", &sizePages, &residentPages);
+        fclose(file);
+        return n == 2 ? static_cast<size_t>(residentPages) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+    }
+
+private:
+    static void printTier(FILE *out, const char *name, const TierStats &tier)
+    {
+        fprintf(out, "%s: 命中 %llu, 未命中 %llu, 命中率 %.2f%%\n", name, static_cast<unsigned long long>(tier.hits),
+                static_cast<unsigned long long>(tier.misses), tier.hitRate() * 100.0);
+    }
+
+    static void printTierJson(FILE *out, const char *name, const TierStats &tier, const char *separator)
+    {
+        fprintf(out, "\"%s\":{\"hits\":%llu,\"misses\":%llu,\"hit_rate\":%.4f}%s", name,
+                static_cast<unsigned long long>(tier.hits), static_cast<unsigned long long>(tier.misses),
+                tier.hitRate(), separator);
+    }
+};
+
+#endif
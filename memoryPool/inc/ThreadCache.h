@@ -3,9 +3,23 @@
 #ifndef THREAD_CACHE_H
 #define THREAD_CACHE_H
 #include "CentralCache.h"
+#include "Config.h"
 #include "Conmmon.h"
+#include "Hardening.h"
+#include "HeapProfiler.h"
+#include "LatencyHistogram.h"
+#include "ObjectPool.h"
+#include "Stats.h"
+#if MEMPOOL_PERCPU_CACHE
+#include "CpuCache.h"
+#endif
 #include <array>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <pthread.h>
 
 class ThreadCache
 {
@@ -15,12 +29,217 @@ public:
      * @return ThreadCache* 返回线程本地缓存的单例指针
      *
      * 使用 thread_local 确保每个线程都有自己独立的 ThreadCache 实例
-     * 避免了线程间的竞争，提高了并发性能
+     * 避免了线程间的竞争，提高了并发性能。
+     * 实例在线程第一次使用时从对象池创建并登记，线程退出时通过 pthread_key 的析构函数
+     * 把缓存的内存块全部还给中心缓存，thread_local 变量本身只是一个指针，没有析构函数
      */
     static ThreadCache *getThreadCache()
     {
-        static thread_local ThreadCache instance;
-        return &instance;
+        ThreadCache *&instance = current();
+        if (!instance)
+        {
+            instance = create();
+        }
+        return instance;
+    }
+
+    /**
+     * @brief 清空所有线程的缓存
+     * @return size_t 登记的线程缓存数量
+     *
+     * 当前线程的缓存立即还给中心缓存；线程缓存只能由所属线程访问，
+     * 其他线程的缓存只是打上标记，在各自下一次分配时还给中心缓存。
+     * 适用于 fork 之前或内存紧张时尽量回收线程缓存中的内存
+     */
+    static size_t flushAll()
+    {
+        size_t count = 0;
+        {
+            Registry &reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            for (ThreadCache *cache = reg.head; cache; cache = cache->next_)
+            {
+                cache->flushRequested_.store(true, std::memory_order_relaxed);
+                count++;
+            }
+        }
+        getThreadCache()->flush();
+        return count;
+    }
+
+    /**
+     * @brief 预热一个大小：分配 count 个 size 字节的内存块并逐页写入，再全部释放
+     * @return size_t 预热的内存块数量，内存不足时可能小于 count
+     *
+     * 服务开始处理请求之前调用，mmap、切分Span和缺页都在这里发生。
+     * 释放的内存块按平时的策略留在当前线程的自由链表、传输缓存和页缓存中，
+     * 超出各层容量的部分同样会被归还，所以预热的数量不必超过稳定运行时的用量。
+     * 分配出的内存块通过各自的前8个字节串起来，不需要额外的内存
+     */
+    static size_t warmup(size_t size, size_t count)
+    {
+        ThreadCache *cache = getThreadCache();
+        if (!cache || size == 0)
+            return 0;
+        void *chain = nullptr;
+        size_t warmed = 0;
+        for (; warmed < count; warmed++)
+        {
+            char *ptr = cache->allocate<char>(size);
+            if (!ptr)
+                break;
+            for (size_t offset = 0; offset < size; offset += PAGE_SIZE)
+            {
+                ptr[offset] = 0;
+            }
+            ptr[size - 1] = 0;
+            FreeList::setNext(ptr, chain);
+            chain = ptr;
+        }
+        while (chain)
+        {
+            void *next = FreeList::next(chain);
+            cache->deallocate(chain);
+            chain = next;
+        }
+        return warmed;
+    }
+
+    /**
+     * @brief 当前存活（已登记）的线程缓存数量
+     */
+    static size_t getThreadCacheCount()
+    {
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        size_t count = 0;
+        for (ThreadCache *cache = reg.head; cache; cache = cache->next_)
+        {
+            count++;
+        }
+        return count;
+    }
+
+    /**
+     * @brief 收集整个内存池的统计信息
+     * @return MemoryPoolStats 收集时的快照
+     *
+     * 持有登记表的锁汇总所有线程缓存的计数器，再依次读取每个节点的中心缓存和页缓存，
+     * 不会阻塞其他线程的分配和释放
+     */
+    static MemoryPoolStats getStats()
+    {
+        MemoryPoolStats stats;
+        for (size_t index = 0; index < FREE_LIST_SIZE; index++)
+        {
+            stats.classes[index].size = SizeClass::getSize(index);
+        }
+        {
+            Registry &reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            for (size_t index = 0; index < FREE_LIST_SIZE; index++)
+            {
+                ClassStats &c = stats.classes[index];
+                c.allocs += reg.retired[index].allocs;
+                c.frees += reg.retired[index].frees;
+                c.frontMisses += reg.retired[index].frontMisses;
+            }
+            for (ThreadCache *cache = reg.head; cache; cache = cache->next_)
+            {
+                for (size_t index = 0; index < FREE_LIST_SIZE; index++)
+                {
+                    cache->collectCounters(index, stats.classes[index]);
+                }
+                stats.threadCaches++;
+            }
+        }
+        for (size_t node = 0; node < Numa::nodeCount(); node++)
+        {
+            if (CentralCache *central = CentralCache::existingNode(node))
+                central->collectStats(stats);
+            if (PageCache *pageCache = PageCache::existingNode(node))
+                pageCache->collectStats(stats);
+        }
+
+        for (ClassStats &c : stats.classes)
+        {
+            // 计数器在不同线程中分别读取，分配和释放正在进行时差值可能短暂为负
+            c.liveObjects = c.allocs > c.frees ? static_cast<size_t>(c.allocs - c.frees) : 0;
+            size_t cached = c.transferObjects + c.liveObjects;
+            c.frontObjects = c.frontObjects > cached ? c.frontObjects - cached : 0;
+            uint64_t misses = std::min(c.frontMisses, c.allocs);
+            stats.threadCache.hits += c.allocs - misses;
+            stats.threadCache.misses += misses;
+            stats.transferCache.hits += c.transferHits;
+            stats.transferCache.misses += c.transferMisses;
+            uint64_t spanFetches = std::min(c.spanFetches, c.transferMisses);
+            stats.centralCache.hits += c.transferMisses - spanFetches;
+            stats.centralCache.misses += spanFetches;
+        }
+        stats.rssBytes = MemoryPoolStats::readRss();
+        return stats;
+    }
+
+    /**
+     * @brief 汇总所有线程（包括已退出的线程）的慢路径延迟直方图
+     * @return LatencyStats 没有开启 MEMPOOL_LATENCY_HISTOGRAM 时所有事件的次数都是0
+     */
+    static LatencyStats getLatencyStats()
+    {
+        LatencyStats stats;
+#if MEMPOOL_LATENCY_HISTOGRAM
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        stats.add(reg.retiredLatency);
+        stats.add(LatencyRecorder::shared());
+        for (ThreadCache *cache = reg.head; cache; cache = cache->next_)
+        {
+            stats.add(cache->latency_);
+        }
+#endif
+        return stats;
+    }
+
+    /**
+     * @brief 当前线程缓存中缓存的字节数
+     */
+    size_t getCachedBytes() const
+    {
+        size_t bytes = 0;
+        for (size_t index = 0; index < FREE_LIST_SIZE; index++)
+        {
+            bytes += _freeListSize[index] * SizeClass::getSize(index);
+        }
+        return bytes;
+    }
+
+    /**
+     * @brief 当前线程缓存的字节数上限，由所有线程共享的预算动态分配
+     */
+    size_t getMaxCachedBytes() const { return maxBytes_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 把当前线程缓存中的内存块全部还给中心缓存
+     *
+     * 只能由所属线程调用，链表长度上限也重新开始慢启动，远程队列中的内存块也一起归还
+     */
+    void flush()
+    {
+        flushRequested_.store(false, std::memory_order_relaxed);
+        CentralCache &centralCache = CentralCache::getInstance();
+        for (size_t index = 0; index < FREE_LIST_SIZE; index++)
+        {
+            if (_freeList[index])
+            {
+                centralCache.returnRange(_freeList[index], _freeListSize[index], index);
+            }
+            _freeList[index] = nullptr;
+            _freeListSize[index] = 0;
+            _freeListMaxSize[index] = 1;
+            _lengthOverages[index] = 0;
+        }
+        cachedBytes_ = 0;
+        drainRemote(false);
     }
 
     /**
@@ -28,8 +247,9 @@ public:
      * @param size 请求的内存大小
      * @return  返回的是一个指针
      *
-     * 如果请求的大小超过最大限制(MAX_BYTES)，则直接调用系统malloc
-     * 否则从线程本地缓存或中心缓存获取内存
+     * 如果请求的大小超过最大限制(MAX_BYTES)，则直接向页缓存申请整页的Span
+     * 否则从线程本地缓存获取内存，本地自由链表为空时从中心缓存批量获取。
+     * 采样的字节倒计数用完时记录一次堆分析的采样
      */
     template <typename T, typename N>
     T *allocate(N size)
@@ -37,15 +257,716 @@ public:
         if (size == 0)
             size = ALIGNMENT;
 
-        if (size > MAX_BYTES)
+        checkFlushRequest();
+
+        void *ptr = nullptr;
+        size_t bytes = Hardening::taggedSize(size);
+        if (bytes > MAX_BYTES)
+        {
+            ptr = allocateLarge(bytes);
+        }
+        else
+        {
+            // 内存对齐，获取 向上取整的下标
+            size_t index = SizeClass::getIndex(bytes);
+            ptr = markAllocated(allocateSmall(index), SizeClass::getSize(index));
+        }
+        if (__builtin_expect((bytesUntilSample_ -= static_cast<int64_t>(size)) < 0, 0))
+            sampleAllocation(ptr, size);
+        return static_cast<T *>(ptr);
+    }
+
+
+    /**
+     * @brief 为一个 T 类型的对象分配内存，大小类在编译期确定
+     * @return T* 未构造的内存，内存不足时返回nullptr
+     *
+     * sizeof(T) 一定是 alignof(T) 的倍数，对齐不超过一页时对应的大小类满足 T 的对齐要求
+     * （见 SizeClass::alignedClassesOk）。
+     * 释放时使用 deallocateFixed<sizeof(T)>(ptr)，也可以使用 deallocate(ptr, sizeof(T))
+     */
+    template <typename T>
+    T *allocate()
+    {
+        static_assert(alignof(T) <= PAGE_SIZE, "对齐超过一页的类型使用 allocateAligned");
+        return static_cast<T *>(allocateFixed<sizeof(T)>());
+    }
+
+
+    /**
+     * @brief 按编译期常量大小分配内存
+     * @tparam Size 请求的内存大小
+     *
+     * 大小类的索引、批次数量以及是否是大对象都在编译期计算，
+     * 运行时只剩下从自由链表弹出一个内存块
+     */
+    template <size_t Size>
+    void *allocateFixed()
+    {
+        constexpr size_t bytes = Hardening::taggedSize(Size == 0 ? ALIGNMENT : Size);
+        checkFlushRequest();
+        void *ptr = nullptr;
+        if constexpr (bytes > MAX_BYTES)
+        {
+            ptr = allocateLarge(bytes);
+        }
+        else
+        {
+            constexpr size_t index = SizeClass::getIndex(bytes);
+            ptr = markAllocated(allocateSmall(index), SizeClass::getSize(index));
+        }
+        if (__builtin_expect((bytesUntilSample_ -= static_cast<int64_t>(bytes)) < 0, 0))
+            sampleAllocation(ptr, bytes);
+        return ptr;
+    }
+
+
+    /**
+     * @brief 释放 allocateFixed<Size>() 分配的内存，大小类在编译期确定
+     */
+    template <size_t Size>
+    void deallocateFixed(void *ptr)
+    {
+        constexpr size_t bytes = Hardening::taggedSize(Size == 0 ? ALIGNMENT : Size);
+        forgetSample(ptr);
+        if constexpr (bytes > MAX_BYTES)
+        {
+            deallocateLarge(ptr);
+        }
+        else
+        {
+            constexpr size_t index = SizeClass::getIndex(bytes);
+            deallocateSmall(ptr, index, PageCache::mapObjectToSpan(ptr));
+        }
+    }
+
+
+    /**
+     * @brief 分配按 align 字节对齐的内存
+     * @param size 请求的内存大小
+     * @param align 对齐要求，必须是2的幂
+     * @return T* 对齐的内存，align 不是2的幂或内存不足时返回nullptr
+     *
+     * 1. align 不超过一页时，把大小向上取整到 align 的倍数后走普通的分配路径：
+     *    这样的大小对应的大小类一定是 align 的倍数（见 SizeClass::alignedClassesOk），
+     *    Span 按页对齐并从起始位置按大小类切分，所以内存块地址满足对齐，开销与普通分配相同
+     * 2. align 超过一页时，按整页分配一个多出 (align - 页大小) 的大对象，返回其中对齐的位置
+     *
+     * 释放时使用 deallocate(ptr)
+     */
+    template <typename T>
+    T *allocateAligned(size_t size, size_t align)
+    {
+        // 先检查 align，避免 SIZE_MAX / 2 - align 回绕
+        if (align == 0 || (align & (align - 1)) != 0 || align > SIZE_MAX / 2 || size > SIZE_MAX / 2 - align)
+            return nullptr;
+        if (align <= ALIGNMENT)
+            return allocate<T>(size);
+        if (align <= PAGE_SIZE)
+            return allocate<T>((std::max<size_t>(size, 1) + align - 1) & ~(align - 1));
+
+        // 大对象的Span每一页都在页表中，释放时通过对齐后的内部指针也能找到Span
+        size_t bytes = std::max(size + align - PAGE_SIZE + HARDENED_TAG_BYTES, MAX_BYTES + 1);
+        char *ptr = static_cast<char *>(allocateLarge(bytes));
+        if (!ptr)
+            return nullptr;
+        uintptr_t aligned = (reinterpret_cast<uintptr_t>(ptr) + align - 1) & ~(align - 1);
+        return reinterpret_cast<T *>(aligned);
+    }
+
+
+    /**
+     * @brief 释放指定大小的内存
+     * @param ptr 指向要释放的内存的指针
+     * @param size 请求的内存大小
+     *
+     * size 必须与分配时的大小属于同一个大小类，调用方不知道大小时使用 deallocate(ptr)。
+     * 大小类由 size 直接算出，仍然查一次页表，内存块属于其他线程缓存时放进它的远程队列
+     */
+    template <typename T, typename N>
+    void deallocate(T *ptr, N size)
+    {
+        forgetSample(ptr);
+        size_t bytes = Hardening::taggedSize(size);
+        // 大对象直接把整个Span还给页缓存
+        if (bytes > MAX_BYTES)
+        {
+            deallocateLarge(ptr);
+            return;
+        }
+        deallocateSmall(ptr, SizeClass::getIndex(bytes), PageCache::mapObjectToSpan(ptr));
+    }
+
+
+    /**
+     * @brief 释放内存，不需要提供大小
+     * @param ptr 指向要释放的内存的指针，nullptr 时直接返回
+     *
+     * 通过页表找到内存块所在的Span，由Span上记录的大小类决定放回哪个自由链表：
+     * 1. Span 的 objSize 大于 MAX_BYTES，说明是大对象，整个Span还给页缓存
+     * 2. Span 属于其他线程缓存时，放进那个线程缓存的远程队列
+     * 3. 否则放回 Span 记录的大小类对应的自由链表
+     * 4. 不属于内存池或已经整体归还的地址直接忽略（加固模式下报告错误）
+     */
+    template <typename T>
+    void deallocate(T *ptr)
+    {
+        if (!ptr)
+            return;
+        Span *span = PageCache::GetInstance().mapObjectToSpan(ptr);
+        if (!span || span->objSize == 0)
+        {
+            checkFree(ptr, span);
+            return;
+        }
+        forgetSample(ptr);
+        if (span->objSize > MAX_BYTES)
+        {
+            deallocateLarge(ptr);
+            return;
+        }
+        deallocateSmall(ptr, span->sizeClass, span);
+    }
+
+
+    /**
+     * @brief 指针所在内存块从该位置开始可以使用的字节数
+     * @return size_t 不属于内存池或已经释放的地址返回0
+     *
+     * 小对象是大小类的大小，大对象是整个Span的字节数，都由Span记录，不需要调用方提供大小；
+     * 加固模式下不包括内存块末尾的标记
+     */
+    static size_t usableSize(const void *ptr)
+    {
+        if (!ptr)
+            return 0;
+        Span *span = PageCache::mapObjectToSpan(ptr);
+        if (!span || span->objSize == 0)
+            return 0;
+        size_t offset = static_cast<size_t>(static_cast<const char *>(ptr) - static_cast<char *>(span->PageAddr));
+        return span->objSize - offset % span->objSize - HARDENED_TAG_BYTES;
+    }
+
+
+    /**
+     * @brief 调整内存块的大小，语义与 realloc 相同
+     * @param ptr 原来的内存块，nullptr 时等同于 allocate(size)
+     * @param size 新的大小，为0时释放 ptr 并返回nullptr
+     * @return T* 新的内存块，失败时返回nullptr，原内存块保持不变
+     *
+     * 尽量不复制数据：
+     * 1. 新大小仍然放得下，并且不会浪费一半以上的空间时，直接返回原指针
+     * 2. 大对象变大时，让页缓存原地扩大Span（接上后面的空闲Span，或者 mremap 单独映射的Span）
+     * 3. 以上都不行时才分配新内存、复制、释放原内存
+     */
+    template <typename T>
+    T *reallocate(T *ptr, size_t size)
+    {
+        if (!ptr)
+            return allocate<T>(size);
+        if (size == 0)
+        {
+            deallocate(ptr);
+            return nullptr;
+        }
+        Span *span = PageCache::mapObjectToSpan(ptr);
+        if (!span || span->objSize == 0)
+            return nullptr;
+        size_t usable = usableSize(ptr);
+        if (size <= usable && size >= usable / 2)
+            return ptr;
+
+        // 大对象只有从Span起始位置分配的可以扩大，对齐分配返回的内部指针不行；末尾有保护页时也不行
+        if (size > usable && span->objSize > MAX_BYTES && span->PageAddr == ptr && size <= SIZE_MAX - PAGE_SIZE &&
+            !guardPages())
+        {
+            size_t numPages = (size + HARDENED_TAG_BYTES + PAGE_SIZE - 1) / PAGE_SIZE;
+            if (void *grown = PageCache::GetInstance().growSpan(ptr, numPages))
+            {
+                span->objSize = numPages * PAGE_SIZE;
+                return static_cast<T *>(markAllocated(grown, span->objSize));
+            }
+        }
+
+        void *newPtr = allocate<void>(size);
+        if (!newPtr)
+            return nullptr;
+        memcpy(newPtr, ptr, std::min(size, usable));
+        deallocate(ptr);
+        return static_cast<T *>(newPtr);
+    }
+
+
+    /**
+     * @brief 一次分配 n 个同样大小的内存块
+     * @param size 每个内存块的大小
+     * @param n 需要的数量
+     * @param out 输出数组，至少能放下 n 个指针
+     * @return size_t 实际分配的数量，只有内存不足时才小于 n
+     *
+     * 先从本地自由链表整段取走，不够时每次向中心缓存请求一个完整批次
+     * （可以直接从传输缓存整批取走），多出来的留在本地自由链表
+     */
+    template <typename N>
+    size_t allocateBatch(N size, size_t n, void **out)
+    {
+        if (n == 0)
+            return 0;
+        if (size == 0)
+            size = ALIGNMENT;
+        checkFlushRequest();
+
+        size_t count = 0;
+        size_t bytes = Hardening::taggedSize(size);
+        if (bytes > MAX_BYTES)
+        {
+            for (; count < n; count++)
+            {
+                if (!(out[count] = allocateLarge(bytes)))
+                    break;
+            }
+            return count;
+        }
+
+        size_t index = SizeClass::getIndex(bytes);
+        size_t objSize = SizeClass::getSize(index);
+#if MEMPOOL_PERCPU_CACHE
+        if (CpuCache::enabled())
+        {
+            for (; count < n; count++)
+            {
+                if (!(out[count] = markAllocated(CpuCache::getInstance().allocate(index), objSize)))
+                    break;
+            }
+            counterAdd<uint64_t>(counters_[index].allocs, count);
+            return count;
+        }
+#endif
+        // 本地自由链表为空时把远程队列并入本地
+        if (!_freeList[index])
+        {
+            if (void *ptr = popRemote(index))
+                out[count++] = ptr;
+        }
+        void *ptr = _freeList[index];
+        for (; count < n && ptr; count++)
+        {
+            out[count] = ptr;
+            ptr = FreeList::next(ptr);
+            _freeListSize[index]--;
+            cachedBytes_ -= objSize;
+        }
+        _freeList[index] = ptr;
+
+        size_t batchNum = SizeClass::getBatchNum(index);
+        while (count < n)
+        {
+            size_t actualNum = 0;
+            counterAdd<uint64_t>(counters_[index].misses, 1);
+            MEMPOOL_LATENCY_SCOPE(LATENCY_FRONT_MISS);
+            void *start = CentralCache::getInstance().fetchRange<void>(index, batchNum, actualNum, this);
+            if (!start)
+                break;
+            for (; count < n && start; count++)
+            {
+                out[count] = start;
+                start = FreeList::next(start);
+                actualNum--;
+            }
+            // 最后一批用剩的内存块放入本地自由链表（此时本地链表一定为空）
+            _freeList[index] = start;
+            _freeListSize[index] = actualNum;
+            cachedBytes_ += actualNum * objSize;
+        }
+#if MEMPOOL_HARDENED
+        for (size_t i = 0; i < count; i++)
+        {
+            Hardening::markAllocated(out[i], objSize);
+        }
+#endif
+        counterAdd<uint64_t>(counters_[index].allocs, count);
+        return count;
+    }
+
+
+    /**
+     * @brief 一次释放 n 个同样大小的内存块
+     * @param ptrs 内存块指针数组
+     * @param n 数量
+     * @param size 每个内存块分配时的大小，与 deallocate(ptr, size) 的要求相同
+     *
+     * 与 deallocate 一样，Span属于其他线程缓存的内存块放进它的远程队列；相邻的内存块通常在同一个Span上，
+     * 只在离开上一个Span的范围时查页表。其余的串成一段，本地自由链表放不下的部分按完整批次直接还给中心缓存，
+     * 剩下的接到本地自由链表上，最后只检查一次是否超过长度上限
+     */
+    template <typename N>
+    void deallocateBatch(void **ptrs, size_t n, N size)
+    {
+        if (n == 0)
+            return;
+        for (size_t i = 0; i < n && HeapProfiler::hasSamples(); i++)
+        {
+            HeapProfiler::getInstance().remove(ptrs[i]);
+        }
+        size_t bytes = Hardening::taggedSize(size);
+        if (bytes > MAX_BYTES)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                deallocateLarge(ptrs[i]);
+            }
+            return;
+        }
+
+        size_t index = SizeClass::getIndex(bytes);
+        counterAdd<uint64_t>(counters_[index].frees, n);
+        void *head = nullptr;
+        void *tail = nullptr;
+        size_t count = 0;
+        Span *span = nullptr;
+        char *begin = nullptr;
+        char *end = nullptr;
+        for (size_t i = 0; i < n; i++)
+        {
+            char *address = static_cast<char *>(ptrs[i]);
+            if (address < begin || address >= end)
+            {
+                span = PageCache::mapObjectToSpan(ptrs[i]);
+                begin = span ? static_cast<char *>(span->PageAddr) : nullptr;
+                end = span ? begin + span->sizePages * PAGE_SIZE : nullptr;
+            }
+            checkFree(ptrs[i], span);
+            if (pushRemote(ptrs[i], index, span))
+                continue;
+            if (tail)
+                FreeList::setNext(tail, ptrs[i]);
+            else
+                head = ptrs[i];
+            tail = ptrs[i];
+            count++;
+        }
+        if (count == 0)
+            return;
+        FreeList::setNext(tail, nullptr);
+#if MEMPOOL_PERCPU_CACHE
+        if (CpuCache::enabled())
+        {
+            while (void *ptr = head)
+            {
+                head = FreeList::next(ptr);
+                CpuCache::getInstance().deallocate(ptr, index);
+            }
+            return;
+        }
+#endif
+        size_t batchNum = SizeClass::getBatchNum(index);
+        size_t room = _freeListMaxSize[index] > _freeListSize[index] ? _freeListMaxSize[index] - _freeListSize[index] : 0;
+        while (count > room && count >= batchNum)
+        {
+            void *batchTail = head;
+            for (size_t j = 1; j < batchNum; j++)
+            {
+                batchTail = FreeList::next(batchTail);
+            }
+            void *rest = FreeList::next(batchTail);
+            FreeList::setNext(batchTail, nullptr);
+            CentralCache::getInstance().returnRange(head, batchNum, index, batchTail);
+            head = rest;
+            count -= batchNum;
+        }
+        if (count == 0)
+            return;
+
+        FreeList::setNext(tail, _freeList[index]);
+        _freeList[index] = head;
+        _freeListSize[index] += count;
+        cachedBytes_ += count * SizeClass::getSize(index);
+        if (shuoReturnThreadCache(index))
+        {
+            returnThreadCache(_freeList[index], index);
+        }
+        if (overBudget())
+            scavenge();
+    }
+
+
+private:
+    friend class ObjectPool<ThreadCache>;
+
+    /**
+     * @brief 所有线程缓存的登记表
+     *
+     * 线程缓存本身也从对象池分配，不依赖系统malloc；key 的析构函数在线程退出时调用
+     */
+    struct Registry
+    {
+        std::mutex mutex;
+        ThreadCache *head = nullptr;
+        pthread_key_t key;
+        // 已经退出的线程的计数器之和
+        std::array<ClassStats, FREE_LIST_SIZE> retired;
+        // 线程缓存预算中还没有分配给任何线程的字节数，新线程先占用最小上限，可能暂时为负
+        int64_t unclaimedBytes = 0;
+        // 下一次从哪个线程缓存的上限中取预算，轮流选择
+        ThreadCache *nextVictim = nullptr;
+#if MEMPOOL_LATENCY_HISTOGRAM
+        // 已经退出的线程的延迟直方图之和
+        LatencyStats retiredLatency;
+#endif
+    };
+
+    // 线程缓存的对象池（Registry::mutex 保护）
+    static ObjectPool<ThreadCache> &cachePool()
+    {
+        static ObjectPool<ThreadCache> pool;
+        return pool;
+    }
+
+    // 当前线程的线程缓存指针
+    static ThreadCache *&current()
+    {
+        static thread_local ThreadCache *instance = nullptr;
+        return instance;
+    }
+
+    /**
+     * @brief 所有线程缓存的登记表，第一次创建线程缓存时读取运行时配置
+     */
+    static Registry &registry()
+    {
+        static Registry *reg = []() {
+            static Registry instance;
+            pthread_key_create(&instance.key, threadExit);
+            const MemoryPoolConfig &config = MemoryPoolConfig::get();
+            instance.unclaimedBytes = static_cast<int64_t>(std::min<size_t>(config.threadCacheBytes, INT64_MAX));
+            applyConfig(config);
+            return &instance;
+        }();
+        return *reg;
+    }
+
+    /**
+     * @brief 把运行时配置交给页缓存和堆分析
+     *
+     * 与编译期默认值相同的项不调用设置函数，不覆盖程序在此之前直接设置的值
+     */
+    static void applyConfig(const MemoryPoolConfig &config)
+    {
+        if (config.releaseRate != RELEASE_RATE)
+            PageCache::setReleaseRate(config.releaseRate);
+        if (config.retainBytes != RETAIN_BYTES)
+            PageCache::setRetainBytes(config.retainBytes);
+        if (config.directMmapBytes != DIRECT_MMAP_BYTES)
+            PageCache::setDirectMmapThreshold(config.directMmapBytes);
+        if (config.madvFree)
+            PageCache::setUseMadvFree(true);
+        if (config.sampleRate)
+            HeapProfiler::setSampleRate(config.sampleRate);
+    }
+
+    /**
+     * @brief 为当前线程创建并登记线程缓存
+     */
+    static ThreadCache *create()
+    {
+        Registry &reg = registry();
+        registerForkHandlers();
+        ThreadCache *cache = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            cache = cachePool().allocate();
+            if (!cache)
+                return nullptr;
+            // 复用的线程缓存在上一个线程退出时关闭了远程队列
+            for (RemoteList &list : cache->remote_)
+            {
+                list.head.store(nullptr, std::memory_order_release);
+            }
+            for (ClassCounters &counters : cache->counters_)
+            {
+                counters.allocs.store(0, std::memory_order_relaxed);
+                counters.frees.store(0, std::memory_order_relaxed);
+                counters.misses.store(0, std::memory_order_relaxed);
+            }
+#if MEMPOOL_LATENCY_HISTOGRAM
+            cache->latency_.reset();
+#endif
+            // 新线程先占用最小上限，预算已经分完时也是如此
+            cache->maxBytes_.store(THREAD_CACHE_MIN_BYTES, std::memory_order_relaxed);
+            reg.unclaimedBytes -= static_cast<int64_t>(THREAD_CACHE_MIN_BYTES);
+            cache->next_ = reg.head;
+            if (reg.head)
+                reg.head->prev_ = cache;
+            reg.head = cache;
+        }
+        pthread_setspecific(reg.key, cache);
+#if MEMPOOL_LATENCY_HISTOGRAM
+        LatencyRecorder::local() = &cache->latency_;
+#endif
+        return cache;
+    }
+
+    /**
+     * @brief 注册 fork 的处理函数，只注册一次
+     *
+     * 不放在 registry() 的初始化中：pthread_atfork 可能分配内存，替换了 malloc 时会重新进入这里
+     */
+    static void registerForkHandlers()
+    {
+        static std::atomic<bool> registered{false};
+        if (!registered.load(std::memory_order_acquire) && !registered.exchange(true, std::memory_order_acq_rel))
+            pthread_atfork(prepareFork, parentAfterFork, childAfterFork);
+    }
+
+    /**
+     * @brief fork 之前获取内存池的所有锁
+     *
+     * 顺序与正常路径一致：登记表、中心缓存（大小类、传输缓存）、页缓存。
+     * 多线程的进程 fork 时其他线程可能正持有某个锁，子进程中没有线程会释放它，
+     * 之后第一次用到这个锁的分配就会死锁
+     */
+    static void prepareFork()
+    {
+        registry().mutex.lock();
+        CentralCache::prepareFork();
+        PageCache::prepareFork();
+    }
+
+    static void parentAfterFork()
+    {
+        PageCache::afterFork(false);
+        CentralCache::afterFork(false);
+        registry().mutex.unlock();
+    }
+
+    /**
+     * @brief 子进程中释放所有锁，关闭父进程其他线程的远程队列
+     *
+     * 其他线程在子进程中不存在，它们的线程缓存可能停在修改到一半的状态，不能回收，
+     * 只把远程队列中已经放入的内存块还给中心缓存并关闭队列，
+     * 之后释放这些线程的Span上的内存块时放回释放线程自己的自由链表
+     */
+    static void childAfterFork()
+    {
+        PageCache::afterFork(true);
+        CentralCache::afterFork(true);
+        Registry &reg = registry();
+        for (ThreadCache *cache = reg.head; cache; cache = cache->next_)
+        {
+            if (cache != current())
+                cache->drainRemote(true);
+        }
+        reg.mutex.unlock();
+    }
+
+    /**
+     * @brief 线程退出时的回调：清空线程缓存，从登记表中摘除并放回对象池
+     *
+     * 线程退出过程中其他析构函数还可能再次使用内存池，那时会重新创建一个线程缓存，
+     * pthread 会再次调用这个函数。
+     * 远程队列被关闭，之后仍然指向这个线程缓存的Span在释放时放回释放线程自己的自由链表
+     */
+    static void threadExit(void *ptr)
+    {
+        ThreadCache *cache = static_cast<ThreadCache *>(ptr);
+        cache->flush();
+        cache->drainRemote(true);
+        current() = nullptr;
+#if MEMPOOL_LATENCY_HISTOGRAM
+        LatencyRecorder::local() = nullptr;
+#endif
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (size_t index = 0; index < FREE_LIST_SIZE; index++)
         {
-            return static_cast<T *>(malloc(size));
+            cache->collectCounters(index, reg.retired[index]);
         }
-        // 内存对齐，获取 向上取整的下标zh
-        N index = SizeClass::getIndex(size);
-        // 更新自由链表大小
-        _freeListSize[index]--;
-        // 如果头节点为空，则需要从中心缓存获取内存
+#if MEMPOOL_LATENCY_HISTOGRAM
+        reg.retiredLatency.add(cache->latency_);
+#endif
+        reg.unclaimedBytes += static_cast<int64_t>(cache->maxBytes_.load(std::memory_order_relaxed));
+        if (reg.nextVictim == cache)
+            reg.nextVictim = cache->next_;
+        if (cache->prev_)
+            cache->prev_->next_ = cache->next_;
+        else
+            reg.head = cache->next_;
+        if (cache->next_)
+            cache->next_->prev_ = cache->prev_;
+        cachePool().deallocate(cache);
+    }
+
+    /**
+     * @brief 私有构造函数，防止外部创建实例
+     *
+     * 初始化线程本地缓存，确保只能通过getThreadCache方法获取实例
+     * 每个自由链表的长度上限从1开始，按慢启动的方式逐步增长
+     */
+    ThreadCache()
+    {
+        _freeList.fill(nullptr);
+        _freeListSize.fill(0);
+        _freeListMaxSize.fill(1);
+        _lengthOverages.fill(0);
+    }
+
+
+    /**
+     * @brief 采样的字节倒计数用完：采样开启时记录这次分配，并重新抽取下一次采样的间隔
+     *
+     * 采样关闭时每 PROFILE_RECHECK_BYTES 字节才进来检查一次。
+     * 记录调用栈的过程中可能再次分配内存（例如展开器第一次加载某个模块），这些分配不采样
+     */
+    __attribute__((noinline)) void sampleAllocation(void *ptr, size_t size)
+    {
+        size_t rate = HeapProfiler::getSampleRate();
+        if (rate == 0)
+        {
+            bytesUntilSample_ = static_cast<int64_t>(PROFILE_RECHECK_BYTES);
+            return;
+        }
+        bytesUntilSample_ = HeapProfiler::nextInterval(rate, sampleSeed_);
+        if (ptr && !inSample_)
+        {
+            inSample_ = true;
+            HeapProfiler::getInstance().record(ptr, size);
+            inSample_ = false;
+        }
+    }
+
+    /**
+     * @brief 释放的内存块如果被采样过，从采样表中删除
+     */
+    static void forgetSample(const void *ptr)
+    {
+        if (__builtin_expect(HeapProfiler::hasSamples(), 0))
+            HeapProfiler::getInstance().remove(ptr);
+    }
+
+
+    // 其他线程调用了 flushAll，先清空自己的缓存
+    void checkFlushRequest()
+    {
+        if (__builtin_expect(flushRequested_.load(std::memory_order_relaxed), 0))
+            flush();
+    }
+
+
+    /**
+     * @brief 从指定大小类的自由链表取一个内存块
+     * @param index 自由链表的索引
+     *
+     * 本地自由链表为空时先取回远程队列，再从中心缓存批量获取
+     */
+    void *allocateSmall(size_t index)
+    {
+        counterAdd<uint64_t>(counters_[index].allocs, 1);
+#if MEMPOOL_PERCPU_CACHE
+        // 按CPU划分的缓存可用时不再使用线程本地的自由链表
+        if (CpuCache::enabled())
+            return CpuCache::getInstance().allocate(index);
+#endif
+        // 如果头节点不为空，直接从本地自由链表弹出一个内存块
         if (void *ptr = _freeList[index])
         {
 
@@ -57,155 +978,339 @@ public:
                 解引用后就是 T 的一个值，进行返回当前内存地址的值
 
             */
-            _freeList[index] = *reinterpret_cast<T **>(ptr);
-            return reinterpret_cast<T *>(ptr);
+            _freeList[index] = FreeList::next(ptr);
+            // 更新自由链表大小
+            _freeListSize[index]--;
+            cachedBytes_ -= SizeClass::getSize(index);
+            return ptr;
         }
-        //! 如果这里不为空 则需要从中心缓存获取内存
-        return 0;
+        // 本地自由链表为空，先取回其他线程释放到远程队列的内存块
+        if (void *ptr = popRemote(index))
+            return ptr;
+        // 远程队列也为空，需要从中心缓存批量获取内存
+        return fetchFromCentralCache(index);
     }
 
 
     /**
-     * @brief 释放指定大小的内存
-     * @param ptr 指向要释放的内存的指针
-     * @param size 请求的内存大小
-     *
+     * @brief 把内存块放回指定大小类的自由链表
+     * @param ptr 内存块指针
+     * @param index 自由链表的索引
      */
-    template <typename T, typename N>
-    void deallocate(T *ptr, N size)
+    void pushFreeList(void *ptr, size_t index)
     {
-        // 大于就使用free 直接释放
-        if (size > MAX_BYTES)
+        counterAdd<uint64_t>(counters_[index].frees, 1);
+#if MEMPOOL_PERCPU_CACHE
+        if (CpuCache::enabled())
         {
-            free(ptr);
+            CpuCache::getInstance().deallocate(ptr, index);
             return;
         }
-        // 计算索引下标
-        N index = SizeClass::getIndex(size);
+#endif
         // 指针存放的是指针
-        *reinterpret_cast<T **>(ptr) = _freeList[index];
+        FreeList::setNext(ptr, _freeList[index]);
         _freeList[index] = ptr;
         _freeListSize[index]++;
+        cachedBytes_ += SizeClass::getSize(index);
 
         // 判断是否需要将部分内存回收给中心缓存
         if (shuoReturnThreadCache(index))
         {
-            returnThreadCache(ptr, size);
+            returnThreadCache(ptr, index);
         }
+        // 整个线程缓存超过字节数上限
+        if (overBudget())
+            scavenge();
     }
 
 
-private:
     /**
-     * @brief 私有构造函数，防止外部创建实例
+     * @brief 释放一个小对象：Span属于其他线程缓存时放进它的远程队列，否则放回本地自由链表
+     * @param span 内存块所在的Span，不属于内存池时为nullptr（加固模式下报告错误）
+     */
+    void deallocateSmall(void *ptr, size_t index, Span *span)
+    {
+        checkFree(ptr, span);
+        if (pushRemote(ptr, index, span))
+        {
+            counterAdd<uint64_t>(counters_[index].frees, 1);
+            return;
+        }
+        pushFreeList(ptr, index);
+    }
+
+
+    /**
+     * @brief 跨线程释放：把内存块放进所属线程缓存的远程队列
+     * @param ptr 内存块指针
+     * @param index 大小类的索引
+     * @param span 内存块所在的Span
+     * @return bool 已经交给其他线程缓存或中心缓存返回true，应放回本线程自由链表返回false
      *
-     * 初始化线程本地缓存，确保只能通过getThreadCache方法获取实例
+     * 远程队列是无锁的多生产者单消费者栈，释放只需要一次CAS，所属线程在下一次
+     * 本地自由链表为空时整条取走。所属线程长时间不取用、队列超过 REMOTE_FREE_BATCHES
+     * 个批次时，释放的线程把整条队列连同这个内存块一起还给中心缓存
+     */
+    bool pushRemote(void *ptr, size_t index, Span *span)
+    {
+        ThreadCache *owner = span ? static_cast<ThreadCache *>(span->owner.load(std::memory_order_relaxed)) : nullptr;
+        if (!owner || owner == this || owner == Span::sharedOwner())
+            return false;
+
+        RemoteList &list = owner->remote_[index];
+        void *head = list.head.load(std::memory_order_relaxed);
+        if (list.count.load(std::memory_order_relaxed) >=
+            static_cast<intptr_t>(REMOTE_FREE_BATCHES * SizeClass::getBatchNum(index)))
+        {
+            while (head && head != closedMark() &&
+                   !list.head.compare_exchange_weak(head, nullptr, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+            }
+            if (head == closedMark())
+                return false;
+            if (head)
+            {
+                size_t count = countList(head);
+                list.count.fetch_sub(static_cast<intptr_t>(count), std::memory_order_relaxed);
+                FreeList::setNext(ptr, head);
+                CentralCache::getInstance().returnRange(ptr, count + 1, index);
+                return true;
+            }
+        }
+
+        do
+        {
+            // 所属线程已经退出
+            if (head == closedMark())
+                return false;
+            FreeList::setNext(ptr, head);
+        } while (!list.head.compare_exchange_weak(head, ptr, std::memory_order_release, std::memory_order_relaxed));
+        list.count.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+
+    /**
+     * @brief 本地自由链表为空时，取走远程队列中的全部内存块
+     * @return void* 返回其中一个，其余放入本地自由链表；远程队列为空时返回nullptr
+     */
+    void *popRemote(size_t index)
+    {
+        RemoteList &list = remote_[index];
+        if (!list.head.load(std::memory_order_relaxed))
+            return nullptr;
+        void *head = list.head.exchange(nullptr, std::memory_order_acquire);
+        if (!head)
+            return nullptr;
+        size_t count = countList(head);
+        list.count.fetch_sub(static_cast<intptr_t>(count), std::memory_order_relaxed);
+        _freeList[index] = FreeList::next(head);
+        _freeListSize[index] += count - 1;
+        cachedBytes_ += (count - 1) * SizeClass::getSize(index);
+        return head;
+    }
+
+
+    /**
+     * @brief 把远程队列中的内存块全部还给中心缓存
+     * @param close 是否同时关闭远程队列（线程退出时），关闭后其他线程不再放入
+     */
+    void drainRemote(bool close)
+    {
+        CentralCache &centralCache = CentralCache::getInstance();
+        for (size_t index = 0; index < FREE_LIST_SIZE; index++)
+        {
+            RemoteList &list = remote_[index];
+            if (!close && !list.head.load(std::memory_order_relaxed))
+                continue;
+            void *head = list.head.exchange(close ? closedMark() : nullptr, std::memory_order_acquire);
+            if (!head || head == closedMark())
+                continue;
+            size_t count = countList(head);
+            list.count.fetch_sub(static_cast<intptr_t>(count), std::memory_order_relaxed);
+            centralCache.returnRange(head, count, index);
+        }
+    }
+
+
+    /**
+     * @brief 把一个大小类的计数器累加到统计中
+     *
+     * 计数器只由所属线程修改，其他线程不加锁读取
      */
-    ThreadCache() = default;
+    void collectCounters(size_t index, ClassStats &stats) const
+    {
+        const ClassCounters &counters = counters_[index];
+        stats.allocs += counters.allocs.load(std::memory_order_relaxed);
+        stats.frees += counters.frees.load(std::memory_order_relaxed);
+        stats.frontMisses += counters.misses.load(std::memory_order_relaxed);
+    }
+
+
+    // 关闭的远程队列的头指针
+    static void *closedMark() { return reinterpret_cast<void *>(uintptr_t(1)); }
+
+    static size_t countList(void *head)
+    {
+        size_t count = 0;
+        for (; head; head = FreeList::next(head))
+        {
+            count++;
+        }
+        return count;
+    }
+
+
+    /**
+     * @brief 分配大对象：按整页向页缓存申请一个Span
+     * @param size 请求的内存大小
+     *
+     * 在Span上记录整个Span的字节数，释放时不需要提供大小
+     */
+    static void *allocateLarge(size_t size)
+    {
+        // 向上取整到页时会回绕的大小不可能分配成功
+        if (size > SIZE_MAX - PAGE_SIZE)
+            return nullptr;
+        size_t numPages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+        size_t guard = guardPages() ? 1 : 0;
+        PageCache &pageCache = PageCache::GetInstance();
+        void *ptr = pageCache.allocateSpan<void>(numPages + guard);
+        if (ptr)
+        {
+            Span *span = pageCache.mapObjectToSpan(ptr);
+            span->objSize = numPages * PAGE_SIZE;
+#if MEMPOOL_HARDENED
+            if (guard)
+                Hardening::protectPage(static_cast<char *>(ptr) + span->objSize);
+#endif
+            markAllocated(ptr, span->objSize);
+        }
+        return ptr;
+    }
+
+
+    /**
+     * @brief 释放大对象：把整个Span还给页缓存
+     */
+    static void deallocateLarge(void *ptr)
+    {
+        PageCache &pageCache = PageCache::GetInstance();
+        Span *span = pageCache.mapObjectToSpan(ptr);
+        checkFree(ptr, span);
+        if (span)
+        {
+#if MEMPOOL_HARDENED
+            // 有保护页的Span比 objSize 多一页，还给页缓存之前恢复读写
+            if (span->sizePages * PAGE_SIZE > span->objSize)
+                Hardening::unprotectPage(static_cast<char *>(span->PageAddr) + span->objSize);
+#endif
+            pageCache.deallocateSpan(span->PageAddr, span->sizePages);
+        }
+    }
+
+
+    // 加固模式下大对象末尾是否加保护页（MEMPOOL_CONF 的 guard_pages）
+    static bool guardPages()
+    {
+#if MEMPOOL_HARDENED
+        return MemoryPoolConfig::get().guardPages != 0;
+#else
+        return false;
+#endif
+    }
+
+
+    // 加固模式下在内存块末尾写入“已分配”，返回原指针
+    static void *markAllocated(void *ptr, size_t blockSize)
+    {
+#if MEMPOOL_HARDENED
+        if (ptr)
+            Hardening::markAllocated(ptr, blockSize);
+#else
+        (void)blockSize;
+#endif
+        return ptr;
+    }
+
+
+    // 加固模式下检查释放的内存块（重复释放、越界写），span 为nullptr时查页表
+    static void checkFree(void *ptr, const Span *span = nullptr)
+    {
+#if MEMPOOL_HARDENED
+        Hardening::checkFree(ptr, span ? span : PageCache::mapObjectToSpan(ptr));
+#else
+        (void)ptr;
+        (void)span;
+#endif
+    }
 
 
     /**
      * @brief 判断是否需要归还内存给中心缓存
      * @param index 自由链表的索引
-     * @return bool 如果自由链表大小超过阈值返回true，否则返回false
+     * @return bool 如果自由链表长度超过当前的动态上限返回true，否则返回false
      */
     template <typename N>
     bool shuoReturnThreadCache(N index)
     {
-        const size_t thread = 64;
-        return (_freeListSize[index] > thread);
+        return (_freeListSize[index] > _freeListMaxSize[index]);
     }
 
 
     /**
      * @brief 将多余的内存归还给中心缓存
-     * @param ptr 要归还的内存块指针
-     * @param size 内存块的大小
+     * @param ptr 要归还的内存块指针（自由链表的头节点）
+     * @param index 自由链表的索引
+     *
+     * 每次只归还一个批次（SizeClass::getBatchNum）的内存块，而不是整条链表的一半，
+     * 同时根据归还的情况调整自由链表的长度上限：
+     * 1. 上限小于一个批次时，说明还处于慢启动阶段，上限继续加1
+     * 2. 上限大于一个批次且连续多次超限时，上限缩小一个批次，
+     *    避免长期空闲的大小类占用过多的线程缓存
      */
-    template <typename N>
-    void returnThreadCache(void *ptr, N size)
+    void returnThreadCache(void *ptr, size_t index)
     {
-        //  计算内存大小对应的自由链表索引
-        N index = SizeClass::getIndex(size);
-        // 将内存大小向上对齐到 8 的倍数
-        N AllSize = SizeClass::roundUp(size);
-        // 获取当前链表的大小
-        N batchNum = _freeListSize[index];
-        if (batchNum <= 1)
+        // 一个批次的内存块数量
+        size_t batchNum = SizeClass::getBatchNum(index);
+        // 实际归还的数量不能超过当前链表的长度
+        size_t returnNum = std::min(batchNum, _freeListSize[index]);
+
+        /**
+         * 从链表头部开始数出 returnNum 个节点：
+         *    ptr(start) -> ... -> end -> 剩余节点
+         * 将 end->next 断开，剩余节点继续留在线程本地自由链表中，
+         * [start, end] 这一段交给中心缓存
+         */
+        void *start = ptr;
+        void *end = start;
+        for (size_t i = 1; i < returnNum; ++i)
         {
-            return;
+            end = FreeList::next(end);
         }
-        // 要保留的节点数量
-        N RetainNum = std::max(batchNum / 2, size_t(1));
-
-        // 计算出 需要归还的内存
-        size_t FreesizeNum = batchNum - RetainNum;
-
-        char *current = static_cast<char *>(ptr);
-        char *splitNode = current;
-        for (size_t i = 0; i < RetainNum - 1; ++i)
-        {
-            /**
-             * 重要：链表节点遍历与内存指针操作详解
-             *
-             * 当前内存布局：
-             * +------------------+
-             * |下一块指针(8字节)   |  <--- splitNode 指向这里（块的起始位置）
-             * +------------------+
-             * | 实际数据区域      |  <--- 存储用户数据的区域
-             * | ...              |
-             * +------------------+
-             *
-             * 指针操作步骤详解：
-             * 1. reinterpret_cast<T **>(splitNode)
-             *    - 目的：将 splitNode 从 char* 类型转换为 T** 类型
-             *    - 作用：使编译器将这段内存解释为"指针的指针"
-             *    - 原理：内存块的开头8字节存储的就是下一个块的地址
-             *
-             * 2. *reinterpret_cast<T **>(splitNode)
-             *    - 目的：解引用转换后的指针，获取下一个节点的地址
-             *    - 作用：读取当前内存块开头8字节中存储的地址值
-             *    - 结果：得到指向下一个内存块的指针值
-             *
-             * 3. reinterpret_cast<char *>(...)
-             *    - 目的：将获取的指针转换回 char* 类型
-             *    - 作用：保持指针类型统一，方便后续操作
-             *    - 必要性：内存池中统一使用 char* 处理内存
-             *
-             * 完整过程示例：
-             *    如果 splitNode = 0x1000 (当前块地址)
-             *    且在地址0x1000处存储的值为0x2000 (下一块地址)
-             *    则经过这行代码后，splitNode 将变为 0x2000
-             *
-             * 访问用户数据（如需）：
-             *    要访问实际数据，需要跳过指针部分：
-             *    char* dataStart = splitNode + sizeof(T*);
-             *    这样 dataStart 就指向了用户数据的起始位置
-             *
-             *  遍历到临界点 需要返回给中心内存
-             */
-
-            splitNode = reinterpret_cast<char *>(*reinterpret_cast<void **>(splitNode));
-
-            // 检查是否到达链表末尾
-            if (splitNode == nullptr)
-            {
-                // 如果提前遇到空指针，更新实际可以返回的数量
-                FreesizeNum = batchNum - (i + 1);
-                break;
-            }
+        _freeList[index] = FreeList::next(end);
+        // 断开连接
+        FreeList::setNext(end, nullptr);
+        _freeListSize[index] -= returnNum;
+        cachedBytes_ -= returnNum * SizeClass::getSize(index);
+
+        //! 将这一批内存返回给 中心内存
+        CentralCache::getInstance().returnRange(start, returnNum, index, end);
+
+        // 根据归还情况调整链表长度上限
+        size_t &maxSize = _freeListMaxSize[index];
+        if (maxSize < batchNum)
+        {
+            // 慢启动阶段：链表长度上限还没到一个批次，继续增长
+            maxSize++;
         }
-        if (splitNode != nullptr)
+        else if (maxSize > batchNum)
         {
-            void *nextNode = *reinterpret_cast<void **>(splitNode);
-            // 断开连接
-            *reinterpret_cast<void **>(splitNode) = nullptr;
-            _freeList[index] = nextNode;
-            _freeListSize[index] = RetainNum;
-            if (RetainNum > 0 && nextNode != nullptr)
+            // 连续多次超限说明这个大小类的缓存过多，缩小一个批次
+            if (++_lengthOverages[index] > MAX_LENGTH_OVERAGES)
             {
-                //! 将剩余的内存返回给 中心内存
-                CentralCache::getInstance().returnRange(nextNode, FreesizeNum, index);
+                maxSize -= batchNum;
+                _lengthOverages[index] = 0;
             }
         }
     }
@@ -216,66 +1321,118 @@ private:
      *
      * @param index  内存大小
      * @return void*  返回的是一个指针
+     *
+     * 采用慢启动的方式决定本次获取的数量：
+     * 1. 链表长度上限小于一个批次时，每次未命中只把上限加1，
+     *    避免只分配一次的大小类一次性拿走一整批内存
+     * 2. 达到一个批次之后，每次未命中把上限增加一个批次，直到配置的 max_list_length，
+     *    频繁使用的大小类会在线程本地缓存足够多的内存块，稳定后不再访问中心缓存
      */
     template <typename N>
     void *fetchFromCentralCache(N index)
     {
-        size_t size = (index + 1) * ALIGNMENT;
-        // 根据对象内存大小计算批量获取的数量
-        size_t batchNum = getBatchNum(size);
-        // 从中心缓存批量获取内存
-        void *start = CentralCache::getInstance().fetchRange(index, batchNum);
+        // 根据大小类获取一个批次数量的上限
+        size_t batchNum = SizeClass::getBatchNum(index);
+        size_t &maxSize = _freeListMaxSize[index];
+        // 本次实际请求的数量
+        size_t fetchNum = std::min(maxSize, batchNum);
+        if (maxSize < batchNum)
+        {
+            maxSize++;
+        }
+        else
+        {
+            maxSize = std::min(maxSize + batchNum, std::max(MemoryPoolConfig::get().maxListLength, batchNum));
+            // 保持上限是批次数量的整数倍
+            maxSize -= maxSize % batchNum;
+        }
+
+        // 从中心缓存批量获取内存，actualNum 是实际拿到的数量
+        counterAdd<uint64_t>(counters_[index].misses, 1);
+        MEMPOOL_LATENCY_SCOPE(LATENCY_FRONT_MISS);
+        size_t actualNum = 0;
+        void *start = CentralCache::getInstance().fetchRange<void>(index, fetchNum, actualNum, this);
         if (!start)
             return nullptr;
 
-        // 更新自由链表大小
-        _freeListSize[index] += batchNum;  // 增加对应大小类的自由链表大小
+        // 取一个返回，其余放入线程本地自由链表（此时本地链表一定为空）
+        _freeList[index] = FreeList::next(start);
+        _freeListSize[index] += actualNum - 1;
+        cachedBytes_ += (actualNum - 1) * SizeClass::getSize(index);
 
-        // 取一个返回，其余放入线程本地自由链表
-        void *result = start;
-        if (batchNum > 1)
-        {
-            _freeList[index] = *reinterpret_cast<void **>(start);
-        }
+        return start;
+    }
 
-        return result;
+
+    bool overBudget() const
+    {
+        return __builtin_expect(cachedBytes_ > maxBytes_.load(std::memory_order_relaxed), 0);
     }
 
 
     /**
-     * @brief 计算批量获取内存块的数量
+     * @brief 线程缓存超过字节数上限：每个自由链表归还一半（向上取整）给中心缓存，再尝试增加上限
      *
-     * @param size  内存块的大小
-     * @return size_t  数量
+     * 经常超过上限的线程说明需要更大的缓存，每次从预算中多分一些；
+     * 长期不释放内存的线程保持原来的上限，直到被其他线程取走
      */
-    template <typename N>
-    N getBatchNum(N size)
-    {
-        // 基准：每次批量获取不超过4KB内存
-        constexpr N MAX_BATCH_SIZE = 4 * 1024;  // 4KB
-
-        // 根据对象大小设置合理的基准批量数
-        N baseNum;
-        if (size <= 32)
-            baseNum = 64;  // 64 * 32 = 2KB
-        else if (size <= 64)
-            baseNum = 32;  // 32 * 64 = 2KB
-        else if (size <= 128)
-            baseNum = 16;  // 16 * 128 = 2KB
-        else if (size <= 256)
-            baseNum = 8;  // 8 * 256 = 2KB
-        else if (size <= 512)
-            baseNum = 4;  // 4 * 512 = 2KB
-        else if (size <= 1024)
-            baseNum = 2;  // 2 * 1024 = 2KB
-        else
-            baseNum = 1;  // 大于1024的对象每次只从中心缓存取1个
+    __attribute__((noinline)) void scavenge()
+    {
+        CentralCache &centralCache = CentralCache::getInstance();
+        for (size_t index = 0; index < FREE_LIST_SIZE; index++)
+        {
+            size_t returnNum = (_freeListSize[index] + 1) / 2;
+            if (returnNum == 0)
+                continue;
+            void *start = _freeList[index];
+            void *end = start;
+            for (size_t i = 1; i < returnNum; ++i)
+            {
+                end = FreeList::next(end);
+            }
+            _freeList[index] = FreeList::next(end);
+            FreeList::setNext(end, nullptr);
+            _freeListSize[index] -= returnNum;
+            cachedBytes_ -= returnNum * SizeClass::getSize(index);
+            centralCache.returnRange(start, returnNum, index, end);
+        }
+        growBudget();
+    }
 
-        // 计算最大批量数
-        N maxNum = std::max(size_t(1), MAX_BATCH_SIZE / size);
 
-        // 取最小值，但确保至少返回1
-        return std::max(sizeof(1), std::min(maxNum, baseNum));
+    /**
+     * @brief 为这个线程缓存增加 THREAD_CACHE_STEAL_BYTES 的上限
+     *
+     * 优先使用还没有分配的预算；预算用完时从下一个上限高于最小值的线程缓存取，
+     * 最多检查一遍登记表。上限只在持有 Registry::mutex 时修改，所属线程不加锁读取
+     */
+    void growBudget()
+    {
+        size_t maxBytes = maxBytes_.load(std::memory_order_relaxed);
+        if (maxBytes >= THREAD_CACHE_MAX_BYTES)
+            return;
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        if (reg.unclaimedBytes >= static_cast<int64_t>(THREAD_CACHE_STEAL_BYTES))
+        {
+            reg.unclaimedBytes -= static_cast<int64_t>(THREAD_CACHE_STEAL_BYTES);
+            maxBytes_.store(maxBytes + THREAD_CACHE_STEAL_BYTES, std::memory_order_relaxed);
+            return;
+        }
+        for (ThreadCache *start = reg.nextVictim; ;)
+        {
+            ThreadCache *victim = reg.nextVictim ? reg.nextVictim : reg.head;
+            reg.nextVictim = victim->next_;
+            size_t victimBytes = victim->maxBytes_.load(std::memory_order_relaxed);
+            if (victim != this && victimBytes >= THREAD_CACHE_MIN_BYTES + THREAD_CACHE_STEAL_BYTES)
+            {
+                victim->maxBytes_.store(victimBytes - THREAD_CACHE_STEAL_BYTES, std::memory_order_relaxed);
+                maxBytes_.store(maxBytes + THREAD_CACHE_STEAL_BYTES, std::memory_order_relaxed);
+                return;
+            }
+            if (reg.nextVictim == start)
+                return;
+        }
     }
 
 
@@ -284,6 +1441,63 @@ private:
 
     // 每个线程的自由链表大小统计
     std::array<size_t, FREE_LIST_SIZE> _freeListSize;
+
+    // 每个自由链表的动态长度上限（慢启动）
+    std::array<size_t, FREE_LIST_SIZE> _freeListMaxSize;
+
+    // 每个自由链表连续超过上限的次数
+    std::array<size_t, FREE_LIST_SIZE> _lengthOverages;
+
+    // 所有自由链表中内存块的字节数，只由所属线程修改
+    size_t cachedBytes_ = 0;
+    // 字节数上限，所属线程和其他线程都只在持有 Registry::mutex 时修改
+    std::atomic<size_t> maxBytes_{THREAD_CACHE_MIN_BYTES};
+
+    // 其他线程请求清空这个线程缓存
+    std::atomic<bool> flushRequested_{false};
+
+    // 距离下一次堆分析采样还要分配的字节数，小于0时进入 sampleAllocation
+    int64_t bytesUntilSample_ = 0;
+    // 采样间隔的随机数状态
+    uint64_t sampleSeed_ = 0;
+    // 正在记录采样，期间的分配不再采样
+    bool inSample_ = false;
+
+    /**
+     * @brief 其他线程释放到这个线程缓存的内存块，每个大小类一个无锁栈
+     *
+     * 构造函数不初始化：线程缓存放回对象池后其他线程仍可能访问这里，
+     * 新申请的对象池内存是全0（空队列），复用时由 create() 原子地重新打开。
+     * count 只是近似的长度，用来判断是否需要由释放的线程整条还给中心缓存
+     */
+    struct RemoteList
+    {
+        std::atomic<void *> head;
+        std::atomic<intptr_t> count;
+    };
+    std::array<RemoteList, FREE_LIST_SIZE> remote_;
+
+    /**
+     * @brief 每个大小类的统计计数器，只由所属线程修改，ThreadCache::getStats() 汇总时读取
+     *
+     * 同样不在构造函数中初始化，由 create() 清零
+     */
+    struct ClassCounters
+    {
+        std::atomic<uint64_t> allocs;
+        std::atomic<uint64_t> frees;
+        std::atomic<uint64_t> misses;
+    };
+    std::array<ClassCounters, FREE_LIST_SIZE> counters_;
+
+#if MEMPOOL_LATENCY_HISTOGRAM
+    // 这个线程的慢路径延迟直方图，由 create() 清零，线程退出时并入 Registry::retiredLatency
+    LatencyRecorder latency_;
+#endif
+
+    // 登记表中的前后节点（Registry::mutex 保护）
+    ThreadCache *next_ = nullptr;
+    ThreadCache *prev_ = nullptr;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,153 @@
+// 传输缓存
+
+#ifndef TRANSFER_CACHE_H
+#define TRANSFER_CACHE_H
+#include "Conmmon.h"
+#include "SpinLock.h"
+#include "Stats.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/**
+ * @class TransferCache
+ * @brief 线程缓存和中心缓存之间按批次交换内存块的缓存
+ *
+ * 每个大小类保存若干个已经串好的完整批次（头指针、尾指针），批次的数量固定为
+ * SizeClass::getBatchNum(index)，不需要单独记录：
+ * 1. 线程缓存归还一个完整批次时直接整批放入，不需要逐个找到所属的Span
+ * 2. 线程缓存申请一个完整批次时直接整批取走，不需要遍历Span的空闲链表
+ * 3. 临界区内只有一次数组读写，时间复杂度 O(1)，与批次大小无关
+ * 放满或取空时才退回 CentralCache 中按Span管理的慢路径
+ */
+class TransferCache
+{
+public:
+    /**
+     * @brief 放入一个完整批次
+     * @param index 大小类的索引
+     * @param head 批次链表的头节点
+     * @param tail 批次链表的尾节点
+     * @return bool 放入成功返回true，该大小类已满返回false
+     */
+    bool insert(size_t index, void *head, void *tail)
+    {
+        ClassCache &cache = caches_[index];
+        cache.lock.lock();
+        size_t count = cache.count.load(std::memory_order_relaxed);
+        bool ok = count < cache.capacity;
+        if (ok)
+        {
+            cache.batches[count] = {head, tail};
+            cache.count.store(count + 1, std::memory_order_relaxed);
+        }
+        cache.lock.unlock();
+        return ok;
+    }
+
+    /**
+     * @brief 取出一个完整批次
+     * @param index 大小类的索引
+     * @param tail 输出批次链表的尾节点
+     * @return void* 批次链表的头节点，该大小类为空时返回nullptr
+     */
+    void *remove(size_t index, void *&tail)
+    {
+        ClassCache &cache = caches_[index];
+        // 不加锁先看一眼，空的时候不用去抢锁
+        if (cache.count.load(std::memory_order_relaxed) == 0)
+            return nullptr;
+        cache.lock.lock();
+        void *head = nullptr;
+        size_t count = cache.count.load(std::memory_order_relaxed);
+        if (count > 0)
+        {
+            Batch &batch = cache.batches[count - 1];
+            head = batch.head;
+            tail = batch.tail;
+            cache.count.store(count - 1, std::memory_order_relaxed);
+            counterAdd<uint64_t>(cache.hits, 1);
+        }
+        cache.lock.unlock();
+        return head;
+    }
+
+    /**
+     * @brief 大小类最多缓存的批次数量
+     *
+     * 总字节数不超过 TRANSFER_CACHE_BYTES 且至少一个批次，最多 TRANSFER_CACHE_SLOTS 个
+     */
+    static constexpr size_t capacity(size_t index)
+    {
+        size_t batchBytes = SizeClass::getBatchNum(index) * SizeClass::getSize(index);
+        return std::max<size_t>(1, std::min(TRANSFER_CACHE_BYTES / batchBytes, TRANSFER_CACHE_SLOTS));
+    }
+
+    /**
+     * @brief 把一个大小类的缓存数量、命中次数和锁竞争次数累加到统计中
+     */
+    void collectStats(size_t index, ClassStats &stats) const
+    {
+        const ClassCache &cache = caches_[index];
+        stats.transferObjects += cache.count.load(std::memory_order_relaxed) * SizeClass::getBatchNum(index);
+        stats.transferHits += cache.hits.load(std::memory_order_relaxed);
+        stats.lockContentions += cache.lock.contentions();
+    }
+
+    /**
+     * @brief fork 之前获取所有大小类的锁，见 CentralCache::prepareFork()
+     */
+    void prepareFork()
+    {
+        for (ClassCache &cache : caches_)
+        {
+            cache.lock.lock();
+        }
+    }
+
+    /**
+     * @brief fork 之后释放 prepareFork() 获取的锁
+     * @param child 是否在子进程中
+     */
+    void afterFork(bool child)
+    {
+        for (ClassCache &cache : caches_)
+        {
+            if (child)
+                cache.lock.unlockInChild();
+            else
+                cache.lock.unlock();
+        }
+    }
+
+    TransferCache()
+    {
+        for (size_t index = 0; index < FREE_LIST_SIZE; index++)
+        {
+            caches_[index].capacity = capacity(index);
+        }
+    }
+
+private:
+    struct Batch
+    {
+        void *head;
+        void *tail;
+    };
+
+    // 每个大小类独占缓存行，不同大小类之间不会伪共享
+    struct alignas(64) ClassCache
+    {
+        SpinLock lock;
+        // count 只在持锁时修改，remove 里不加锁的读取只用来提前判断是否为空
+        std::atomic<size_t> count{0};
+        // 整批取走的次数，只在持锁时修改
+        std::atomic<uint64_t> hits{0};
+        size_t capacity = 0;
+        Batch batches[TRANSFER_CACHE_SLOTS];
+    };
+
+    std::array<ClassCache, FREE_LIST_SIZE> caches_;
+};
+
+#endif
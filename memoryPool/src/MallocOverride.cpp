@@ -0,0 +1,272 @@
+// 替换系统的 malloc/free/new/delete
+//
+// 编译成 libmempool_malloc.so 后通过 LD_PRELOAD 加载，或者静态链接 libmempool_malloc_static.a，
+// 不需要修改程序代码就可以让所有内存分配都经过 ThreadCache -> CentralCache -> PageCache
+
+#include "../inc/ThreadCache.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+// 动态库默认隐藏所有符号，只导出替换的分配函数
+#define MEMPOOL_VISIBLE __attribute__((visibility("default")))
+#define MEMPOOL_EXPORT extern "C" MEMPOOL_VISIBLE
+
+namespace
+{
+// malloc 返回的内存需要满足 alignof(max_align_t)（x86-64 为16字节）
+constexpr size_t MALLOC_ALIGNMENT = alignof(std::max_align_t);
+
+/**
+ * @brief 计算 malloc 实际请求的大小
+ *
+ * 大于8字节的请求向上取整到16的倍数，对应的大小类都是16的倍数，
+ * 内存块从页对齐的Span起始位置切分，所以地址也是16字节对齐的。
+ * 加固模式下 ThreadCache 会再加上末尾的标记，取整时把标记算在内
+ */
+inline size_t mallocSize(size_t size)
+{
+    if (size + HARDENED_TAG_BYTES <= ALIGNMENT)
+        return ALIGNMENT;
+    return ((size + HARDENED_TAG_BYTES + MALLOC_ALIGNMENT - 1) & ~(MALLOC_ALIGNMENT - 1)) - HARDENED_TAG_BYTES;
+}
+
+inline void *poolMalloc(size_t size)
+{
+    if (size > SIZE_MAX - PAGE_SIZE)
+        return nullptr;
+    return ThreadCache::getThreadCache()->allocate<void>(mallocSize(size));
+}
+
+inline void poolFree(void *ptr)
+{
+    if (ptr)
+        ThreadCache::getThreadCache()->deallocate(ptr);
+}
+
+/**
+ * @brief 按指定对齐分配内存，align 必须是2的幂
+ *
+ * 不超过16字节的对齐与 malloc 相同，更大的对齐由 ThreadCache::allocateAligned 处理
+ */
+inline void *poolAlignedAlloc(size_t align, size_t size)
+{
+    if (align <= MALLOC_ALIGNMENT)
+        return poolMalloc(size);
+    return ThreadCache::getThreadCache()->allocateAligned<void>(size, align);
+}
+
+inline size_t poolUsableSize(const void *ptr) { return ThreadCache::usableSize(ptr); }
+
+/**
+ * @brief realloc 的实现：能原地调整时不复制数据，不属于内存池的指针返回nullptr
+ */
+inline void *poolRealloc(void *ptr, size_t size)
+{
+    if (size > SIZE_MAX - PAGE_SIZE)
+        return nullptr;
+    return ThreadCache::getThreadCache()->reallocate(ptr, size ? mallocSize(size) : 0);
+}
+
+inline bool isPowerOfTwo(size_t value) { return value && (value & (value - 1)) == 0; }
+
+/**
+ * @brief operator new 的实现：失败时调用 new_handler，没有 new_handler 时抛出 bad_alloc
+ */
+inline void *poolNew(size_t size, size_t align)
+{
+    for (;;)
+    {
+        void *ptr = align <= MALLOC_ALIGNMENT ? poolMalloc(size) : poolAlignedAlloc(align, size);
+        if (ptr)
+            return ptr;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+inline void *poolNewNothrow(size_t size, size_t align) noexcept
+{
+    try
+    {
+        return poolNew(size, align);
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+/**
+ * @brief 带大小的 delete：大小类由请求大小直接算出，其他线程分配的内存块同样回到所属线程缓存
+ */
+inline void poolSizedDelete(void *ptr, size_t size)
+{
+    if (ptr)
+        ThreadCache::getThreadCache()->deallocate(ptr, mallocSize(size));
+}
+}  // namespace
+
+
+/* ---------------------------------- C 接口 ---------------------------------- */
+
+MEMPOOL_EXPORT void *malloc(size_t size)
+{
+    void *ptr = poolMalloc(size);
+    if (!ptr)
+        errno = ENOMEM;
+    return ptr;
+}
+
+MEMPOOL_EXPORT void free(void *ptr) { poolFree(ptr); }
+
+MEMPOOL_EXPORT void *calloc(size_t num, size_t size)
+{
+    size_t bytes = 0;
+    if (__builtin_mul_overflow(num, size, &bytes))
+    {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    void *ptr = poolMalloc(bytes);
+    if (!ptr)
+    {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    // 自由链表上的内存块可能是之前用过的，需要清零
+    memset(ptr, 0, bytes);
+    return ptr;
+}
+
+MEMPOOL_EXPORT void *realloc(void *ptr, size_t size)
+{
+    void *newPtr = poolRealloc(ptr, size);
+    if (!newPtr && size)
+        errno = ENOMEM;
+    return newPtr;
+}
+
+MEMPOOL_EXPORT void *reallocarray(void *ptr, size_t num, size_t size)
+{
+    size_t bytes = 0;
+    if (__builtin_mul_overflow(num, size, &bytes))
+    {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return realloc(ptr, bytes);
+}
+
+MEMPOOL_EXPORT int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    if (!isPowerOfTwo(align) || align % sizeof(void *) != 0)
+        return EINVAL;
+    void *ptr = poolAlignedAlloc(align, size);
+    if (!ptr)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+MEMPOOL_EXPORT void *aligned_alloc(size_t align, size_t size)
+{
+    if (!isPowerOfTwo(align))
+    {
+        errno = EINVAL;
+        return nullptr;
+    }
+    void *ptr = poolAlignedAlloc(align, size);
+    if (!ptr)
+        errno = ENOMEM;
+    return ptr;
+}
+
+MEMPOOL_EXPORT void *memalign(size_t align, size_t size) { return aligned_alloc(align, size); }
+
+MEMPOOL_EXPORT void *valloc(size_t size) { return aligned_alloc(PAGE_SIZE, size); }
+
+MEMPOOL_EXPORT void *pvalloc(size_t size)
+{
+    return aligned_alloc(PAGE_SIZE, (std::max<size_t>(size, 1) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+}
+
+MEMPOOL_EXPORT size_t malloc_usable_size(void *ptr) { return poolUsableSize(ptr); }
+
+// glibc 的 malloc_stats 同样输出到标准错误
+MEMPOOL_EXPORT void malloc_stats(void) { ThreadCache::getStats().print(stderr); }
+
+
+/* ------------------------------- 内存池的扩展接口 ------------------------------- */
+
+// 以文本表格输出内存池的统计信息
+MEMPOOL_EXPORT void mempool_stats(FILE *out) { ThreadCache::getStats().print(out ? out : stderr); }
+
+// 以一个 JSON 对象输出内存池的统计信息
+MEMPOOL_EXPORT void mempool_stats_json(FILE *out) { ThreadCache::getStats().printJson(out ? out : stderr); }
+
+// 以文本表格输出慢路径的延迟直方图，需要以 MEMPOOL_LATENCY_HISTOGRAM 编译
+MEMPOOL_EXPORT void mempool_latency(FILE *out) { ThreadCache::getLatencyStats().print(out ? out : stderr); }
+
+// 在第一次分配之前设置运行时配置，格式与环境变量 MEMPOOL_CONF 相同，成功返回0
+MEMPOOL_EXPORT int mempool_configure(const char *spec)
+{
+    MemoryPoolConfig config;
+    return MemoryPoolConfig::parse(spec, config) && MemoryPoolConfig::configure(config) ? 0 : -1;
+}
+
+// 服务开始处理请求之前预热缓存，格式为逗号分隔的 大小=数量（例如 "64=1000,4K=16"），
+// 在当前线程中分配并逐页写入后释放；格式错误或内存不足时返回-1
+MEMPOOL_EXPORT int mempool_warmup(const char *profile)
+{
+    bool complete = true;
+    bool parsed = MemoryPoolConfig::parseWarmup(profile, [&complete](size_t size, size_t count) {
+        if (size > SIZE_MAX - PAGE_SIZE || ThreadCache::warmup(mallocSize(size), count) != count)
+            complete = false;
+    });
+    return parsed && complete ? 0 : -1;
+}
+
+// 设置堆分析的平均采样间隔（字节），0表示关闭
+MEMPOOL_EXPORT void mempool_set_sample_rate(size_t bytes) { HeapProfiler::setSampleRate(bytes); }
+
+// 以 pprof 可以读取的 heap profile 格式输出存活的采样，成功返回0
+MEMPOOL_EXPORT int mempool_heap_profile(FILE *out) { return HeapProfiler::getInstance().writeProfile(out) ? 0 : -1; }
+
+
+/* -------------------------------- C++ 运算符 -------------------------------- */
+
+MEMPOOL_VISIBLE void *operator new(size_t size) { return poolNew(size, 0); }
+MEMPOOL_VISIBLE void *operator new[](size_t size) { return poolNew(size, 0); }
+MEMPOOL_VISIBLE void *operator new(size_t size, const std::nothrow_t &) noexcept { return poolNewNothrow(size, 0); }
+MEMPOOL_VISIBLE void *operator new[](size_t size, const std::nothrow_t &) noexcept { return poolNewNothrow(size, 0); }
+
+MEMPOOL_VISIBLE void *operator new(size_t size, std::align_val_t align) { return poolNew(size, static_cast<size_t>(align)); }
+MEMPOOL_VISIBLE void *operator new[](size_t size, std::align_val_t align) { return poolNew(size, static_cast<size_t>(align)); }
+MEMPOOL_VISIBLE void *operator new(size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return poolNewNothrow(size, static_cast<size_t>(align));
+}
+MEMPOOL_VISIBLE void *operator new[](size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return poolNewNothrow(size, static_cast<size_t>(align));
+}
+
+MEMPOOL_VISIBLE void operator delete(void *ptr) noexcept { poolFree(ptr); }
+MEMPOOL_VISIBLE void operator delete[](void *ptr) noexcept { poolFree(ptr); }
+MEMPOOL_VISIBLE void operator delete(void *ptr, const std::nothrow_t &) noexcept { poolFree(ptr); }
+MEMPOOL_VISIBLE void operator delete[](void *ptr, const std::nothrow_t &) noexcept { poolFree(ptr); }
+MEMPOOL_VISIBLE void operator delete(void *ptr, size_t size) noexcept { poolSizedDelete(ptr, size); }
+MEMPOOL_VISIBLE void operator delete[](void *ptr, size_t size) noexcept { poolSizedDelete(ptr, size); }
+
+// 对齐分配的内存块大小与请求大小不对应，只能通过页表释放
+MEMPOOL_VISIBLE void operator delete(void *ptr, std::align_val_t) noexcept { poolFree(ptr); }
+MEMPOOL_VISIBLE void operator delete[](void *ptr, std::align_val_t) noexcept { poolFree(ptr); }
+MEMPOOL_VISIBLE void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { poolFree(ptr); }
+MEMPOOL_VISIBLE void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { poolFree(ptr); }
+MEMPOOL_VISIBLE void operator delete(void *ptr, size_t, std::align_val_t) noexcept { poolFree(ptr); }
+MEMPOOL_VISIBLE void operator delete[](void *ptr, size_t, std::align_val_t) noexcept { poolFree(ptr); }
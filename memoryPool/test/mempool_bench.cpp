@@ -0,0 +1,804 @@
+/**
+ * @file mempool_bench.cpp
+ * @brief 分配器基准测试
+ *
+ * 一组参数化的场景，每个场景按线程数分别运行，并在内存池（ThreadCache）和
+ * 进程的 malloc/free 上各跑一遍：
+ * 1. fixed/大小：固定大小，整批分配后整批释放
+ * 2. random_mix：8-4096 字节均匀分布，70% 分配、30% 随机释放
+ * 3. realistic：偏向小对象、带大对象长尾的大小分布，固定大小的工作集随机替换
+ * 4. prodcons：生产者分配、消费者释放，全部是跨线程释放
+ * 5. larson：每轮结束后工作集交给下一个线程，由其他线程释放上一轮的内存块
+ * 6. threadtest：每个线程反复分配一大批小对象再全部释放
+ * 7. large：64KB-1MB 的大对象，夹杂单独映射的超大对象
+ *
+ * 输出每秒操作数、单次操作延迟的 p50/p99/p999（每 LATENCY_SAMPLE_EVERY 次操作计时一次），
+ * 用户持有的字节峰值和常驻内存的峰值增量。每个场景、后端和线程数的组合在单独fork的子进程中运行，
+ * 常驻内存只计算子进程开始之后增加的部分，不包含之前的组合留在缓存中的内存。
+ *
+ * 链接 jemalloc、tcmalloc 的版本（mempool_bench_jemalloc、mempool_bench_tcmalloc）中
+ * malloc 后端就是对应的分配器；也可以用 LD_PRELOAD 替换 malloc 后端。
+ *
+ * 用法：mempool_bench [--filter=子串] [--allocator=pool,malloc] [--threads=1,2,4] [--quick]
+ */
+
+#include "../inc/ThreadCache.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#ifndef MEMPOOL_BENCH_MALLOC_NAME
+#define MEMPOOL_BENCH_MALLOC_NAME "malloc"
+#endif
+
+namespace
+{
+// 每个线程默认的操作次数，--quick 时除以 QUICK_DIVISOR
+constexpr uint64_t DEFAULT_OPS = 1000000;
+constexpr uint64_t QUICK_DIVISOR = 20;
+// 每多少次操作记录一次延迟，必须是2的幂
+constexpr uint64_t LATENCY_SAMPLE_EVERY = 16;
+// 常驻内存的采样间隔
+constexpr auto RSS_SAMPLE_INTERVAL = std::chrono::milliseconds(2);
+// 每个线程每多少次分配汇总一次所有线程持有的字节数，必须是2的幂
+constexpr uint64_t LIVE_SAMPLE_EVERY = 64;
+
+/* ---------------------------------- 后端 ---------------------------------- */
+
+// 内存池：按大小释放，与 STL 分配器和 sized delete 的用法相同
+struct PoolBackend
+{
+    static void *allocate(size_t size) { return ThreadCache::getThreadCache()->allocate<void>(size); }
+    static void deallocate(void *ptr, size_t size) { ThreadCache::getThreadCache()->deallocate(ptr, size); }
+};
+
+// 进程当前使用的 malloc（glibc，或者链接、预加载的其他分配器）
+struct MallocBackend
+{
+    static void *allocate(size_t size) { return malloc(size); }
+    static void deallocate(void *ptr, size_t) { free(ptr); }
+};
+
+/* -------------------------------- 计时和统计 -------------------------------- */
+
+uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief 每个线程的统计：操作次数、采样的延迟、用户持有的字节数
+ *
+ * liveBytes 由所属线程修改、其他线程读取；跨线程释放时释放者减少自己的计数，单个线程可能为负。
+ * 采样线程的间隔比很短的场景还长，所以每个线程每 LIVE_SAMPLE_EVERY 次分配也汇总一次 peers 的 liveBytes
+ */
+struct alignas(64) Worker
+{
+    std::mt19937_64 rng;
+    uint64_t ops = 0;
+    uint64_t allocs = 0;
+    std::vector<uint32_t> latencies;
+    std::atomic<int64_t> liveBytes{0};
+    const std::vector<Worker> *peers = nullptr;
+    size_t peakLive = 0;
+
+    template <typename Backend>
+    void *allocate(size_t size)
+    {
+        void *ptr = nullptr;
+        if ((ops++ & (LATENCY_SAMPLE_EVERY - 1)) == 0)
+        {
+            uint64_t start = nowNs();
+            ptr = Backend::allocate(size);
+            latencies.push_back(static_cast<uint32_t>(std::min<uint64_t>(nowNs() - start, UINT32_MAX)));
+        }
+        else
+        {
+            ptr = Backend::allocate(size);
+        }
+        if (!ptr)
+        {
+            fprintf(stderr, "分配 %zu 字节失败\n", size);
+            abort();
+        }
+        // 写首尾两个字节，保证页真正被访问，又不把内存带宽算进分配器的时间
+        static_cast<char *>(ptr)[0] = 1;
+        static_cast<char *>(ptr)[size - 1] = 1;
+        liveBytes.store(liveBytes.load(std::memory_order_relaxed) + static_cast<int64_t>(size),
+                        std::memory_order_relaxed);
+        if ((++allocs & (LIVE_SAMPLE_EVERY - 1)) == 0 && peers)
+            peakLive = std::max(peakLive, totalLive(*peers));
+        return ptr;
+    }
+
+    /**
+     * @brief 所有线程持有的字节数之和，负数按0计算
+     */
+    static size_t totalLive(const std::vector<Worker> &workers)
+    {
+        int64_t live = 0;
+        for (const Worker &worker : workers)
+        {
+            live += worker.liveBytes.load(std::memory_order_relaxed);
+        }
+        return static_cast<size_t>(std::max<int64_t>(live, 0));
+    }
+
+    template <typename Backend>
+    void deallocate(void *ptr, size_t size)
+    {
+        if ((ops++ & (LATENCY_SAMPLE_EVERY - 1)) == 0)
+        {
+            uint64_t start = nowNs();
+            Backend::deallocate(ptr, size);
+            latencies.push_back(static_cast<uint32_t>(std::min<uint64_t>(nowNs() - start, UINT32_MAX)));
+        }
+        else
+        {
+            Backend::deallocate(ptr, size);
+        }
+        liveBytes.store(liveBytes.load(std::memory_order_relaxed) - static_cast<int64_t>(size),
+                        std::memory_order_relaxed);
+    }
+};
+
+struct Block
+{
+    void *ptr;
+    size_t size;
+};
+
+/**
+ * @brief 偏向小对象、带大对象长尾的大小分布
+ *
+ * 50% 8-64 字节，30% 65-512，15% 513-4096，4% 4K-32K，1% 32K-256K
+ */
+size_t realisticSize(std::mt19937_64 &rng)
+{
+    uint64_t r = rng() % 100;
+    auto between = [&rng](size_t low, size_t high) { return low + rng() % (high - low + 1); };
+    if (r < 50)
+        return between(8, 64);
+    if (r < 80)
+        return between(65, 512);
+    if (r < 95)
+        return between(513, 4096);
+    if (r < 99)
+        return between(4097, 32 * 1024);
+    return between(32 * 1024 + 1, 256 * 1024);
+}
+
+/**
+ * @brief 所有线程同时开始的屏障，可以重复使用
+ */
+class Barrier
+{
+public:
+    explicit Barrier(size_t count) : count_(count) {}
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        size_t generation = generation_;
+        if (++arrived_ == count_)
+        {
+            arrived_ = 0;
+            generation_++;
+            cond_.notify_all();
+            return;
+        }
+        cond_.wait(lock, [&] { return generation != generation_; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    size_t count_;
+    size_t arrived_ = 0;
+    size_t generation_ = 0;
+};
+
+/**
+ * @brief 单生产者单消费者的有界环形队列
+ */
+class BlockQueue
+{
+public:
+    bool push(const Block &block)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == CAPACITY)
+            return false;
+        slots_[tail % CAPACITY] = block;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(Block &block)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+            return false;
+        block = slots_[head % CAPACITY];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static constexpr size_t CAPACITY = 1024;
+    Block slots_[CAPACITY];
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+/* ---------------------------------- 场景 ---------------------------------- */
+
+/**
+ * @brief 场景运行时的共享状态
+ */
+struct Context
+{
+    size_t threads;
+    uint64_t opsPerThread;
+    std::vector<Worker> workers;
+    Barrier barrier;
+
+    Context(size_t threadCount, uint64_t ops) : threads(threadCount), opsPerThread(ops), workers(threadCount), barrier(threadCount)
+    {
+        for (size_t i = 0; i < threadCount; i++)
+        {
+            workers[i].rng.seed(i + 1);
+            workers[i].peers = &workers;
+            workers[i].latencies.reserve(ops / LATENCY_SAMPLE_EVERY * 2 + 16);
+        }
+    }
+};
+
+template <typename Backend>
+void fixedSize(Context &ctx, size_t id, size_t size)
+{
+    constexpr size_t BATCH = 1000;
+    Worker &worker = ctx.workers[id];
+    std::vector<void *> ptrs(BATCH);
+    while (worker.ops < ctx.opsPerThread)
+    {
+        for (void *&ptr : ptrs)
+        {
+            ptr = worker.allocate<Backend>(size);
+        }
+        for (void *ptr : ptrs)
+        {
+            worker.deallocate<Backend>(ptr, size);
+        }
+    }
+}
+
+// 原来 pressure_test 的负载：8-4096 字节均匀分布，70% 分配、30% 随机释放。
+// 四成的分配一直持有到最后，操作次数取十分之一，避免线程多时占用过多内存
+template <typename Backend>
+void randomMix(Context &ctx, size_t id)
+{
+    Worker &worker = ctx.workers[id];
+    uint64_t ops = std::max<uint64_t>(ctx.opsPerThread / 10, 1000);
+    std::vector<Block> blocks;
+    blocks.reserve(ops);
+    while (worker.ops < ops)
+    {
+        if (blocks.empty() || worker.rng() % 100 >= 30)
+        {
+            size_t size = 8 + worker.rng() % (4096 - 8 + 1);
+            blocks.push_back({worker.allocate<Backend>(size), size});
+        }
+        else
+        {
+            size_t index = worker.rng() % blocks.size();
+            worker.deallocate<Backend>(blocks[index].ptr, blocks[index].size);
+            blocks[index] = blocks.back();
+            blocks.pop_back();
+        }
+    }
+    for (const Block &block : blocks)
+    {
+        worker.deallocate<Backend>(block.ptr, block.size);
+    }
+}
+
+template <typename Backend>
+void realistic(Context &ctx, size_t id)
+{
+    constexpr size_t WORKING_SET = 4096;
+    Worker &worker = ctx.workers[id];
+    std::vector<Block> blocks(WORKING_SET);
+    for (Block &block : blocks)
+    {
+        block.size = realisticSize(worker.rng);
+        block.ptr = worker.allocate<Backend>(block.size);
+    }
+    while (worker.ops < ctx.opsPerThread)
+    {
+        Block &block = blocks[worker.rng() % WORKING_SET];
+        worker.deallocate<Backend>(block.ptr, block.size);
+        block.size = realisticSize(worker.rng);
+        block.ptr = worker.allocate<Backend>(block.size);
+    }
+    for (const Block &block : blocks)
+    {
+        worker.deallocate<Backend>(block.ptr, block.size);
+    }
+}
+
+// 线程两两配对，偶数编号生产、奇数编号消费；线程数为奇数时最后一个线程自产自销
+template <typename Backend>
+void producerConsumer(Context &ctx, size_t id, std::vector<BlockQueue> &queues)
+{
+    Worker &worker = ctx.workers[id];
+    size_t pair = id / 2;
+    bool alone = id + 1 == ctx.threads && id % 2 == 0;
+    if (alone)
+    {
+        while (worker.ops < ctx.opsPerThread)
+        {
+            size_t size = realisticSize(worker.rng);
+            worker.deallocate<Backend>(worker.allocate<Backend>(size), size);
+        }
+        return;
+    }
+
+    BlockQueue &queue = queues[pair];
+    uint64_t count = ctx.opsPerThread / 2;
+    if (id % 2 == 0)
+    {
+        for (uint64_t i = 0; i < count; i++)
+        {
+            size_t size = realisticSize(worker.rng);
+            Block block{worker.allocate<Backend>(size), size};
+            while (!queue.push(block))
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+    else
+    {
+        Block block;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            while (!queue.pop(block))
+            {
+                std::this_thread::yield();
+            }
+            worker.deallocate<Backend>(block.ptr, block.size);
+        }
+    }
+}
+
+// 每轮随机替换工作集中的内存块，轮与轮之间工作集交给下一个线程
+template <typename Backend>
+void larson(Context &ctx, size_t id, std::vector<std::vector<Block>> &sets)
+{
+    constexpr size_t SLOTS = 1000;
+    constexpr size_t ROUNDS = 20;
+    Worker &worker = ctx.workers[id];
+    std::vector<Block> &initial = sets[id];
+    initial.resize(SLOTS);
+    for (Block &block : initial)
+    {
+        block.size = 16 + worker.rng() % (1024 - 16 + 1);
+        block.ptr = worker.allocate<Backend>(block.size);
+    }
+    uint64_t perRound = ctx.opsPerThread / ROUNDS / 2;
+    for (size_t round = 0; round < ROUNDS; round++)
+    {
+        ctx.barrier.wait();
+        std::vector<Block> &blocks = sets[(id + round) % ctx.threads];
+        for (uint64_t i = 0; i < perRound; i++)
+        {
+            Block &block = blocks[worker.rng() % SLOTS];
+            worker.deallocate<Backend>(block.ptr, block.size);
+            block.size = 16 + worker.rng() % (1024 - 16 + 1);
+            block.ptr = worker.allocate<Backend>(block.size);
+        }
+    }
+    ctx.barrier.wait();
+    for (const Block &block : sets[id])
+    {
+        worker.deallocate<Backend>(block.ptr, block.size);
+    }
+}
+
+template <typename Backend>
+void threadTest(Context &ctx, size_t id)
+{
+    constexpr size_t BATCH = 10000;
+    Worker &worker = ctx.workers[id];
+    std::vector<Block> blocks(BATCH);
+    while (worker.ops < ctx.opsPerThread)
+    {
+        for (Block &block : blocks)
+        {
+            block.size = 8 + worker.rng() % (64 - 8 + 1);
+            block.ptr = worker.allocate<Backend>(block.size);
+        }
+        for (const Block &block : blocks)
+        {
+            worker.deallocate<Backend>(block.ptr, block.size);
+        }
+    }
+}
+
+// 每16次分配中有一次是单独映射的超大对象
+template <typename Backend>
+void largeObjects(Context &ctx, size_t id)
+{
+    constexpr size_t WINDOW = 8;
+    Worker &worker = ctx.workers[id];
+    std::vector<Block> blocks;
+    uint64_t ops = std::max<uint64_t>(ctx.opsPerThread / 100, 200);
+    while (worker.ops < ops)
+    {
+        if (blocks.size() == WINDOW)
+        {
+            size_t index = worker.rng() % WINDOW;
+            worker.deallocate<Backend>(blocks[index].ptr, blocks[index].size);
+            blocks[index] = blocks.back();
+            blocks.pop_back();
+        }
+        size_t size = worker.rng() % 16 == 0 ? (8 << 20) + worker.rng() % (8 << 20)
+                                             : (64 << 10) + worker.rng() % (1 << 20);
+        blocks.push_back({worker.allocate<Backend>(size), size});
+    }
+    for (const Block &block : blocks)
+    {
+        worker.deallocate<Backend>(block.ptr, block.size);
+    }
+}
+
+/**
+ * @brief 一个场景在一个后端上的入口
+ *
+ * 场景自己需要的共享状态（队列、工作集）在这里创建
+ */
+template <typename Backend>
+std::function<void(Context &)> scenarioBody(const std::string &name)
+{
+    auto perThread = [](auto body) {
+        return [body](Context &ctx) {
+            std::vector<std::thread> threads;
+            for (size_t id = 0; id < ctx.threads; id++)
+            {
+                threads.emplace_back([&ctx, id, &body] { body(ctx, id); });
+            }
+            for (std::thread &thread : threads)
+            {
+                thread.join();
+            }
+        };
+    };
+
+    if (name.rfind("fixed/", 0) == 0)
+    {
+        size_t size = std::stoul(name.substr(6));
+        return perThread([size](Context &ctx, size_t id) { fixedSize<Backend>(ctx, id, size); });
+    }
+    if (name == "random_mix")
+        return perThread([](Context &ctx, size_t id) { randomMix<Backend>(ctx, id); });
+    if (name == "realistic")
+        return perThread([](Context &ctx, size_t id) { realistic<Backend>(ctx, id); });
+    if (name == "prodcons")
+    {
+        return [perThread](Context &ctx) {
+            std::vector<BlockQueue> queues(ctx.threads / 2 + 1);
+            perThread([&queues](Context &c, size_t id) { producerConsumer<Backend>(c, id, queues); })(ctx);
+        };
+    }
+    if (name == "larson")
+    {
+        return [perThread](Context &ctx) {
+            std::vector<std::vector<Block>> sets(ctx.threads);
+            perThread([&sets](Context &c, size_t id) { larson<Backend>(c, id, sets); })(ctx);
+        };
+    }
+    if (name == "threadtest")
+        return perThread([](Context &ctx, size_t id) { threadTest<Backend>(ctx, id); });
+    return perThread([](Context &ctx, size_t id) { largeObjects<Backend>(ctx, id); });
+}
+
+const std::vector<std::string> SCENARIOS = {"fixed/16",  "fixed/64",   "fixed/256",  "fixed/1024", "fixed/4096",
+                                            "random_mix", "realistic", "prodcons",   "larson",     "threadtest",
+                                            "large"};
+
+/* -------------------------------- 运行和输出 -------------------------------- */
+
+size_t readRss(int fd)
+{
+    if (fd < 0)
+        return 0;
+    char buffer[128];
+    ssize_t n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (n <= 0)
+        return 0;
+    buffer[n] = '\0';
+    unsigned long long sizePages = 0;
+    unsigned long long residentPages = 0;
+    if (sscanf(buffer, "%llu %llu", &sizePages, &residentPages) != 2)
+        return 0;
+    return static_cast<size_t>(residentPages) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+struct Result
+{
+    double seconds;
+    uint64_t ops;
+    uint32_t p50;
+    uint32_t p99;
+    uint32_t p999;
+    size_t peakLive;
+    size_t peakRss;
+};
+
+Result runScenario(const std::function<void(Context &)> &body, size_t threads, uint64_t ops)
+{
+    int statmFd = open("/proc/self/statm", O_RDONLY);
+    size_t startRss = readRss(statmFd);
+    Context ctx(threads, ops);
+    std::atomic<bool> done{false};
+    size_t peakLive = 0;
+    size_t peakRss = startRss;
+    // 采样线程记录用户持有字节数和常驻内存的峰值
+    std::thread sampler([&] {
+        while (!done.load(std::memory_order_acquire))
+        {
+            peakLive = std::max(peakLive, Worker::totalLive(ctx.workers));
+            peakRss = std::max(peakRss, readRss(statmFd));
+            std::this_thread::sleep_for(RSS_SAMPLE_INTERVAL);
+        }
+    });
+
+    uint64_t start = nowNs();
+    body(ctx);
+    uint64_t elapsed = nowNs() - start;
+    done.store(true, std::memory_order_release);
+    sampler.join();
+    peakRss = std::max(peakRss, readRss(statmFd));
+    if (statmFd >= 0)
+        close(statmFd);
+
+    Result result{};
+    result.seconds = static_cast<double>(elapsed) / 1e9;
+    std::vector<uint32_t> latencies;
+    for (Worker &worker : ctx.workers)
+    {
+        result.ops += worker.ops;
+        peakLive = std::max(peakLive, worker.peakLive);
+        latencies.insert(latencies.end(), worker.latencies.begin(), worker.latencies.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        return latencies.empty() ? 0 : latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+    };
+    result.p50 = percentile(0.50);
+    result.p99 = percentile(0.99);
+    result.p999 = percentile(0.999);
+    result.peakLive = peakLive;
+    result.peakRss = peakRss - startRss;
+    return result;
+}
+
+/**
+ * @brief 子进程传回父进程的结果
+ */
+struct Outcome
+{
+    Result result;
+#if MEMPOOL_LATENCY_HISTOGRAM
+    LatencyStats latency;
+#endif
+};
+
+/**
+ * @brief 在fork的子进程中运行一个组合，结果通过管道传回
+ * @return bool 子进程正常退出并传回完整结果时返回true
+ *
+ * 父进程本身不分配，每个子进程都从同样的状态开始，之前的组合留在内存池或 malloc 中的内存不影响常驻内存
+ */
+bool runIsolated(const std::function<void(Context &)> &body, size_t threads, uint64_t ops, Outcome &outcome)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    fflush(nullptr);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        Outcome child{};
+        child.result = runScenario(body, threads, ops);
+#if MEMPOOL_LATENCY_HISTOGRAM
+        child.latency = ThreadCache::getLatencyStats();
+#endif
+        const char *data = reinterpret_cast<const char *>(&child);
+        size_t written = 0;
+        while (written < sizeof(child))
+        {
+            ssize_t n = write(fds[1], data + written, sizeof(child) - written);
+            if (n <= 0)
+                _exit(1);
+            written += static_cast<size_t>(n);
+        }
+        _exit(0);
+    }
+
+    close(fds[1]);
+    char *data = reinterpret_cast<char *>(&outcome);
+    size_t received = 0;
+    while (received < sizeof(outcome))
+    {
+        ssize_t n = read(fds[0], data + received, sizeof(outcome) - received);
+        if (n <= 0)
+            break;
+        received += static_cast<size_t>(n);
+    }
+    close(fds[0]);
+    int status = 0;
+    if (waitpid(pid, &status, 0) != pid)
+        return false;
+    return received == sizeof(outcome) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+std::vector<std::string> splitList(const std::string &value)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= value.size())
+    {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos)
+            end = value.size();
+        if (end > start)
+            items.push_back(value.substr(start, end - start));
+        start = end + 1;
+    }
+    return items;
+}
+
+void usage(const char *program)
+{
+    fprintf(stderr,
+            "用法: %s [--filter=子串] [--allocator=pool,malloc] [--threads=1,2,4] [--ops=每线程操作数] [--quick]\n"
+            "场景:",
+            program);
+    for (const std::string &name : SCENARIOS)
+    {
+        fprintf(stderr, " %s", name.c_str());
+    }
+    fprintf(stderr, "\n");
+}
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    std::string filter;
+    std::vector<std::string> allocators = {"pool", MEMPOOL_BENCH_MALLOC_NAME};
+    std::vector<size_t> threadCounts;
+    uint64_t ops = DEFAULT_OPS;
+    bool quick = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--filter=", 0) == 0)
+            filter = arg.substr(9);
+        else if (arg.rfind("--allocator=", 0) == 0)
+            allocators = splitList(arg.substr(12));
+        else if (arg.rfind("--threads=", 0) == 0)
+        {
+            for (const std::string &item : splitList(arg.substr(10)))
+            {
+                threadCounts.push_back(std::max<size_t>(1, std::stoul(item)));
+            }
+        }
+        else if (arg.rfind("--ops=", 0) == 0)
+            ops = std::max<uint64_t>(1000, std::stoull(arg.substr(6)));
+        else if (arg == "--quick")
+            quick = true;
+        else
+        {
+            usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (quick)
+        ops /= QUICK_DIVISOR;
+    // 默认从1个线程按2倍增加到CPU数量（至少到2个线程）
+    if (threadCounts.empty())
+    {
+        size_t maxThreads = std::max<size_t>(2, std::thread::hardware_concurrency());
+        for (size_t n = 1; n < maxThreads; n *= 2)
+        {
+            threadCounts.push_back(n);
+        }
+        threadCounts.push_back(maxThreads);
+    }
+
+    int statmFd = open("/proc/self/statm", O_RDONLY);
+    size_t startRss = readRss(statmFd);
+    if (statmFd >= 0)
+        close(statmFd);
+    printf("每线程操作数 %llu, 每 %llu 次操作记录一次延迟, 启动时常驻内存 %.1f MB\n",
+           static_cast<unsigned long long>(ops), static_cast<unsigned long long>(LATENCY_SAMPLE_EVERY),
+           static_cast<double>(startRss) / (1 << 20));
+    printf("%-16s %-10s %7s %12s %8s %8s %8s %11s %11s\n", "benchmark", "allocator", "threads", "ops/s", "p50_ns",
+           "p99_ns", "p999_ns", "peak_live", "peak_rss");
+
+    bool ran = false;
+#if MEMPOOL_LATENCY_HISTOGRAM
+    LatencyStats latency{};
+#endif
+    for (const std::string &name : SCENARIOS)
+    {
+        if (!filter.empty() && name.find(filter) == std::string::npos)
+            continue;
+        for (size_t threads : threadCounts)
+        {
+            for (const std::string &allocator : allocators)
+            {
+                std::function<void(Context &)> body;
+                if (allocator == "pool")
+                    body = scenarioBody<PoolBackend>(name);
+                else if (allocator == MEMPOOL_BENCH_MALLOC_NAME || allocator == "malloc")
+                    body = scenarioBody<MallocBackend>(name);
+                else
+                {
+                    fprintf(stderr, "未知的分配器 %s（可选 pool, %s）\n", allocator.c_str(), MEMPOOL_BENCH_MALLOC_NAME);
+                    return 1;
+                }
+                Outcome outcome{};
+                if (!runIsolated(body, threads, ops, outcome))
+                {
+                    fprintf(stderr, "%s %s %zu 线程运行失败\n", name.c_str(), allocator.c_str(), threads);
+                    return 1;
+                }
+#if MEMPOOL_LATENCY_HISTOGRAM
+                latency.add(outcome.latency);
+#endif
+                const Result &r = outcome.result;
+                printf("%-16s %-10s %7zu %12.0f %8u %8u %8u %9.1fMB %9.1fMB\n", name.c_str(), allocator.c_str(),
+                       threads, static_cast<double>(r.ops) / r.seconds, r.p50, r.p99, r.p999,
+                       static_cast<double>(r.peakLive) / (1 << 20), static_cast<double>(r.peakRss) / (1 << 20));
+                fflush(stdout);
+                ran = true;
+            }
+        }
+    }
+#if MEMPOOL_LATENCY_HISTOGRAM
+    // 所有子进程中内存池慢路径的延迟分布之和（malloc 后端不经过这些路径）
+    if (ran)
+        latency.print(stdout);
+#endif
+    if (!ran)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,1630 @@
+/**
+ * @file unit_test.cpp
+ * @brief 内存池功能测试程序
+ *
+ * 验证各层缓存的分配/释放行为是否正确，任何一项检查失败都以非0返回码退出
+ */
+
+#include "../inc/CentralCache.h"
+#include "../inc/Config.h"
+#include "../inc/Hardening.h"
+#include "../inc/HeapProfiler.h"
+#include "../inc/LatencyHistogram.h"
+#include "../inc/MonotonicRegion.h"
+#include "../inc/ObjectPool.h"
+#include "../inc/PoolAllocator.h"
+#include "../inc/SpinLock.h"
+#include "../inc/ThreadCache.h"
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <malloc.h>
+#include <new>
+#include <sched.h>
+#include <set>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static int g_failed = 0;
+
+// 按CPU划分的缓存生效时内存块不在线程缓存里，线程被迁移后也不一定复用同一个内存块
+static bool perCpuCache()
+{
+#if MEMPOOL_PERCPU_CACHE
+    return CpuCache::enabled();
+#else
+    return false;
+#endif
+}
+
+#define CHECK(cond)                                                                   \
+    do                                                                                \
+    {                                                                                 \
+        if (!(cond))                                                                  \
+        {                                                                             \
+            std::cerr << __FILE__ << ":" << __LINE__ << " 检查失败: " #cond << std::endl; \
+            ++g_failed;                                                               \
+        }                                                                             \
+    } while (0)
+
+// 每个大小都映射到能容纳它的最小大小类，且128B以上的内部碎片不超过1/8
+void testSizeClass()
+{
+    CHECK(FREE_LIST_SIZE <= 128);
+    for (size_t bytes = 1; bytes <= MAX_BYTES; bytes++)
+    {
+        size_t index = SizeClass::getIndex(bytes);
+        size_t size = SizeClass::getSize(index);
+        CHECK(size >= bytes);
+        CHECK(index == 0 || SizeClass::getSize(index - 1) < bytes);
+        if (bytes > SMALL_CLASS_MAX)
+        {
+            CHECK((size - bytes) * 8 <= size);
+        }
+        if (size < bytes || (index > 0 && SizeClass::getSize(index - 1) >= bytes))
+            break;
+    }
+    for (size_t index = 0; index < FREE_LIST_SIZE; index++)
+    {
+        CHECK(SizeClass::getSpanPages(index) * PAGE_SIZE >= SizeClass::getSize(index));
+        CHECK(SizeClass::getBatchNum(index) >= MIN_BATCH_NUM);
+    }
+}
+
+// 对象池分配的对象已经值初始化，释放后优先复用
+void testObjectPool()
+{
+    ObjectPool<Span> pool;
+    std::set<Span *> seen;
+    for (int i = 0; i < 10000; i++)
+    {
+        Span *span = pool.allocate();
+        CHECK(span != nullptr && span->PageAddr == nullptr && span->sizePages == 0 && !span->isUse);
+        CHECK(reinterpret_cast<uintptr_t>(span) % alignof(Span) == 0);
+        CHECK(seen.insert(span).second);
+        span->sizePages = i;
+    }
+    Span *last = *seen.begin();
+    pool.deallocate(last);
+    Span *again = pool.allocate();
+    CHECK(again == last && again->sizePages == 0);
+}
+
+// 页表可以通过Span内部任意地址找到Span，释放后的相邻Span会被合并复用
+void testPageCache()
+{
+    PageCache &pageCache = PageCache::GetInstance();
+    char *first = pageCache.allocateSpan<char>(size_t(3));
+    CHECK(first != nullptr);
+    CHECK(reinterpret_cast<uintptr_t>(first) % PAGE_SIZE == 0);
+    for (size_t offset = 0; offset < 3 * PAGE_SIZE; offset += 1000)
+    {
+        Span *span = pageCache.mapObjectToSpan(first + offset);
+        CHECK(span != nullptr && span->PageAddr == first && span->sizePages == 3);
+    }
+    int local = 0;
+    CHECK(pageCache.mapObjectToSpan(&local) == nullptr);
+
+    pageCache.deallocateSpan(first, size_t(3));
+    char *again = pageCache.allocateSpan<char>(size_t(3));
+    CHECK(again == first);
+    pageCache.deallocateSpan(again, size_t(3));
+}
+
+// 小Span释放后进入无锁槽位，同样页数的请求直接取回；重复释放被忽略，主动归还时合并回空闲链表
+void testReadySpans()
+{
+    PageCache &pageCache = PageCache::GetInstance();
+    pageCache.releaseFreeMemory();
+    std::vector<char *> spans;
+    for (int i = 0; i < 4; i++)
+    {
+        spans.push_back(pageCache.allocateSpan<char>(SPAN_PAGES));
+        CHECK(spans.back() != nullptr);
+    }
+    size_t freeBefore = pageCache.getFreeBytes();
+    for (char *ptr : spans)
+    {
+        pageCache.deallocateSpan(ptr, SPAN_PAGES);
+        Span *span = pageCache.mapObjectToSpan(ptr);
+        CHECK(span->isUse && span->isReady && span->objSize == 0);
+        // 槽位中的Span每一页仍然记录在页表中
+        CHECK(pageCache.mapObjectToSpan(ptr + SPAN_PAGES * PAGE_SIZE - 1) == span);
+    }
+    CHECK(pageCache.getFreeBytes() == freeBefore + spans.size() * SPAN_PAGES * PAGE_SIZE);
+    pageCache.deallocateSpan(spans[0], SPAN_PAGES);
+
+    std::set<char *> expect(spans.begin(), spans.end());
+    std::set<char *> again;
+    for (size_t i = 0; i < spans.size(); i++)
+    {
+        char *ptr = pageCache.allocateSpan<char>(SPAN_PAGES);
+        CHECK(ptr != nullptr && !pageCache.mapObjectToSpan(ptr)->isReady);
+        again.insert(ptr);
+    }
+    CHECK(again == expect);
+
+    for (char *ptr : spans)
+    {
+        pageCache.deallocateSpan(ptr, SPAN_PAGES);
+    }
+    pageCache.releaseFreeMemory();
+    // 合并回空闲链表并归还物理内存，页表中的记录变成空闲Span（或被合并后只剩边界页）
+    CHECK(pageCache.getFreeBytes() == 0);
+    for (char *ptr : spans)
+    {
+        Span *span = pageCache.mapObjectToSpan(ptr);
+        CHECK(!span || (!span->isUse && !span->isReady));
+    }
+
+    // 多个线程同时分配、释放同样页数的Span，同一时刻每个Span只属于一个线程
+    constexpr int THREADS = 4;
+    std::atomic<int> overlaps{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++)
+    {
+        threads.emplace_back([&pageCache, &overlaps, t]() {
+            std::vector<char *> held;
+            for (int i = 0; i < 2000; i++)
+            {
+                char *ptr = pageCache.allocateSpan<char>(SPAN_PAGES);
+                if (!ptr)
+                    continue;
+                ptr[0] = static_cast<char>(t);
+                ptr[SPAN_PAGES * PAGE_SIZE - 1] = static_cast<char>(t);
+                held.push_back(ptr);
+                if (held.size() > 3 || i % 3 == 0)
+                {
+                    char *old = held.front();
+                    held.erase(held.begin());
+                    if (old[0] != static_cast<char>(t) || old[SPAN_PAGES * PAGE_SIZE - 1] != static_cast<char>(t))
+                        overlaps.fetch_add(1);
+                    pageCache.deallocateSpan(old, SPAN_PAGES);
+                }
+            }
+            for (char *ptr : held)
+            {
+                pageCache.deallocateSpan(ptr, SPAN_PAGES);
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    CHECK(overlaps.load() == 0);
+}
+
+// 前后相邻的空闲Span都会被合并
+void testCoalesce()
+{
+    PageCache &pageCache = PageCache::GetInstance();
+    // 一次申请300页再切成三段，保证三段在地址上连续（页数较大，不会用到之前测试留下的空闲Span）
+    char *base = pageCache.allocateSpan<char>(size_t(300));
+    pageCache.deallocateSpan(base, size_t(300));
+    char *a = pageCache.allocateSpan<char>(size_t(100));
+    char *b = pageCache.allocateSpan<char>(size_t(100));
+    char *c = pageCache.allocateSpan<char>(size_t(100));
+    CHECK(a == base && b == base + 100 * PAGE_SIZE && c == base + 200 * PAGE_SIZE);
+
+    pageCache.deallocateSpan(a, size_t(100));
+    pageCache.deallocateSpan(c, size_t(100));
+    // 释放中间一段时同时向前、向后合并成一个300页的Span
+    pageCache.deallocateSpan(b, size_t(100));
+    Span *span = pageCache.mapObjectToSpan(base);
+    // 大页模式下三段还会和所在区域的剩余部分合并，只要求合并后的Span覆盖这300页
+    CHECK(span != nullptr && !span->isUse && span->PageAddr <= base);
+    CHECK(span != nullptr && static_cast<char *>(span->PageAddr) + span->sizePages * PAGE_SIZE >= base + 300 * PAGE_SIZE);
+}
+
+// 空闲Span的物理页可以归还操作系统，归还后的Span仍然可以再次分配使用
+void testRelease()
+{
+    PageCache &pageCache = PageCache::GetInstance();
+    constexpr size_t pages = 200;
+    char *ptr = pageCache.allocateSpan<char>(pages);
+    CHECK(ptr != nullptr);
+    memset(ptr, 0x7F, pages * PAGE_SIZE);
+    pageCache.deallocateSpan(ptr, pages);
+    CHECK(pageCache.getFreeBytes() >= pages * PAGE_SIZE);
+
+    CHECK(pageCache.releaseFreeMemory() >= pages * PAGE_SIZE);
+    CHECK(pageCache.getFreeBytes() == 0);
+    CHECK(pageCache.getReleasedBytes() >= pages * PAGE_SIZE);
+    // MADV_DONTNEED 之后这些页不再驻留内存
+    std::vector<unsigned char> resident(pages);
+    CHECK(mincore(ptr, pages * PAGE_SIZE, resident.data()) == 0);
+    size_t residentPages = 0;
+    for (unsigned char page : resident)
+    {
+        residentPages += page & 1;
+    }
+    CHECK(residentPages == 0);
+
+    char *again = pageCache.allocateSpan<char>(pages);
+    CHECK(again != nullptr);
+    memset(again, 0x3C, pages * PAGE_SIZE);
+    pageCache.deallocateSpan(again, pages);
+
+    // 后台线程只能启动一个，停止后可以再次启动
+    CHECK(pageCache.startScavenger(10));
+    CHECK(!pageCache.startScavenger(10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    pageCache.stopScavenger();
+    CHECK(pageCache.startScavenger(10));
+    pageCache.stopScavenger();
+}
+
+// 大Span按最佳适配分配；超大对象单独映射，释放后缓存复用，主动归还时才munmap
+void testLargeSpans()
+{
+    // 最佳适配：页数不少于请求的最小Span，页数相同时取地址最低的
+    std::vector<Span> spans(200);
+    SpanTree tree;
+    for (size_t i = 0; i < spans.size(); i++)
+    {
+        spans[i].PageAddr = reinterpret_cast<void *>((1000 + (i * 7919) % 200) * PAGE_SIZE);
+        spans[i].sizePages = MAX_FREE_PAGES + 1 + (i * 31) % 50;
+        tree.insert(&spans[i]);
+    }
+    for (size_t want = MAX_FREE_PAGES; want <= MAX_FREE_PAGES + 60; want++)
+    {
+        Span *expect = nullptr;
+        for (Span &span : spans)
+        {
+            if (span.sizePages >= want &&
+                (!expect || span.sizePages < expect->sizePages ||
+                 (span.sizePages == expect->sizePages && span.PageAddr < expect->PageAddr)))
+                expect = &span;
+        }
+        CHECK(tree.lowerBound(want) == expect);
+        // 取走后下一次得到次优的Span
+        if (expect)
+        {
+            tree.erase(expect);
+            expect->sizePages = 0;
+        }
+    }
+    for (Span &span : spans)
+    {
+        if (span.sizePages)
+            tree.erase(&span);
+    }
+    CHECK(tree.empty());
+
+    PageCache &pageCache = PageCache::GetInstance();
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+    constexpr size_t big = 10 * 1024 * 1024;
+    char *direct = threadCache->allocate<char>(big);
+    CHECK(direct != nullptr);
+    memset(direct, 0x42, big);
+    Span *span = pageCache.mapObjectToSpan(direct + big - 1);
+    CHECK(span != nullptr && span->isDirect && span->objSize >= big);
+    threadCache->deallocate(direct);
+    char *again = threadCache->allocate<char>(big - 1024 * 1024);
+    CHECK(again == direct);
+    threadCache->deallocate(again);
+
+    pageCache.releaseFreeMemory();
+    CHECK(pageCache.mapObjectToSpan(direct) == nullptr);
+
+    // 向上取整到页会回绕的大小直接失败，不会变成很小的分配
+    CHECK(threadCache->allocate<char>(SIZE_MAX) == nullptr);
+    CHECK(threadCache->allocate<char>(SIZE_MAX - PAGE_SIZE / 2) == nullptr);
+    void *out[2] = {};
+    CHECK(threadCache->allocateBatch(SIZE_MAX - 1, 2, out) == 0 && out[0] == nullptr);
+}
+
+// 每个节点有自己的页缓存和中心缓存，释放时回到Span所属的节点
+void testNumaNodes()
+{
+    CHECK(Numa::nodeCount() >= 1 && Numa::nodeCount() <= MAX_NUMA_NODES);
+    CHECK(Numa::currentNode() < Numa::nodeCount());
+    CHECK(&PageCache::GetInstance() == &PageCache::forNode(Numa::currentNode()));
+
+    // 单节点的机器上也可以使用1号节点的实例，验证跨节点释放的路由
+    PageCache &local = PageCache::forNode(0);
+    PageCache &remote = PageCache::forNode(1);
+    CHECK(remote.getNode() == 1 && &local != &remote);
+    // 页数超过无锁槽位的范围，释放后直接回到空闲链表
+    constexpr size_t pages = READY_SPAN_MAX_PAGES + 5;
+    char *ptr = remote.allocateSpan<char>(pages);
+    Span *span = PageCache::mapObjectToSpan(ptr);
+    CHECK(span != nullptr && span->node == 1);
+    local.deallocateSpan(ptr, pages);
+    CHECK(!span->isUse && span->node == 1);
+    char *again = remote.allocateSpan<char>(pages);
+    CHECK(again == ptr);
+    remote.deallocateSpan(again, pages);
+
+    size_t index = SizeClass::getIndex(512);
+    size_t actualNum = 0;
+    void *head = CentralCache::forNode(1).fetchRange<void>(index, size_t(3), actualNum);
+    CHECK(head != nullptr && PageCache::mapObjectToSpan(head)->node == 1);
+    Span *objSpan = PageCache::mapObjectToSpan(head);
+    size_t used = objSpan->useCount;
+    CentralCache::forNode(0).returnRange(head, actualNum, index);
+    CHECK(!objSpan->isUse || objSpan->useCount == used - actualNum);
+
+    // 从0号节点整批归还1号节点的内存块：批次回到1号节点的传输缓存，不进入0号节点的
+    // 一个Span的内存块多于一个批次，一次就能取到完整的批次
+    index = SizeClass::getIndex(64);
+    size_t batchNum = SizeClass::getBatchNum(index);
+    void *batch = CentralCache::forNode(1).fetchRange<void>(index, batchNum, actualNum);
+    CHECK(batch != nullptr && actualNum == batchNum);
+    CentralCache::forNode(0).returnRange(batch, actualNum, index);
+    void *nodeZero = CentralCache::forNode(0).fetchRange<void>(index, batchNum, actualNum);
+    size_t nodeZeroNum = actualNum;
+    bool allNodeZero = nodeZero != nullptr;
+    for (void *block = nodeZero; block; block = FreeList::next(block))
+    {
+        allNodeZero = allNodeZero && PageCache::mapObjectToSpan(block)->node == 0;
+    }
+    CHECK(allNodeZero);
+    CentralCache::forNode(0).returnRange(nodeZero, nodeZeroNum, index);
+    void *refetched = CentralCache::forNode(1).fetchRange<void>(index, batchNum, actualNum);
+    CHECK(refetched == batch && actualNum == batchNum);
+    CentralCache::forNode(1).returnRange(refetched, actualNum, index);
+}
+
+// 中心缓存中一个Span的内存块全部归还后，Span整体还给页缓存
+void testSpanReturn()
+{
+    CentralCache &centralCache = CentralCache::getInstance();
+    size_t index = SizeClass::getIndex(4096);
+    size_t batchNum = SizeClass::getBatchNum(index);
+    size_t actualNum = 0;
+    void *head = centralCache.fetchRange<void>(index, batchNum, actualNum);
+    CHECK(head != nullptr && actualNum > 0);
+    Span *span = PageCache::GetInstance().mapObjectToSpan(head);
+    CHECK(span->isUse && span->useCount >= actualNum);
+
+    bool wholeSpan = span->useCount == actualNum;
+    // 分两次归还，不满一个批次，不会进入传输缓存
+    void *rest = FreeList::next(head);
+    FreeList::setNext(head, nullptr);
+    centralCache.returnRange(head, size_t(1), index);
+    centralCache.returnRange(rest, actualNum - 1, index);
+    if (wholeSpan)
+    {
+        CHECK(!span->isUse || span->sizeClass != index);
+    }
+}
+
+// 新的Span按地址顺序切出内存块；连续取空Span的大小类由补充线程预先准备Span
+void testLazyCarve()
+{
+    CentralCache &centralCache = CentralCache::forNode(1);
+    size_t index = SizeClass::getIndex(1024);
+    size_t size = SizeClass::getSize(index);
+    size_t blocks = SizeClass::getSpanPages(index) * PAGE_SIZE / size;
+    CHECK(blocks > 2);
+
+    size_t actualNum = 0;
+    char *first = centralCache.fetchRange<char>(index, size_t(2), actualNum);
+    CHECK(first != nullptr && actualNum == 2);
+    Span *span = PageCache::mapObjectToSpan(first);
+    CHECK(first == span->PageAddr && FreeList::next(first) == first + size);
+    CHECK(FreeList::next(first + size) == nullptr);
+    CHECK(span->bumpNext == first + 2 * size && span->useCount == 2);
+
+    // 连续取空两个Span，第二个Span紧接着第一个被取空，大小类被标记为需要补充
+    size_t restNum = 0;
+    void *rest = centralCache.fetchRange<void>(index, blocks, restNum);
+    CHECK(restNum == blocks - 2 && span->bumpNext == span->bumpEnd);
+    size_t secondNum = 0;
+    void *second = centralCache.fetchRange<void>(index, blocks, secondNum);
+    CHECK(second != nullptr && secondNum == blocks);
+
+    MemoryPoolStats before;
+    centralCache.collectStats(before);
+    CHECK(centralCache.refillHotClasses() == 1);
+    CHECK(centralCache.refillHotClasses() == 0);
+    MemoryPoolStats after;
+    centralCache.collectStats(after);
+    CHECK(after.classes[index].spans == before.classes[index].spans + 1);
+
+    centralCache.returnRange(first, actualNum, index);
+    centralCache.returnRange(rest, restNum, index);
+    centralCache.returnRange(second, secondNum, index);
+
+    CHECK(CentralCache::startRefiller(1));
+    CHECK(!CentralCache::startRefiller(1));
+    CentralCache::stopRefiller();
+    CHECK(CentralCache::startRefiller(1));
+    CentralCache::stopRefiller();
+}
+
+// 线程数超过CPU数量时，自旋后休眠的锁仍然互斥，并且不会丢失唤醒
+void testSpinLock()
+{
+    static_assert(sizeof(SpinLock) == 64, "每个锁独占一个缓存行");
+    SpinLock lock;
+    CHECK(lock.try_lock() && !lock.try_lock());
+    lock.unlock();
+
+    constexpr int THREADS = 8;
+    constexpr int COUNT = 20000;
+    long counter = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++)
+    {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < COUNT; i++)
+            {
+                std::lock_guard<SpinLock> guard(lock);
+                counter++;
+                // 偶尔在持锁时让出CPU，让等待者进入休眠
+                if (i % 1000 == 0)
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    CHECK(counter == static_cast<long>(THREADS) * COUNT);
+}
+
+// 完整批次经过传输缓存整批交换，取回的就是刚放入的那一批
+void testTransferCache()
+{
+    CentralCache &centralCache = CentralCache::getInstance();
+    size_t index = SizeClass::getIndex(64);
+    size_t batchNum = SizeClass::getBatchNum(index);
+    size_t actualNum = 0;
+    void *head = centralCache.fetchRange<void>(index, batchNum, actualNum);
+    CHECK(head != nullptr && actualNum == batchNum);
+    centralCache.returnRange(head, actualNum, index);
+
+    size_t againNum = 0;
+    void *again = centralCache.fetchRange<void>(index, batchNum, againNum);
+    CHECK(again == head && againNum == batchNum);
+    size_t count = 0;
+    for (void *node = again; node; node = FreeList::next(node))
+    {
+        count++;
+    }
+    CHECK(count == batchNum);
+    centralCache.returnRange(again, againNum, index);
+}
+
+// 冷启动时的分配也必须成功，并且返回的内存块互不重叠
+void testColdAllocation()
+{
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+    std::vector<size_t> sizes = {1, 8, 13, 64, 100, 1024, 4000, 32 * 1024, 100 * 1024, MAX_BYTES};
+
+    for (size_t size : sizes)
+    {
+        std::set<uintptr_t> seen;
+        std::vector<void *> ptrs;
+        for (int i = 0; i < 200; i++)
+        {
+            void *ptr = threadCache->allocate<void>(size);
+            CHECK(ptr != nullptr);
+            if (!ptr)
+                continue;
+            CHECK(reinterpret_cast<uintptr_t>(ptr) % ALIGNMENT == 0);
+            CHECK(seen.insert(reinterpret_cast<uintptr_t>(ptr)).second);
+            memset(ptr, 0x5A, size);
+            ptrs.push_back(ptr);
+        }
+        for (void *ptr : ptrs)
+        {
+            threadCache->deallocate(ptr, size);
+        }
+    }
+}
+
+// 释放后的内存块会被同一线程优先复用
+void testReuse()
+{
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+    void *first = threadCache->allocate<void>(size_t(48));
+    threadCache->deallocate(first, size_t(48));
+    void *second = threadCache->allocate<void>(size_t(48));
+    CHECK(first == second || perCpuCache());
+    threadCache->deallocate(second, size_t(48));
+}
+
+// 不提供大小的释放：大小类由Span记录，大对象整页归还后可以再次复用
+void testSizeFreeDeallocate()
+{
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+    std::vector<size_t> sizes = {8, 24, 200, 3000, 70000, MAX_BYTES + 1, 3 * MAX_BYTES};
+    for (size_t size : sizes)
+    {
+        void *ptr = threadCache->allocate<void>(size);
+        CHECK(ptr != nullptr);
+        memset(ptr, 0x11, size);
+        Span *span = PageCache::GetInstance().mapObjectToSpan(ptr);
+        CHECK(span != nullptr && span->objSize >= size);
+        if (size <= MAX_BYTES)
+        {
+            CHECK(span->objSize == SizeClass::roundUp(Hardening::taggedSize(size)));
+        }
+        threadCache->deallocate(ptr);
+        void *again = threadCache->allocate<void>(size);
+        CHECK(again == ptr || (perCpuCache() && size <= MAX_BYTES));
+        threadCache->deallocate(again);
+    }
+    // 空指针和不属于内存池的地址被忽略（加固模式下后者报告错误，见 testHardening）
+    threadCache->deallocate(static_cast<void *>(nullptr));
+#if !MEMPOOL_HARDENED
+    int local = 0;
+    threadCache->deallocate(&local);
+#endif
+
+    // 在一个线程分配，在另一个线程只凭指针释放
+    std::vector<void *> ptrs;
+    for (size_t i = 0; i < 1000; i++)
+    {
+        ptrs.push_back(threadCache->allocate<void>(16 + i * 13));
+    }
+    std::thread([&ptrs]() {
+        for (void *ptr : ptrs)
+        {
+            ThreadCache::getThreadCache()->deallocate(ptr);
+        }
+    }).join();
+}
+
+// 生产者分配、消费者释放：内存块通过远程队列回到生产者，下一次分配时被复用
+void testRemoteFree()
+{
+    constexpr size_t COUNT = 200;
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+    std::vector<void *> ptrs;
+    for (size_t i = 0; i < COUNT; i++)
+    {
+        ptrs.push_back(threadCache->allocate<void>(size_t(72)));
+    }
+    std::thread([&ptrs]() {
+        ThreadCache *consumer = ThreadCache::getThreadCache();
+        for (void *ptr : ptrs)
+        {
+            consumer->deallocate(ptr);
+        }
+        CHECK(consumer->getCachedBytes() == 0 || perCpuCache());
+    }).join();
+
+    std::set<void *> reused;
+    std::vector<void *> again;
+    for (size_t i = 0; i < 2 * COUNT; i++)
+    {
+        void *ptr = threadCache->allocate<void>(size_t(72));
+        again.push_back(ptr);
+        reused.insert(ptr);
+    }
+    for (void *ptr : ptrs)
+    {
+        CHECK(reused.count(ptr) == 1 || perCpuCache());
+    }
+    for (void *ptr : again)
+    {
+        threadCache->deallocate(ptr, size_t(72));
+    }
+}
+
+// 第一个取内存块的线程缓存拥有Span；其他线程缓存从Span上或经传输缓存取走内存块后Span变为共用
+void testSpanOwner()
+{
+    CentralCache &centralCache = CentralCache::forNode(1);
+    size_t index = SizeClass::getIndex(128);
+    size_t batchNum = SizeClass::getBatchNum(index);
+    int first = 0;
+    int second = 0;
+
+    size_t actualNum = 0;
+    void *a = centralCache.fetchRange<void>(index, size_t(2), actualNum, static_cast<void *>(&first));
+    CHECK(a != nullptr && actualNum == 2);
+    Span *span = PageCache::mapObjectToSpan(a);
+    CHECK(span->owner.load() == &first);
+    size_t secondNum = 0;
+    void *b = centralCache.fetchRange<void>(index, size_t(2), secondNum, static_cast<void *>(&first));
+    CHECK(PageCache::mapObjectToSpan(b) == span && span->owner.load() == &first);
+    size_t sharedNum = 0;
+    void *c = centralCache.fetchRange<void>(index, size_t(2), sharedNum, static_cast<void *>(&second));
+    CHECK(PageCache::mapObjectToSpan(c) == span && span->owner.load() == Span::sharedOwner());
+    centralCache.returnRange(a, actualNum, index);
+    centralCache.returnRange(b, secondNum, index);
+    centralCache.returnRange(c, sharedNum, index);
+
+    // 整批放入传输缓存，另一个线程缓存整批取走；这个大小类一个批次正好是一个新的Span
+    index = SizeClass::getIndex(256);
+    batchNum = SizeClass::getBatchNum(index);
+    void *batch = centralCache.fetchRange<void>(index, batchNum, actualNum, static_cast<void *>(&first));
+    CHECK(batch != nullptr && actualNum == batchNum);
+    Span *batchSpan = PageCache::mapObjectToSpan(batch);
+    CHECK(batchSpan->owner.load() == &first);
+    centralCache.returnRange(batch, actualNum, index);
+    void *taken = centralCache.fetchRange<void>(index, batchNum, actualNum, static_cast<void *>(&second));
+    CHECK(taken == batch && batchSpan->owner.load() == Span::sharedOwner());
+    centralCache.returnRange(taken, actualNum, index);
+}
+
+// 线程退出时线程缓存被清空并注销，flushAll 立即清空当前线程的缓存
+void testThreadExitFlush()
+{
+    size_t before = ThreadCache::getThreadCacheCount();
+    size_t cached = 0;
+    std::thread([&cached]() {
+        ThreadCache *threadCache = ThreadCache::getThreadCache();
+        std::vector<void *> ptrs;
+        for (int i = 0; i < 500; i++)
+        {
+            ptrs.push_back(threadCache->allocate<void>(size_t(96)));
+        }
+        for (void *ptr : ptrs)
+        {
+            threadCache->deallocate(ptr, size_t(96));
+        }
+        cached = threadCache->getCachedBytes();
+    }).join();
+    CHECK(cached > 0 || perCpuCache());
+    CHECK(ThreadCache::getThreadCacheCount() == before);
+
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+    void *ptr = threadCache->allocate<void>(size_t(96));
+    threadCache->deallocate(ptr, size_t(96));
+    CHECK(threadCache->getCachedBytes() > 0 || perCpuCache());
+    CHECK(ThreadCache::flushAll() >= 1);
+    CHECK(threadCache->getCachedBytes() == 0);
+}
+
+// 对齐分配：不超过一页的对齐走普通大小类，更大的对齐按整页分配
+void testAlignedAllocate()
+{
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+    for (size_t align = 1; align <= 64 * PAGE_SIZE; align *= 2)
+    {
+        std::vector<void *> ptrs;
+        for (size_t size : {size_t(1), size_t(7), size_t(64), size_t(100), size_t(3000), 5 * PAGE_SIZE, MAX_BYTES})
+        {
+            void *ptr = threadCache->allocateAligned<void>(size, align);
+            CHECK(ptr != nullptr && reinterpret_cast<uintptr_t>(ptr) % align == 0);
+            memset(ptr, 0x66, size);
+            ptrs.push_back(ptr);
+        }
+        for (void *ptr : ptrs)
+        {
+            threadCache->deallocate(ptr);
+        }
+    }
+    CHECK(threadCache->allocateAligned<void>(100, 48) == nullptr);
+    // 超过 SIZE_MAX / 2 的对齐不可能满足，大小和对齐相加会溢出
+    CHECK(threadCache->allocateAligned<void>(100, SIZE_MAX / 2 + 1) == nullptr);
+    CHECK(threadCache->allocateAligned<void>(SIZE_MAX / 2, PAGE_SIZE * 2) == nullptr);
+    // 不超过一页的对齐与普通分配使用同一个大小类
+    void *ptr = threadCache->allocateAligned<void>(100, 64);
+    CHECK(PageCache::GetInstance().mapObjectToSpan(ptr)->objSize == SizeClass::roundUp(Hardening::taggedSize(128)));
+    threadCache->deallocate(ptr);
+}
+
+// realloc：能原地调整时返回原指针，数据在调整前后保持不变
+// 请求 bytes 字节的大对象占用的字节数，加固模式下包括末尾的标记
+static size_t largeBytes(size_t bytes) { return (bytes + HARDENED_TAG_BYTES + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE; }
+
+void testReallocate()
+{
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+    CHECK(ThreadCache::usableSize(nullptr) == 0);
+    int local = 0;
+    CHECK(ThreadCache::usableSize(&local) == 0);
+    CHECK(threadCache->reallocate(&local, 16) == nullptr);
+
+    // 小对象在同一个大小类内调整大小不移动
+    char *small = threadCache->reallocate<char>(nullptr, 100);
+    CHECK(small != nullptr && ThreadCache::usableSize(small) == 104);
+    memset(small, 0x21, 100);
+    CHECK(threadCache->reallocate(small, 104) == small);
+    char *moved = threadCache->reallocate(small, 1000);
+    CHECK(moved != nullptr && moved[0] == 0x21 && moved[99] == 0x21);
+    CHECK(ThreadCache::usableSize(moved) >= 1000);
+    CHECK(threadCache->reallocate(moved, 0) == nullptr);
+
+    // 保护页开启时大对象后面总是不可访问的页，不原地变大
+    if (MemoryPoolConfig::get().guardPages)
+        return;
+
+    // 后面的页空闲时大对象原地变大：先找到两个相邻的Span，释放后一个
+    std::vector<char *> held;
+    char *large = nullptr;
+    for (int i = 0; i < 16 && !large; i++)
+    {
+        char *first = threadCache->allocate<char>(80 * PAGE_SIZE);
+        char *second = threadCache->allocate<char>(80 * PAGE_SIZE);
+        if (second == first + largeBytes(80 * PAGE_SIZE))
+        {
+            large = first;
+            threadCache->deallocate(second);
+        }
+        else
+        {
+            held.push_back(first);
+            held.push_back(second);
+        }
+    }
+    for (char *ptr : held)
+    {
+        threadCache->deallocate(ptr);
+    }
+    CHECK(large != nullptr);
+    if (!large)
+        return;
+    memset(large, 0x42, 80 * PAGE_SIZE);
+    char *grown = threadCache->reallocate(large, 120 * PAGE_SIZE);
+    CHECK(grown == large && ThreadCache::usableSize(grown) == largeBytes(120 * PAGE_SIZE) - HARDENED_TAG_BYTES);
+    CHECK(grown[80 * PAGE_SIZE - 1] == 0x42);
+    memset(grown, 0x42, 120 * PAGE_SIZE);
+    // 变小不到一半时保持不动
+    CHECK(threadCache->reallocate(grown, 70 * PAGE_SIZE) == grown);
+
+    // 单独mmap的大对象通过 mremap 变大，数据保持不变
+    char *direct = threadCache->reallocate(grown, DIRECT_MMAP_BYTES);
+    CHECK(direct != nullptr && direct[0] == 0x42 && direct[120 * PAGE_SIZE - 1] == 0x42);
+    memset(direct, 0x43, DIRECT_MMAP_BYTES);
+    char *remapped = threadCache->reallocate(direct, 3 * DIRECT_MMAP_BYTES);
+    CHECK(remapped != nullptr &&
+          ThreadCache::usableSize(remapped) == largeBytes(3 * DIRECT_MMAP_BYTES) - HARDENED_TAG_BYTES);
+    CHECK(remapped[0] == 0x43 && remapped[DIRECT_MMAP_BYTES - 1] == 0x43);
+    CHECK(PageCache::GetInstance().mapObjectToSpan(remapped)->PageAddr == remapped);
+    memset(remapped, 0x44, 3 * DIRECT_MMAP_BYTES);
+    threadCache->deallocate(remapped);
+}
+
+// 运行时配置的解析；线程缓存的字节数不超过自己的上限，频繁释放的线程上限会增长
+void testConfig()
+{
+    MemoryPoolConfig config;
+    CHECK(MemoryPoolConfig::parse("thread_cache_max=2MB,max_list_length=1024,release_rate=0,sample_rate=512k", config));
+    CHECK(config.threadCacheBytes == 2 * 1024 * 1024 && config.maxListLength == 1024);
+    CHECK(config.releaseRate == 0 && config.sampleRate == 512 * 1024);
+    CHECK(config.retainBytes == RETAIN_BYTES);
+    CHECK(MemoryPoolConfig::parse("", config) && MemoryPoolConfig::parse(nullptr, config));
+    CHECK(config.maxListLength == 1024);
+    CHECK(MemoryPoolConfig::parse("direct_mmap=1g", config) && config.directMmapBytes == size_t(1) << 30);
+    // 任何一项出错时整个字符串都不生效
+    CHECK(!MemoryPoolConfig::parse("max_list_length=8,unknown=1", config) && config.maxListLength == 1024);
+    CHECK(!MemoryPoolConfig::parse("max_list_length=", config));
+    CHECK(!MemoryPoolConfig::parse("max_list_length=0", config));
+    CHECK(!MemoryPoolConfig::parse("thread_cache_max=3XB", config));
+    CHECK(!MemoryPoolConfig::parse("thread_cache_max", config));
+    CHECK(!MemoryPoolConfig::parse("thread_cache_max=99999999999999999999", config));
+    // 内存池已经在使用，配置不再改变
+    CHECK(!MemoryPoolConfig::configure(config));
+
+    std::thread worker([]() {
+        ThreadCache *threadCache = ThreadCache::getThreadCache();
+        CHECK(threadCache->getMaxCachedBytes() == THREAD_CACHE_MIN_BYTES);
+        std::vector<void *> ptrs;
+        for (size_t round = 0; round < 8; round++)
+        {
+            for (size_t i = 0; i < 1024; i++)
+            {
+                ptrs.push_back(threadCache->allocate<void>(4096));
+            }
+            for (void *ptr : ptrs)
+            {
+                threadCache->deallocate(ptr, 4096);
+                CHECK(threadCache->getCachedBytes() <= threadCache->getMaxCachedBytes());
+            }
+            ptrs.clear();
+        }
+        CHECK(threadCache->getMaxCachedBytes() <= THREAD_CACHE_MAX_BYTES);
+        // 预算没有被 MEMPOOL_CONF 调小时还有剩余，可以增长
+        if (!perCpuCache() && MemoryPoolConfig::get().threadCacheBytes >= THREAD_CACHE_BYTES)
+            CHECK(threadCache->getMaxCachedBytes() > THREAD_CACHE_MIN_BYTES);
+    });
+    worker.join();
+}
+
+#if MEMPOOL_HARDENED
+// 在子进程中执行 body，子进程被 signal 信号结束时返回true
+static bool diesInChild(void (*body)(), int signal)
+{
+    fflush(nullptr);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int devNull = open("/dev/null", O_WRONLY);
+        if (devNull >= 0)
+            dup2(devNull, STDERR_FILENO);
+        body();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFSIGNALED(status) && WTERMSIG(status) == signal;
+}
+#endif
+
+// 空闲链表指针的读写；加固模式下重复释放、越界写、释放后写入和无效指针都会结束进程
+void testHardening()
+{
+    void *slots[2] = {};
+    FreeList::setNext(&slots[0], &slots[1]);
+    FreeList::setNext(&slots[1], nullptr);
+    CHECK(FreeList::next(&slots[0]) == &slots[1] && FreeList::next(&slots[1]) == nullptr);
+    // 加上标记之后仍然保持原来大小的对齐
+    CHECK(Hardening::taggedSize(64) % 64 == 0 && Hardening::taggedSize(64) >= 64 + HARDENED_TAG_BYTES);
+    CHECK(Hardening::taggedSize(48) % 16 == 0 && Hardening::taggedSize(24) % 8 == 0);
+
+    // 可用大小不包括末尾的标记，全部写满后正常释放
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+    for (size_t size : {size_t(1), size_t(100), size_t(4096), MAX_BYTES, MAX_BYTES + 1})
+    {
+        char *ptr = threadCache->allocate<char>(size);
+        size_t usable = ThreadCache::usableSize(ptr);
+        CHECK(ptr != nullptr && usable >= size);
+        memset(ptr, 0x5a, usable);
+        threadCache->deallocate(ptr);
+    }
+
+#if MEMPOOL_HARDENED
+    void (*doubleFree)() = []() {
+        ThreadCache *cache = ThreadCache::getThreadCache();
+        void *ptr = cache->allocate<void>(64);
+        cache->deallocate(ptr);
+        cache->deallocate(ptr);
+    };
+    void (*sizedDoubleFree)() = []() {
+        ThreadCache *cache = ThreadCache::getThreadCache();
+        void *ptr = cache->allocate<void>(200);
+        cache->deallocate(ptr, 200);
+        cache->deallocate(ptr, 200);
+    };
+    void (*overflow)() = []() {
+        ThreadCache *cache = ThreadCache::getThreadCache();
+        char *ptr = cache->allocate<char>(100);
+        memset(ptr, 0, ThreadCache::usableSize(ptr) + 1);
+        cache->deallocate(ptr);
+    };
+    void (*interiorFree)() = []() {
+        ThreadCache *cache = ThreadCache::getThreadCache();
+        char *ptr = cache->allocate<char>(100);
+        cache->deallocate(ptr + 16);
+    };
+    void (*foreignFree)() = []() {
+        int local = 0;
+        ThreadCache::getThreadCache()->deallocate(&local);
+    };
+    void (*useAfterFree)() = []() {
+        ThreadCache *cache = ThreadCache::getThreadCache();
+        char *first = cache->allocate<char>(64);
+        char *second = cache->allocate<char>(64);
+        cache->deallocate(second, 64);
+        cache->deallocate(first, 64);
+        // first 在自由链表头部，它的链接指针被清零后，再分配一次就会解码出错误的地址
+        memset(first, 0, sizeof(void *));
+        cache->allocate<void>(64);
+        cache->allocate<void>(64);
+    };
+    CHECK(diesInChild(doubleFree, SIGABRT));
+    CHECK(diesInChild(sizedDoubleFree, SIGABRT));
+    CHECK(diesInChild(overflow, SIGABRT));
+    CHECK(diesInChild(interiorFree, SIGABRT));
+    CHECK(diesInChild(foreignFree, SIGABRT));
+    // 按CPU划分的缓存用数组保存内存块，不经过链接指针
+    if (!perCpuCache())
+        CHECK(diesInChild(useAfterFree, SIGABRT));
+    if (MemoryPoolConfig::get().guardPages)
+    {
+        void (*pastLarge)() = []() {
+            char *ptr = ThreadCache::getThreadCache()->allocate<char>(MAX_BYTES + 1);
+            ptr[ThreadCache::usableSize(ptr) + HARDENED_TAG_BYTES] = 1;
+        };
+        CHECK(diesInChild(pastLarge, SIGSEGV));
+    }
+#endif
+}
+
+// 预热配置的解析；预热之后再分配同样多的内存块不需要向系统申请新的内存
+void testWarmup()
+{
+    size_t entries = 0;
+    size_t total = 0;
+    auto visit = [&](size_t size, size_t count) {
+        entries++;
+        total += size * count;
+    };
+    CHECK(MemoryPoolConfig::parseWarmup("64=1000,4K=2", visit));
+    CHECK(entries == 2 && total == 64 * 1000 + 8192);
+    CHECK(MemoryPoolConfig::parseWarmup(nullptr, visit) && entries == 2);
+    const char *invalid[] = {"64", "64=", "=8", "64=1x", "64=1,,", "64=1;128=2", "64=1,bad"};
+    for (const char *spec : invalid)
+    {
+        CHECK(!MemoryPoolConfig::parseWarmup(spec, visit));
+    }
+    CHECK(entries == 2);
+
+    CHECK(ThreadCache::warmup(0, 10) == 0);
+    // 与 testStats 使用的大小类不同，不影响那里的未命中计数
+    const size_t size = 6000;
+    const size_t count = 200;
+    CHECK(ThreadCache::warmup(size, count) == count);
+    MemoryPoolStats before = ThreadCache::getStats();
+    std::vector<void *> ptrs;
+    for (size_t i = 0; i < count; i++)
+    {
+        ptrs.push_back(ThreadCache::getThreadCache()->allocate<void>(size));
+    }
+    MemoryPoolStats after = ThreadCache::getStats();
+    CHECK(after.pageCache.misses == before.pageCache.misses);
+    for (void *ptr : ptrs)
+    {
+        ThreadCache::getThreadCache()->deallocate(ptr);
+    }
+}
+
+// 其他线程不停地分配、释放时 fork：子进程中内存池的锁都已经释放，后台线程可以重新启动，
+// 父进程其他线程的内存块在子进程中释放后可以继续使用
+void testFork()
+{
+    std::atomic<bool> stop{false};
+    std::atomic<bool> published{false};
+    void *held[64] = {};
+    std::vector<std::thread> workers;
+    workers.emplace_back([&]() {
+        ThreadCache *threadCache = ThreadCache::getThreadCache();
+        for (void *&ptr : held)
+        {
+            ptr = threadCache->allocate<void>(100);
+        }
+        published.store(true, std::memory_order_release);
+        while (!stop.load(std::memory_order_acquire))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        for (void *ptr : held)
+        {
+            threadCache->deallocate(ptr);
+        }
+    });
+    for (size_t t = 0; t < 2; t++)
+    {
+        workers.emplace_back([&, t]() {
+            ThreadCache *threadCache = ThreadCache::getThreadCache();
+            for (size_t i = 0; !stop.load(std::memory_order_relaxed); i++)
+            {
+                size_t size = (i * 37 + t * 1000) % (MAX_BYTES / 8) + 1;
+                char *ptr = threadCache->allocate<char>(i % 64 == 0 ? 100 * PAGE_SIZE : size);
+                if (ptr)
+                    threadCache->deallocate(ptr);
+            }
+        });
+    }
+    while (!published.load(std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+    bool startedRefiller = CentralCache::startRefiller(20);
+
+    for (int round = 0; round < 20; round++)
+    {
+        fflush(nullptr);
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // 死锁时由 SIGALRM 结束子进程
+            alarm(10);
+            bool ok = true;
+            ThreadCache *threadCache = ThreadCache::getThreadCache();
+            if (round == 0)
+            {
+                for (void *ptr : held)
+                {
+                    threadCache->deallocate(ptr);
+                }
+            }
+            for (size_t i = 0; i < 2000; i++)
+            {
+                size_t size = i % 100 == 0 ? 100 * PAGE_SIZE : (i * 53) % MAX_BYTES + 1;
+                char *ptr = threadCache->allocate<char>(size);
+                ok = ok && ptr != nullptr;
+                if (ptr)
+                {
+                    memset(ptr, 0x5a, size);
+                    threadCache->deallocate(ptr);
+                }
+            }
+            ThreadCache::flushAll();
+            ok = ok && ThreadCache::getStats().threadCaches >= 1;
+            CentralCache::stopRefiller();
+            ok = ok && CentralCache::startRefiller(1);
+            CentralCache::stopRefiller();
+            ok = ok && PageCache::startScavenger(1);
+            PageCache::stopScavenger();
+            _exit(ok ? 0 : 1);
+        }
+        CHECK(pid > 0);
+        int status = 0;
+        CHECK(waitpid(pid, &status, 0) == pid);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    if (startedRefiller)
+        CentralCache::stopRefiller();
+    stop.store(true, std::memory_order_release);
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+// 统计信息：分配、释放次数与各层缓存中的内存块数一致
+void testStats()
+{
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+    size_t index = SizeClass::getIndex(3000);
+    MemoryPoolStats before = ThreadCache::getStats();
+    std::vector<void *> ptrs;
+    for (int i = 0; i < 200; i++)
+    {
+        ptrs.push_back(threadCache->allocate<void>(3000));
+    }
+    MemoryPoolStats during = ThreadCache::getStats();
+    CHECK(during.classes[index].allocs - before.classes[index].allocs == 200);
+    CHECK(during.classes[index].liveObjects >= 200);
+    CHECK(during.classes[index].frontMisses > before.classes[index].frontMisses || perCpuCache());
+    CHECK(during.threadCaches >= 1 && during.mappedBytes > 0 && during.rssBytes > 0);
+    CHECK(during.threadCache.hits + during.threadCache.misses > 0);
+
+    // 没有其他线程在分配时，各层的内存块加起来正好是Span切出的内存块
+    const ClassStats &c = during.classes[index];
+    size_t blocks = c.spans * (SizeClass::getSpanPages(index) * PAGE_SIZE / c.size);
+    CHECK(c.spans > 0 && c.spanBytes == c.spans * SizeClass::getSpanPages(index) * PAGE_SIZE);
+    CHECK(c.liveObjects + c.frontObjects + c.transferObjects + c.centralObjects == blocks);
+    CHECK(c.fragmentation() >= 0.0 && c.fragmentation() < 1.0);
+
+    for (void *ptr : ptrs)
+    {
+        threadCache->deallocate(ptr);
+    }
+    MemoryPoolStats after = ThreadCache::getStats();
+    CHECK(after.classes[index].frees - before.classes[index].frees == 200);
+    CHECK(after.classes[index].liveObjects + 200 == during.classes[index].liveObjects);
+
+    FILE *text = tmpfile();
+    FILE *json = tmpfile();
+    CHECK(text != nullptr && json != nullptr);
+    if (!text || !json)
+        return;
+    after.print(text);
+    after.printJson(json);
+    char buffer[256] = {};
+    rewind(json);
+    CHECK(fgets(buffer, sizeof(buffer), json) != nullptr && buffer[0] == '{');
+    CHECK(strstr(buffer, "\"thread_caches\"") != nullptr);
+    CHECK(ftell(text) > 0);
+    fclose(text);
+    fclose(json);
+}
+
+// 堆分析采样：采样的内存块记录在采样表中，释放后删除，可以导出 pprof 格式
+void testHeapProfiler()
+{
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+    HeapProfiler &profiler = HeapProfiler::getInstance();
+    // 新的采样间隔在当前倒计数用完后才生效，先分配足够多的字节用完采样关闭时的倒计数
+    HeapProfiler::setSampleRate(1024);
+    for (int i = 0; i < 64; i++)
+    {
+        threadCache->deallocate(threadCache->allocate<void>(PROFILE_RECHECK_BYTES / 32));
+    }
+
+    std::vector<void *> ptrs;
+    for (int i = 0; i < 1000; i++)
+    {
+        ptrs.push_back(threadCache->allocate<void>(64));
+    }
+    HeapProfiler::setSampleRate(0);
+    size_t sampled = 0;
+    for (void *ptr : ptrs)
+    {
+        sampled += profiler.isSampled(ptr);
+    }
+    // 平均每1024字节采样一次，64000字节大约采样62次
+    CHECK(sampled > 10 && sampled < 200);
+    CHECK(HeapProfiler::getSampleCount() >= sampled);
+
+    FILE *out = tmpfile();
+    CHECK(out != nullptr && profiler.writeProfile(out));
+    if (out)
+    {
+        char buffer[256] = {};
+        rewind(out);
+        CHECK(fgets(buffer, sizeof(buffer), out) != nullptr && strncmp(buffer, "heap profile: ", 14) == 0);
+        CHECK(strstr(buffer, "@ heap_v2/") != nullptr);
+        CHECK(fgets(buffer, sizeof(buffer), out) != nullptr && strstr(buffer, "@ 0x") != nullptr);
+        fclose(out);
+    }
+
+    size_t before = HeapProfiler::getSampleCount();
+    for (void *ptr : ptrs)
+    {
+        threadCache->deallocate(ptr);
+    }
+    CHECK(HeapProfiler::getSampleCount() + sampled <= before);
+    for (void *ptr : ptrs)
+    {
+        CHECK(!profiler.isSampled(ptr));
+    }
+}
+
+// 延迟直方图：分桶的误差在 1/8 以内，百分位数落在对应的桶；开启时慢路径会被计时
+void testLatencyHistogram()
+{
+    size_t last = 0;
+    for (uint64_t value = 0; value < (uint64_t(1) << 24); value += value / 16 + 1)
+    {
+        size_t bucket = LatencyHistogram::bucketOf(value);
+        CHECK(bucket >= last && bucket < LatencyHistogram::BUCKETS);
+        CHECK(LatencyHistogram::bucketMax(bucket) >= value);
+        CHECK(LatencyHistogram::bucketMax(bucket) <= value + value / 8);
+        last = bucket;
+    }
+    CHECK(LatencyHistogram::bucketOf(UINT64_MAX) == LatencyHistogram::BUCKETS - 1);
+
+    LatencyRecorder recorder;
+    for (int i = 0; i < 990; i++)
+    {
+        recorder.events[LATENCY_SPAN_FETCH].record(100, false);
+    }
+    for (int i = 0; i < 10; i++)
+    {
+        recorder.events[LATENCY_SPAN_FETCH].record(10000, false);
+    }
+    LatencyStats stats;
+    stats.add(recorder);
+    const LatencyStats::Event &event = stats.events[LATENCY_SPAN_FETCH];
+    CHECK(event.count == 1000 && event.max == 10000);
+    CHECK(event.percentile(0.5) >= 100 && event.percentile(0.5) <= 112);
+    CHECK(event.percentile(0.99) <= 112);
+    CHECK(event.percentile(0.999) == 10000);
+    CHECK(stats.events[LATENCY_LOCK_WAIT].count == 0 && stats.events[LATENCY_LOCK_WAIT].percentile(0.99) == 0);
+
+#if MEMPOOL_LATENCY_HISTOGRAM
+    LatencyStats before = ThreadCache::getLatencyStats();
+    // 没有缓存过的大小，一定向系统重新映射
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+    void *ptr = threadCache->allocate<void>(5 * DIRECT_MMAP_BYTES + 3 * PAGE_SIZE);
+    CHECK(ptr != nullptr);
+    threadCache->deallocate(ptr);
+    LatencyStats after = ThreadCache::getLatencyStats();
+    CHECK(after.events[LATENCY_SYSTEM_ALLOC].count > before.events[LATENCY_SYSTEM_ALLOC].count);
+    CHECK(after.events[LATENCY_SPAN_FREE].count > before.events[LATENCY_SPAN_FREE].count);
+    CHECK(after.events[LATENCY_FRONT_MISS].count > 0);
+    CHECK(after.events[LATENCY_SYSTEM_ALLOC].max > 0);
+
+    FILE *out = tmpfile();
+    CHECK(out != nullptr);
+    if (out)
+    {
+        after.print(out);
+        char buffer[256] = {};
+        rewind(out);
+        bool found = false;
+        while (fgets(buffer, sizeof(buffer), out))
+        {
+            found = found || strncmp(buffer, "system_alloc", 12) == 0;
+        }
+        CHECK(found);
+        fclose(out);
+    }
+#endif
+}
+
+// 批量分配、释放：内存块互不重叠，释放后可以再次分配
+void testBatch()
+{
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+    for (size_t size : {size_t(24), size_t(520), size_t(9000), MAX_BYTES + 1})
+    {
+        size_t n = size > MAX_BYTES ? 8 : 3000;
+        std::vector<void *> ptrs(n);
+        CHECK(threadCache->allocateBatch(size, n, ptrs.data()) == n);
+        std::set<void *> seen(ptrs.begin(), ptrs.end());
+        CHECK(seen.size() == n);
+        for (void *ptr : ptrs)
+        {
+            memset(ptr, 0x3C, size);
+            CHECK(PageCache::GetInstance().mapObjectToSpan(ptr)->objSize >= size);
+        }
+        threadCache->deallocateBatch(ptrs.data(), n, size);
+
+        // 批量释放的内存块可以再次批量分配，也可以逐个分配
+        std::vector<void *> again(n);
+        CHECK(threadCache->allocateBatch(size, n, again.data()) == n);
+        CHECK(std::set<void *>(again.begin(), again.end()).size() == n);
+        threadCache->deallocateBatch(again.data(), n, size);
+        void *single = threadCache->allocate<void>(size);
+        CHECK(single != nullptr);
+        threadCache->deallocate(single, size);
+    }
+    CHECK(threadCache->allocateBatch(size_t(64), 0, nullptr) == 0);
+    threadCache->deallocateBatch(nullptr, 0, size_t(64));
+
+    // 其他线程批量释放：与逐个释放一样经远程队列回到分配的线程缓存，下一次分配时被复用
+    // （取一个其他测试不用的大小类，Span还没有被多个线程缓存共用；数量不超过远程队列的上限）
+    const size_t size = 136;
+    const size_t count = REMOTE_FREE_BATCHES * SizeClass::getBatchNum(SizeClass::getIndex(Hardening::taggedSize(size)));
+    std::vector<void *> ptrs(count);
+    CHECK(threadCache->allocateBatch(size, count, ptrs.data()) == count);
+    std::thread([&ptrs, size, count]() {
+        ThreadCache *consumer = ThreadCache::getThreadCache();
+        consumer->deallocateBatch(ptrs.data(), count, size);
+        CHECK(consumer->getCachedBytes() == 0 || perCpuCache());
+    }).join();
+
+    std::set<void *> reused;
+    std::vector<void *> again;
+    for (size_t i = 0; i < 2 * count; i++)
+    {
+        void *ptr = threadCache->allocate<void>(size);
+        again.push_back(ptr);
+        reused.insert(ptr);
+    }
+    for (void *ptr : ptrs)
+    {
+        CHECK(reused.count(ptr) == 1 || perCpuCache());
+    }
+    threadCache->deallocateBatch(again.data(), again.size(), size);
+}
+
+// 单调分配区域：按对齐顺序分配，pmr 容器可以直接使用，release() 一次性归还所有Span
+void testMonotonicRegion()
+{
+    MonotonicRegion region;
+    char *last = nullptr;
+    for (int i = 0; i < 10000; i++)
+    {
+        size_t align = size_t(1) << (i % 7);
+        auto *ptr = static_cast<char *>(region.allocateAligned(24, align));
+        CHECK(ptr != nullptr && reinterpret_cast<uintptr_t>(ptr) % align == 0);
+        memset(ptr, 0x5C, 24);
+        CHECK(!last || ptr >= last + 24 || ptr < last);
+        last = ptr;
+    }
+    void *big = region.allocateAligned(3 * MAX_BYTES, PAGE_SIZE);
+    CHECK(big != nullptr && reinterpret_cast<uintptr_t>(big) % PAGE_SIZE == 0);
+    memset(big, 1, 3 * MAX_BYTES);
+    CHECK(region.allocateAligned(8) != nullptr);
+    CHECK(region.allocateAligned(0) != nullptr);
+    auto *pair = region.create<std::pair<int, int>>(1, 2);
+    CHECK(pair != nullptr && pair->second == 2);
+
+    {
+        std::pmr::vector<int> numbers(&region);
+        std::pmr::map<int, std::pmr::string> names(&region);
+        for (int i = 0; i < 5000; i++)
+        {
+            numbers.push_back(i);
+            names[i] = std::pmr::string("a fairly long string that does not fit in SSO", &region);
+        }
+        CHECK(numbers[4999] == 4999 && names[42].size() > 20);
+    }
+    CHECK(region.getReservedBytes() > 3 * MAX_BYTES);
+    region.release();
+    CHECK(region.getReservedBytes() == 0);
+    CHECK(region.allocateAligned(100) != nullptr);
+}
+
+// 编译期确定大小类的分配接口，以及标准库容器使用的 PoolAllocator
+void testPoolAllocator()
+{
+    struct Node
+    {
+        Node *next;
+        char payload[40];
+    };
+    struct alignas(64) Wide
+    {
+        char data[100];
+    };
+    struct Huge
+    {
+        char data[MAX_BYTES + 1];
+    };
+    ThreadCache *threadCache = ThreadCache::getThreadCache();
+
+    Node *node = threadCache->allocate<Node>();
+    CHECK(node != nullptr && PageCache::GetInstance().mapObjectToSpan(node)->objSize ==
+                                  SizeClass::roundUp(Hardening::taggedSize(sizeof(Node))));
+    threadCache->deallocateFixed<sizeof(Node)>(node);
+    CHECK(threadCache->allocate<Node>() == node);
+    threadCache->deallocate(node, sizeof(Node));
+
+    Wide *wide = threadCache->allocate<Wide>();
+    CHECK(wide != nullptr && reinterpret_cast<uintptr_t>(wide) % alignof(Wide) == 0);
+    threadCache->deallocateFixed<sizeof(Wide)>(wide);
+    Huge *huge = threadCache->allocate<Huge>();
+    CHECK(huge != nullptr && PageCache::GetInstance().mapObjectToSpan(huge)->objSize > MAX_BYTES);
+    huge->data[MAX_BYTES] = 1;
+    threadCache->deallocateFixed<sizeof(Huge)>(huge);
+
+    std::vector<Wide, PoolAllocator<Wide>> wides(1000);
+    CHECK(reinterpret_cast<uintptr_t>(wides.data()) % alignof(Wide) == 0);
+    std::vector<int, PoolAllocator<int>> numbers;
+    for (int i = 0; i < 100000; i++)
+    {
+        numbers.push_back(i);
+    }
+    CHECK(numbers[99999] == 99999);
+
+    std::map<int, int, std::less<int>, PoolAllocator<std::pair<const int, int>>> map;
+    std::list<Node, PoolAllocator<Node>> list;
+    for (int i = 0; i < 10000; i++)
+    {
+        map[i] = i * 2;
+        list.push_back(Node{nullptr, {static_cast<char>(i)}});
+    }
+    CHECK(map.size() == 10000 && map[1234] == 2468 && list.size() == 10000);
+    CHECK(PoolAllocator<int>() == PoolAllocator<Node>());
+}
+
+// 标准分配接口的语义；LD_PRELOAD 替换 malloc 后同样的检查由内存池完成
+void testMallocApi()
+{
+    for (size_t size : {size_t(1), size_t(24), size_t(100), size_t(5000), MAX_BYTES, 3 * MAX_BYTES})
+    {
+        auto *ptr = static_cast<unsigned char *>(malloc(size));
+        CHECK(ptr != nullptr && reinterpret_cast<uintptr_t>(ptr) % alignof(std::max_align_t) == 0);
+        CHECK(malloc_usable_size(ptr) >= size);
+        memset(ptr, 0xAB, size);
+        ptr = static_cast<unsigned char *>(realloc(ptr, size * 3));
+        CHECK(ptr != nullptr && ptr[0] == 0xAB && ptr[size - 1] == 0xAB);
+        free(ptr);
+
+        auto *zero = static_cast<unsigned char *>(calloc(size, 1));
+        CHECK(zero != nullptr && zero[0] == 0 && zero[size - 1] == 0);
+        free(zero);
+    }
+    for (size_t align : {size_t(16), size_t(64), size_t(256), PAGE_SIZE, 4 * PAGE_SIZE, size_t(2 * 1024 * 1024)})
+    {
+        void *ptr = nullptr;
+        CHECK(posix_memalign(&ptr, align, 100) == 0);
+        CHECK(reinterpret_cast<uintptr_t>(ptr) % align == 0 && malloc_usable_size(ptr) >= 100);
+        memset(ptr, 1, 100);
+        free(ptr);
+        ptr = aligned_alloc(align, align * 2);
+        CHECK(ptr != nullptr && reinterpret_cast<uintptr_t>(ptr) % align == 0);
+        free(ptr);
+    }
+    void *invalid = nullptr;
+    CHECK(posix_memalign(&invalid, 24, 100) == EINVAL);
+    CHECK(realloc(malloc(10), 0) == nullptr);
+    free(nullptr);
+
+    struct alignas(128) Aligned
+    {
+        char data[200];
+    };
+    auto *aligned = new Aligned[3];
+    CHECK(reinterpret_cast<uintptr_t>(aligned) % 128 == 0);
+    delete[] aligned;
+    auto *value = new size_t(7);
+    CHECK(*value == 7);
+    delete value;
+}
+
+// LD_PRELOAD 时：消费者线程 delete（带大小的 operator delete）的消息回到生产者的远程队列，被生产者复用
+void testPreloadRemoteDelete()
+{
+    // 内存池通过 LD_PRELOAD 替换了分配函数时才能找到导出的扩展接口
+    if (!dlsym(RTLD_DEFAULT, "mempool_stats") || perCpuCache())
+        return;
+    // 其他测试没有用过的大小类：被多个线程共用过的Span上的内存块留在释放线程，不会回到生产者
+    struct Message
+    {
+        char payload[1544];
+    };
+    constexpr size_t COUNT = 200;
+    std::vector<Message *> messages;
+    for (size_t i = 0; i < COUNT; i++)
+    {
+        messages.push_back(new Message());
+    }
+    std::atomic<bool> deleted{false};
+    std::atomic<bool> done{false};
+    // 消费者在生产者重新分配完之前不退出，线程退出时清空缓存不会让内存块回到生产者
+    std::thread consumer([&]() {
+        for (Message *message : messages)
+        {
+            delete message;
+        }
+        deleted.store(true, std::memory_order_release);
+        while (!done.load(std::memory_order_acquire))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    while (!deleted.load(std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+    std::set<Message *> reused;
+    std::vector<Message *> again;
+    for (size_t i = 0; i < 2 * COUNT; i++)
+    {
+        again.push_back(new Message());
+        reused.insert(again.back());
+    }
+    done.store(true, std::memory_order_release);
+    consumer.join();
+    size_t missing = 0;
+    for (Message *message : messages)
+    {
+        missing += reused.count(message) == 0;
+    }
+    CHECK(missing == 0);
+    for (Message *message : again)
+    {
+        delete message;
+    }
+}
+
+#if MEMPOOL_PERCPU_CACHE
+// 按CPU划分的缓存：线程在不同CPU之间迁移，同时分配释放，内存块不会被重复分配
+void testCpuCache()
+{
+    if (!CpuCache::enabled())
+        return;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    std::vector<std::thread> threads;
+    std::vector<int> errors(4, 0);
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([t, cpus, &errors]() {
+            ThreadCache *threadCache = ThreadCache::getThreadCache();
+            std::vector<unsigned char *> ptrs;
+            for (int round = 0; round < 50; round++)
+            {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET((t + round) % cpus, &set);
+                sched_setaffinity(0, sizeof(set), &set);
+                for (int i = 0; i < 300; i++)
+                {
+                    auto *ptr = threadCache->allocate<unsigned char>(size_t(40));
+                    memset(ptr, t + 1, 40);
+                    ptrs.push_back(ptr);
+                }
+                for (unsigned char *ptr : ptrs)
+                {
+                    if (ptr[0] != t + 1 || ptr[39] != t + 1)
+                        errors[t]++;
+                    threadCache->deallocate(ptr, size_t(40));
+                }
+                ptrs.clear();
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    for (int t = 0; t < 4; t++)
+    {
+        CHECK(errors[t] == 0);
+    }
+}
+#endif
+
+// 多线程并发分配写入后校验数据没有被其他线程覆盖
+void testConcurrent()
+{
+    constexpr int THREADS = 4;
+    constexpr int COUNT = 20000;
+    std::vector<std::thread> threads;
+    std::vector<int> errors(THREADS, 0);
+
+    for (int t = 0; t < THREADS; t++)
+    {
+        threads.emplace_back([t, &errors]() {
+            ThreadCache *threadCache = ThreadCache::getThreadCache();
+            std::vector<std::pair<unsigned char *, size_t>> blocks;
+            for (int i = 0; i < COUNT; i++)
+            {
+                size_t size = 8 + (i * 37) % 2048;
+                auto *ptr = threadCache->allocate<unsigned char>(size);
+                if (!ptr)
+                {
+                    errors[t]++;
+                    continue;
+                }
+                memset(ptr, t + 1, size);
+                blocks.push_back({ptr, size});
+                if (i % 3 == 0)
+                {
+                    auto block = blocks[blocks.size() / 2];
+                    blocks[blocks.size() / 2] = blocks.back();
+                    blocks.pop_back();
+                    for (size_t j = 0; j < block.second; j++)
+                    {
+                        if (block.first[j] != t + 1)
+                        {
+                            errors[t]++;
+                            break;
+                        }
+                    }
+                    threadCache->deallocate(block.first, block.second);
+                }
+            }
+            for (auto &block : blocks)
+            {
+                threadCache->deallocate(block.first, block.second);
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    for (int t = 0; t < THREADS; t++)
+    {
+        CHECK(errors[t] == 0);
+    }
+}
+
+int main()
+{
+    testSizeClass();
+    testObjectPool();
+    testPageCache();
+    testReadySpans();
+    testCoalesce();
+    testRelease();
+    testLargeSpans();
+    testNumaNodes();
+    testSpanReturn();
+    testLazyCarve();
+    testSpinLock();
+    testTransferCache();
+    testColdAllocation();
+    testReuse();
+    testSizeFreeDeallocate();
+    testRemoteFree();
+    testSpanOwner();
+    testThreadExitFlush();
+    testAlignedAllocate();
+    testReallocate();
+    testBatch();
+    testPoolAllocator();
+    testMonotonicRegion();
+    testConfig();
+    testHardening();
+    testWarmup();
+    testFork();
+    testStats();
+    testHeapProfiler();
+    testLatencyHistogram();
+    testMallocApi();
+    testPreloadRemoteDelete();
+#if MEMPOOL_PERCPU_CACHE
+    testCpuCache();
+#endif
+    testConcurrent();
+
+    if (g_failed)
+    {
+        std::cerr << g_failed << " 项检查失败" << std::endl;
+        return 1;
+    }
+    std::cout << "所有功能测试通过" << std::endl;
+    return 0;
+}